@@ -17,10 +17,12 @@
  * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307, USA
  */
 
+#include <stddef.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <assert.h>
+#include <errno.h>
 #include <string.h>
 
 #include <osmocom/core/msgb.h>
@@ -29,6 +31,9 @@
 
 #include "ccid_proto.h"
 #include "ccid_device.h"
+#ifdef OCTSIMFWBUILD
+#include "msgb_pool.h"
+#endif
 
 /* local, stand-alone definition of a USB control request */
 struct _usb_ctrl_req {
@@ -178,18 +183,33 @@ static uint8_t ccid_pc_to_rdr_get_seq(const struct ccid_pc_to_rdr *u)
  * Message generation / sending
  ***********************************************************************/
 
+/* msgb for a response; NULL if none is available, e.g. while a slow host leaves the
+ * previous responses in the pool. The response is dropped by ccid_send() then. */
 static struct msgb *ccid_msgb_alloc(void)
 {
-	struct msgb *msg = msgb_alloc(300, "ccid");
-	OSMO_ASSERT(msg);
-	return msg;
+#ifdef OCTSIMFWBUILD
+	/* msgb_free() returns it to the pool */
+	return msgb_pool_get(&g_ccid_msgb_pool);
+#else
+	return msgb_alloc(300, "ccid");
+#endif
 }
 
-/* Send given CCID message */
+/* Send given CCID message; a NULL message is a response which couldn't be allocated */
 static int ccid_send(struct ccid_instance *ci, struct msgb *msg)
 {
-	struct ccid_header *ch = (struct ccid_header *) msgb_ccid_in(msg);
-	struct ccid_slot *cs = get_ccid_slot(ci, ch->bSlot);
+	struct ccid_header *ch;
+	struct ccid_slot *cs;
+
+	if (!msg) {
+		/* the slot is not kept busy: the host sees a timeout and goes on */
+		ci->num_resp_dropped++;
+		LOGPCI(ci, LOGL_ERROR, "No msgb for the response, dropped\n");
+		return -ENOMEM;
+	}
+
+	ch = (struct ccid_header *) msgb_ccid_in(msg);
+	cs = get_ccid_slot(ci, ch->bSlot);
 	if (cs) {
 		LOGPCS(cs, LOGL_DEBUG, "Tx CCID(IN) %s %s\n",
 			get_value_string(ccid_msg_type_vals, ch->bMessageType), msgb_hexdump(msg));
@@ -203,10 +223,13 @@ static int ccid_send(struct ccid_instance *ci, struct msgb *msg)
 /* Send given CCID message for given slot; patch bSlot into message */
 int ccid_slot_send(struct ccid_slot *cs, struct msgb *msg)
 {
-	struct ccid_header *ch = (struct ccid_header *) msgb_ccid_in(msg);
+	struct ccid_header *ch;
 
-	/* patch bSlotNr into message */
-	ch->bSlot = cs->slot_nr;
+	if (msg) {
+		/* patch bSlotNr into message */
+		ch = (struct ccid_header *) msgb_ccid_in(msg);
+		ch->bSlot = cs->slot_nr;
+	}
 	return ccid_send(cs->ci, msg);
 }
 
@@ -223,10 +246,13 @@ static struct msgb *ccid_gen_data_block_nr(uint8_t slot_nr, uint8_t icc_status,
 					   const uint8_t *data, uint32_t data_len)
 {
 	struct msgb *msg = ccid_msgb_alloc();
-	struct ccid_rdr_to_pc_data_block *db =
-		(struct ccid_rdr_to_pc_data_block *) msgb_put(msg, sizeof(*db) + data_len);
+	struct ccid_rdr_to_pc_data_block *db;
 	uint8_t sts = (cmd_sts & CCID_CMD_STATUS_MASK) | icc_status;
 
+	if (!msg)
+		return NULL;
+	db = (struct ccid_rdr_to_pc_data_block *) msgb_put(msg, sizeof(*db) + data_len);
+
 	SET_HDR_IN(db, RDR_to_PC_DataBlock, slot_nr, seq, sts, err);
 	osmo_store32le(data_len, &db->hdr.hdr.dwLength);
 	memcpy(db->abData, data, data_len);
@@ -245,10 +271,13 @@ static struct msgb *ccid_gen_slot_status_nr(uint8_t slot_nr, uint8_t icc_status,
 					    enum ccid_error_code err)
 {
 	struct msgb *msg = ccid_msgb_alloc();
-	struct ccid_rdr_to_pc_slot_status *ss =
-		(struct ccid_rdr_to_pc_slot_status *) msgb_put(msg, sizeof(*ss));
+	struct ccid_rdr_to_pc_slot_status *ss;
 	uint8_t sts = (cmd_sts & CCID_CMD_STATUS_MASK) | icc_status;
 
+	if (!msg)
+		return NULL;
+	ss = (struct ccid_rdr_to_pc_slot_status *) msgb_put(msg, sizeof(*ss));
+
 	SET_HDR_IN(ss, RDR_to_PC_SlotStatus, slot_nr, seq, sts, err);
 	return msg;
 }
@@ -264,10 +293,14 @@ static struct msgb *ccid_gen_parameters_t0_nr(uint8_t slot_nr, uint8_t icc_statu
 					      const struct ccid_pars_decoded *dec_par)
 {
 	struct msgb *msg = ccid_msgb_alloc();
-	struct ccid_rdr_to_pc_parameters *par = (struct ccid_rdr_to_pc_parameters *)msgb_put(
-		msg, sizeof(par->hdr) + sizeof(par->bProtocolNum) + sizeof(par->abProtocolData.t0));
+	struct ccid_rdr_to_pc_parameters *par;
 	uint8_t sts = (cmd_sts & CCID_CMD_STATUS_MASK) | icc_status;
 
+	if (!msg)
+		return NULL;
+	par = (struct ccid_rdr_to_pc_parameters *) msgb_put(
+		msg, sizeof(par->hdr) + sizeof(par->bProtocolNum) + sizeof(par->abProtocolData.t0));
+
 	SET_HDR_IN(par, RDR_to_PC_Parameters, slot_nr, seq, sts, err);
 	par->bProtocolNum = CCID_PROTOCOL_NUM_T0;
 	if (dec_par) {
@@ -287,10 +320,14 @@ static struct msgb *ccid_gen_parameters_t1_nr(uint8_t slot_nr, uint8_t icc_statu
 					      const struct ccid_pars_decoded *dec_par)
 {
 	struct msgb *msg = ccid_msgb_alloc();
-	struct ccid_rdr_to_pc_parameters *par = (struct ccid_rdr_to_pc_parameters *)msgb_put(
-		msg, sizeof(par->hdr) + sizeof(par->bProtocolNum) + sizeof(par->abProtocolData.t1));
+	struct ccid_rdr_to_pc_parameters *par;
 	uint8_t sts = (cmd_sts & CCID_CMD_STATUS_MASK) | icc_status;
 
+	if (!msg)
+		return NULL;
+	par = (struct ccid_rdr_to_pc_parameters *) msgb_put(
+		msg, sizeof(par->hdr) + sizeof(par->bProtocolNum) + sizeof(par->abProtocolData.t1));
+
 	SET_HDR_IN(par, RDR_to_PC_Parameters, slot_nr, seq, sts, err);
 	par->bProtocolNum = CCID_PROTOCOL_NUM_T1;
 	if (dec_par) {
@@ -311,10 +348,13 @@ static struct msgb *ccid_gen_escape_nr(uint8_t slot_nr, uint8_t icc_status, uint
 					enum ccid_error_code err, const uint8_t *data, uint32_t data_len)
 {
 	struct msgb *msg = ccid_msgb_alloc();
-	struct ccid_rdr_to_pc_escape *esc =
-		(struct ccid_rdr_to_pc_escape *) msgb_put(msg, sizeof(*esc) + data_len);
+	struct ccid_rdr_to_pc_escape *esc;
 	uint8_t sts = (cmd_sts & CCID_CMD_STATUS_MASK) | icc_status;
 
+	if (!msg)
+		return NULL;
+	esc = (struct ccid_rdr_to_pc_escape *) msgb_put(msg, sizeof(*esc) + data_len);
+
 	SET_HDR_IN(esc, RDR_to_PC_Escape, slot_nr, seq, sts, err);
 	osmo_store32le(data_len, &esc->hdr.hdr.dwLength);
 	memcpy(esc->abData, data, data_len);
@@ -333,10 +373,13 @@ static struct msgb *ccid_gen_clock_and_rate_nr(uint8_t slot_nr, uint8_t icc_stat
 						uint32_t clock_khz, uint32_t rate_bps)
 {
 	struct msgb *msg = ccid_msgb_alloc();
-	struct ccid_rdr_to_pc_data_rate_and_clock *drc =
-		(struct ccid_rdr_to_pc_data_rate_and_clock *) msgb_put(msg, sizeof(*drc));
+	struct ccid_rdr_to_pc_data_rate_and_clock *drc;
 	uint8_t sts = (cmd_sts & CCID_CMD_STATUS_MASK) | icc_status;
 
+	if (!msg)
+		return NULL;
+	drc = (struct ccid_rdr_to_pc_data_rate_and_clock *) msgb_put(msg, sizeof(*drc));
+
 	SET_HDR_IN(drc, RDR_to_PC_DataRateAndClockFrequency, slot_nr, seq, sts, err);
 	osmo_store32le(8, &drc->hdr.hdr.dwLength); /* Message-specific data length (wtf?) */
 	osmo_store32le(clock_khz, &drc->dwClockFrequency); /* kHz */
@@ -580,8 +623,20 @@ static int ccid_handle_escape(struct ccid_slot *cs, struct msgb *msg)
 	const union ccid_pc_to_rdr *u = msgb_ccid_out(msg);
 	const struct ccid_header *ch = (const struct ccid_header *) u;
 	uint8_t seq = u->escape.hdr.bSeq;
+	uint32_t data_len = osmo_load32le(&ch->dwLength);
+	const struct ccid_instance *ci = cs->ci;
 	struct msgb *resp;
 
+	if (data_len >= 2 && u->escape.abData[0] == CCID_VESC_SET_IN_PRIO && ci->ops->set_in_prio) {
+		if (ci->ops->set_in_prio(cs->ci, cs->slot_nr, u->escape.abData[1]) < 0) {
+			/* bError: offset of the bad parameter */
+			resp = ccid_gen_escape(cs, seq, CCID_CMD_STATUS_FAILED,
+					       offsetof(struct ccid_pc_to_rdr_escape, abData) + 1, NULL, 0);
+		} else
+			resp = ccid_gen_escape(cs, seq, CCID_CMD_STATUS_OK, 0, NULL, 0);
+		return ccid_slot_send_unbusy(cs, resp);
+	}
+
 	resp = ccid_gen_escape(cs, seq, CCID_CMD_STATUS_FAILED, CCID_ERR_CMD_NOT_SUPPORTED, NULL, 0);
 	return ccid_slot_send_unbusy(cs, resp);
 }
@@ -950,6 +1005,7 @@ void ccid_instance_init(struct ccid_instance *ci, const struct ccid_ops *ops,
 	ci->data_rates = data_rates;
 	ci->name = name;
 	ci->priv = priv;
+	ci->num_resp_dropped = 0;
 
 	for (i = 0; i < ARRAY_SIZE(ci->slot); i++) {
 		struct ccid_slot *cs = &ci->slot[i];
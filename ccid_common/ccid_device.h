@@ -80,6 +80,20 @@ struct ccid_slot {
 	volatile void* event_data;
 };
 
+/* priority class of the responses of a slot on the IN endpoint */
+enum ccid_in_prio {
+	CCID_IN_PRIO_NORMAL,
+	/* latency sensitive, e.g. remote SIM authentication */
+	CCID_IN_PRIO_HIGH,
+	_NUM_CCID_IN_PRIO
+};
+
+/* vendor specific commands in abData[0] of PC_to_RDR_Escape */
+enum ccid_vendor_escape {
+	/* abData[1]: enum ccid_in_prio of the addressed slot */
+	CCID_VESC_SET_IN_PRIO	= 0x01,
+};
+
 /* CCID operations provided by USB transport layer */
 struct ccid_ops {
 	/* msgb ownership in below functions is transferred, i.e. whoever
@@ -87,6 +101,11 @@ struct ccid_ops {
 	 * once transmission on IN or INT EP has completed. */
 	int (*send_in)(struct ccid_instance *ci, struct msgb *msg);
 	int (*send_int)(struct ccid_instance *ci, struct msgb *msg);
+	/* optional: a slot has an event pending for slot_ops->handle_fsm_events(),
+	 * may be called from interrupt context */
+	void (*slot_event)(struct ccid_instance *ci, struct ccid_slot *cs);
+	/* optional: set the priority class of the responses of a slot */
+	int (*set_in_prio)(struct ccid_instance *ci, uint8_t slot_nr, enum ccid_in_prio prio);
 };
 
 /* CCID operations provided by actual slot hardware */
@@ -126,6 +145,8 @@ struct ccid_instance {
 	const char *name;
 	/* user-supplied opaque data */
 	void *priv;
+	/* responses dropped as no msgb was available for them */
+	uint32_t num_resp_dropped;
 };
 
 int ccid_slot_send(struct ccid_slot *cs, struct msgb *msg);
@@ -0,0 +1,137 @@
+/* Scheduler for the responses on the CCID IN endpoint
+ *
+ * All slots share one IN endpoint. If responses left in the order they were generated, a
+ * few slots streaming large responses would delay the small, latency critical responses of
+ * all other slots. Instead, each slot has its own queue, and the queues are served by
+ * deficit round robin: every slot gets to send CCID_IN_SCHED_QUANTUM bytes per round,
+ * so a response waits for at most one round of the other slots. Slots in a higher priority
+ * class (configured by the host through a vendor specific Escape) are served first.
+ *
+ * (C) 2019 by sysmocom - s.f.m.c. GmbH
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <errno.h>
+#include <osmocom/core/msgb.h>
+
+#include "ccid_in_sched.h"
+
+/* queue index of a response */
+static uint8_t msg_slot_nr(const struct msgb *msg)
+{
+	const struct ccid_header *ch = (const struct ccid_header *) msgb_data(msg);
+
+	/* error responses to invalid slot numbers go with slot 0 */
+	if (msgb_length(msg) < sizeof(*ch) || ch->bSlot >= NR_SLOTS)
+		return 0;
+	return ch->bSlot;
+}
+
+/* bit-mask of the slots in a priority class */
+static uint32_t prio_mask(const struct ccid_in_sched *s, enum ccid_in_prio prio)
+{
+	uint32_t mask = 0;
+	unsigned int i;
+
+	for (i = 0; i < NR_SLOTS; i++) {
+		if (s->prio[i] == prio)
+			mask |= (1 << i);
+	}
+	return mask;
+}
+
+void ccid_in_sched_init(struct ccid_in_sched *s)
+{
+	unsigned int i;
+
+	for (i = 0; i < NR_SLOTS; i++) {
+		INIT_LLIST_HEAD(&s->queue[i]);
+		s->deficit[i] = 0;
+		s->prio[i] = CCID_IN_PRIO_NORMAL;
+	}
+	s->active_mask = 0;
+	for (i = 0; i < _NUM_CCID_IN_PRIO; i++)
+		s->cur[i] = 0;
+}
+
+/*! Set the priority class of a slot; takes effect with its next response */
+int ccid_in_sched_set_prio(struct ccid_in_sched *s, uint8_t slot_nr, enum ccid_in_prio prio)
+{
+	if (slot_nr >= NR_SLOTS || prio >= _NUM_CCID_IN_PRIO)
+		return -EINVAL;
+	s->prio[slot_nr] = prio;
+	return 0;
+}
+
+/*! Append a response to the queue of its slot */
+void ccid_in_sched_enqueue(struct ccid_in_sched *s, struct msgb *msg)
+{
+	uint8_t slot_nr = msg_slot_nr(msg);
+
+	msgb_enqueue(&s->queue[slot_nr], msg);
+	s->active_mask |= (1 << slot_nr);
+}
+
+/*! Take the next response to be sent
+ *  \returns msgb; NULL if all queues are empty */
+struct msgb *ccid_in_sched_dequeue(struct ccid_in_sched *s)
+{
+	int prio;
+
+	for (prio = _NUM_CCID_IN_PRIO - 1; prio >= 0; prio--) {
+		uint32_t mask = s->active_mask & prio_mask(s, prio);
+		uint8_t n = s->cur[prio];
+
+		if (!mask)
+			continue;
+
+		while (true) {
+			if (mask & (1 << n)) {
+				struct msgb *msg = llist_entry(s->queue[n].next, struct msgb, list);
+
+				if (msgb_length(msg) <= s->deficit[n]) {
+					llist_del(&msg->list);
+					s->deficit[n] -= msgb_length(msg);
+					/* an idle slot doesn't save up for later */
+					if (llist_empty(&s->queue[n])) {
+						s->active_mask &= ~(1 << n);
+						s->deficit[n] = 0;
+					}
+					s->cur[prio] = n;
+					return msg;
+				}
+			}
+			/* the next slot of the class gets its quantum for this round */
+			do {
+				n = (n + 1) % NR_SLOTS;
+			} while (!(mask & (1 << n)));
+			s->deficit[n] += CCID_IN_SCHED_QUANTUM;
+		}
+	}
+	return NULL;
+}
+
+/*! Put back a response taken by ccid_in_sched_dequeue(), which could not be sent yet */
+void ccid_in_sched_return(struct ccid_in_sched *s, struct msgb *msg)
+{
+	uint8_t slot_nr = msg_slot_nr(msg);
+
+	llist_add(&msg->list, &s->queue[slot_nr]);
+	s->active_mask |= (1 << slot_nr);
+	s->deficit[slot_nr] += msgb_length(msg);
+}
+
+/*! Free all queued responses, e.g. on USB reset */
+void ccid_in_sched_flush(struct ccid_in_sched *s)
+{
+	struct msgb *msg;
+	unsigned int i;
+
+	for (i = 0; i < NR_SLOTS; i++) {
+		while ((msg = msgb_dequeue(&s->queue[i])))
+			msgb_free(msg);
+		s->deficit[i] = 0;
+	}
+	s->active_mask = 0;
+}
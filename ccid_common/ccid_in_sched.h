@@ -0,0 +1,43 @@
+#pragma once
+/* Scheduler for the responses on the CCID IN endpoint
+ *
+ * (C) 2019 by sysmocom - s.f.m.c. GmbH
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <osmocom/core/linuxlist.h>
+
+#include "ccid_device.h"
+
+/* bytes a slot may send per round: one message of the maximum size */
+#define CCID_IN_SCHED_QUANTUM	320
+
+/* Per-slot response queues, served by deficit round robin within each priority class; a
+ * class is only served while all higher ones are empty. Not interrupt safe. */
+struct ccid_in_sched {
+	/* responses of each slot, in the order they were generated */
+	struct llist_head queue[NR_SLOTS];
+	/* bytes each slot may still send in the current round */
+	uint32_t deficit[NR_SLOTS];
+	/* priority class of each slot */
+	enum ccid_in_prio prio[NR_SLOTS];
+	/* bit-mask of slots with a non-empty queue */
+	uint32_t active_mask;
+	/* slot currently served, per priority class */
+	uint8_t cur[_NUM_CCID_IN_PRIO];
+};
+
+void ccid_in_sched_init(struct ccid_in_sched *s);
+int ccid_in_sched_set_prio(struct ccid_in_sched *s, uint8_t slot_nr, enum ccid_in_prio prio);
+void ccid_in_sched_enqueue(struct ccid_in_sched *s, struct msgb *msg);
+struct msgb *ccid_in_sched_dequeue(struct ccid_in_sched *s);
+void ccid_in_sched_return(struct ccid_in_sched *s, struct msgb *msg);
+void ccid_in_sched_flush(struct ccid_in_sched *s);
+
+static inline bool ccid_in_sched_empty(const struct ccid_in_sched *s)
+{
+	return !s->active_mask;
+}
@@ -31,11 +31,24 @@
 #include <osmocom/core/fsm.h>
 
 #include "ccid_device.h"
+#include "ccid_slot_fsm.h"
 #include "cuart.h"
 #include "iso7816_fsm.h"
 #include "iso7816_3.h"
 
-#define FAKE_CCID_SETPARAMETERS
+/* after a PPS, only switch the UART to the new F and D; keep the card clock and the
+ * waiting time of the ATR instead of applying those of the SetParameters */
+#define PPS_KEEP_CLOCK_AND_WTIME
+/* activate the card as soon as it is inserted and answer the first IccPowerOn from the cached ATR */
+//#define PREFETCH_ATR_ON_INSERTION
+
+/* RST is held at least this long during an activation */
+#define RST_HOLD_MS		10
+
+/* failed exchanges at a negotiated rate after which we only allow the next lower D */
+#define ADAPT_ERRORS_STEP_DOWN	3
+/* successful TPDUs after which the error count is forgotten and a lowered D is raised again */
+#define ADAPT_TPDUS_STEP_UP	1000
 
 struct iso_fsm_slot {
 	/* CCID slot above us */
@@ -46,6 +59,28 @@ struct iso_fsm_slot {
 	struct card_uart *cuart;
 	/* bSeq of the operation currently in progress */
 	uint8_t seq;
+#ifdef PREFETCH_ATR_ON_INSERTION
+	/* activation on card insertion; no host command waits for it and the host sees the card
+	 * inactive (icc_powered stays false) until it sends IccPowerOn */
+	enum {
+		PREFETCH_NONE,
+		PREFETCH_REQUESTED,	/* card inserted, activation starts from the main loop */
+		PREFETCH_IN_RESET,	/* powered and clocked, RST held since rst_since */
+		PREFETCH_WAIT_ATR,	/* RST released, ATR not yet received */
+		PREFETCH_ATR_CACHED,	/* ATR received, not yet handed to the host */
+	} prefetch;
+	/* (low 32 bits of) jiffies at which RST was asserted */
+	uint32_t rst_since;
+	uint8_t atr_len;
+	uint8_t atr[33];
+#endif
+	/* power class the card is currently activated with */
+	enum card_uart_ctl power;
+	/* highest Di index we let the host negotiate, 0 = no limit; forgotten on card removal */
+	uint8_t di_limit;
+	/* failed/successful exchanges since the last adaptation of di_limit */
+	uint8_t err_count;
+	uint16_t ok_count;
 };
 
 struct iso_fsm_slot_instance {
@@ -72,7 +107,8 @@ static const uint8_t sysmousim_sjs1_atr[] = {
 		0x07, 0x18, 0x00, 0x00, 0x01, 0xA5 };
 
 static const struct ccid_pars_decoded iso_fsm_def_pars = {
-	.fi = 372,
+	/* indexes into the Fi/Di tables: F=372, D=1; ResetParameters sends them in a PPS */
+	.fi = 1,
 	.di = 1,
 	.clock_stop = CCID_CLOCK_STOP_NOTALLOWED,
 	.inverse_convention = false,
@@ -83,11 +119,174 @@ static const struct ccid_pars_decoded iso_fsm_def_pars = {
 	/* FIXME: T=1 */
 };
 
+/* Di index of the next lower (or higher) D value, 0 if there is none */
+static uint8_t iso_fsm_di_step(uint8_t di, bool up)
+{
+	uint8_t d = iso7816_3_di_table[di];
+	uint8_t best = 0;
+	int i;
+
+	for (i = 1; i < 16; i++) {
+		uint8_t cand = iso7816_3_di_table[i];
+		if (!cand)
+			continue;
+		if (up && cand > d && (!best || cand < iso7816_3_di_table[best]))
+			best = i;
+		if (!up && cand < d && (!best || cand > iso7816_3_di_table[best]))
+			best = i;
+	}
+	return best;
+}
+
+/* keep track of the error rate at the negotiated Di and lower/raise the Di the host may
+ * negotiate on the next activation accordingly */
+static void iso_fsm_slot_track_result(struct iso_fsm_slot *ss, uint8_t di, bool success)
+{
+	struct ccid_slot *cs = ss->cs;
+
+	/* the failure caused by a removal must not be charged to the next card */
+	if (!cs->icc_present)
+		return;
+
+	if (success) {
+		if (++ss->ok_count < ADAPT_TPDUS_STEP_UP)
+			return;
+		ss->ok_count = 0;
+		ss->err_count = 0;
+		if (ss->di_limit) {
+			ss->di_limit = iso_fsm_di_step(ss->di_limit, true);
+			LOGPCS(cs, LOGL_NOTICE, "raising Di limit to %u\n", iso7816_3_di_table[ss->di_limit]);
+		}
+		return;
+	}
+
+	/* nothing to fall back to at D=1 */
+	if (iso7816_3_di_table[di] <= 1)
+		return;
+
+	if (++ss->err_count < ADAPT_ERRORS_STEP_DOWN)
+		return;
+
+	ss->err_count = 0;
+	ss->ok_count = 0;
+	ss->di_limit = iso_fsm_di_step(di, false);
+	LOGPCS(cs, LOGL_NOTICE, "repeated errors at D=%u, limiting to D=%u\n",
+		iso7816_3_di_table[di], iso7816_3_di_table[ss->di_limit]);
+}
+
+/* a reset or deactivation takes the card back to Fd/Dd, and the results of the exchanges that
+ * follow are counted at those */
+static void iso_fsm_slot_reset_pars(struct ccid_slot *cs)
+{
+	cs->pars = *cs->default_pars;
+}
+
+/* deactivate the card; the caller reports the reason to the host */
+static void iso_fsm_slot_deactivate(struct iso_fsm_slot *ss)
+{
+	struct ccid_slot *cs = ss->cs;
+
+	card_uart_ctrl(ss->cuart, CUART_CTL_RST, true);
+	card_uart_ctrl(ss->cuart, CUART_CTL_POWER_5V0, false);
+	cs->icc_powered = false;
+	iso_fsm_slot_reset_pars(cs);
+}
+
 static void iso_fsm_slot_pre_proc_cb(struct ccid_slot *cs, struct msgb *msg)
 {
 	/* do nothing; real hardware would update the slot related state here */
 }
 
+/* first half of a cold activation: power and clock the card with RST asserted */
+static void iso_fsm_slot_activate(struct iso_fsm_slot *ss, enum card_uart_ctl cctl)
+{
+	iso_fsm_slot_reset_pars(ss->cs);
+	card_uart_ctrl(ss->cuart, CUART_CTL_RST, true);
+	osmo_fsm_inst_dispatch(ss->fi, ISO7816_E_RESET_ACT_IND, NULL);
+	card_uart_ctrl(ss->cuart, cctl, true);
+	osmo_fsm_inst_dispatch(ss->fi, ISO7816_E_POWER_UP_IND, NULL);
+	ss->power = cctl;
+	card_uart_ctrl(ss->cuart, CUART_CTL_CLOCK, true);
+}
+
+/* second half: release RST, the card answers with its ATR */
+static void iso_fsm_slot_release_reset(struct iso_fsm_slot *ss)
+{
+	osmo_fsm_inst_dispatch(ss->fi, ISO7816_E_RESET_REL_IND, NULL);
+	card_uart_ctrl(ss->cuart, CUART_CTL_RST, false);
+}
+
+/* cold activation with the given power class; the ATR is reported via iso_fsm_clot_user_cb */
+static void iso_fsm_slot_cold_reset(struct iso_fsm_slot *ss, enum card_uart_ctl cctl)
+{
+	struct ccid_slot *cs = ss->cs;
+
+	/* FIXME: do this via a FSM? */
+	iso_fsm_slot_activate(ss, cctl);
+	cs->icc_powered = true;
+#ifdef OCTSIMFWBUILD
+	delay_us(RST_HOLD_MS * 1000);
+#else
+	usleep(RST_HOLD_MS * 1000);
+#endif
+	iso_fsm_slot_release_reset(ss);
+}
+
+#ifdef PREFETCH_ATR_ON_INSERTION
+/* drop a prefetch; an activation in progress is stopped without telling anybody, as no host
+ * command is waiting for it */
+static void iso_fsm_slot_prefetch_abort(struct iso_fsm_slot *ss)
+{
+	struct ccid_slot *cs = ss->cs;
+
+	switch (ss->prefetch) {
+	case PREFETCH_IN_RESET:
+	case PREFETCH_WAIT_ATR:
+	case PREFETCH_ATR_CACHED:
+		card_uart_ctrl(ss->cuart, CUART_CTL_RST, true);
+		osmo_fsm_inst_dispatch(ss->fi, ISO7816_E_RESET_ACT_IND, NULL);
+		card_uart_ctrl(ss->cuart, CUART_CTL_POWER_5V0, false);
+		/* an ATR event not handled yet belongs to the prefetch as well */
+		if (ss->prefetch != PREFETCH_ATR_CACHED)
+			cs->event = 0;
+		break;
+	default:
+		break;
+	}
+	ss->prefetch = PREFETCH_NONE;
+}
+
+/* advance a prefetch, called from the main loop; RST is held for RST_HOLD_MS without blocking */
+static void iso_fsm_slot_prefetch_poll(struct iso_fsm_slot *ss)
+{
+	struct ccid_slot *cs = ss->cs;
+
+	switch (ss->prefetch) {
+	case PREFETCH_REQUESTED:
+		if (!cs->icc_present || cs->icc_powered || cs->cmd_busy) {
+			/* the host got there first */
+			ss->prefetch = PREFETCH_NONE;
+			break;
+		}
+		/* same power class as an IccPowerOn with automatic voltage selection */
+		LOGPCS(cs, LOGL_DEBUG, "card inserted, prefetching ATR\n");
+		iso_fsm_slot_activate(ss, CUART_CTL_POWER_5V0);
+		ss->rst_since = get_jiffies();
+		ss->prefetch = PREFETCH_IN_RESET;
+		break;
+	case PREFETCH_IN_RESET:
+		/* strictly more, the jiffy we asserted RST in may be almost over */
+		if ((uint32_t)get_jiffies() - ss->rst_since <= RST_HOLD_MS)
+			break;
+		ss->prefetch = PREFETCH_WAIT_ATR;
+		iso_fsm_slot_release_reset(ss);
+		break;
+	default:
+		break;
+	}
+}
+#endif
+
 static void iso_fsm_slot_icc_set_insertion_status(struct ccid_slot *cs, bool present) {
 	struct iso_fsm_slot *ss = ccid_slot2iso_fsm_slot(cs);
 
@@ -97,11 +296,22 @@ static void iso_fsm_slot_icc_set_insertion_status(struct ccid_slot *cs, bool pre
 	cs->icc_present = present;
 
 	if (!present) {
+		/* error history belongs to the card, not the slot */
+		ss->di_limit = 0;
+		ss->err_count = 0;
+		ss->ok_count = 0;
+#ifdef PREFETCH_ATR_ON_INSERTION
+		/* before the FSM reports the removal as an ATR error nobody asked for */
+		iso_fsm_slot_prefetch_abort(ss);
+#endif
 		osmo_fsm_inst_dispatch(ss->fi, ISO7816_E_CARD_REMOVAL, NULL);
-		card_uart_ctrl(ss->cuart, CUART_CTL_RST, true);
-		card_uart_ctrl(ss->cuart, CUART_CTL_POWER_5V0, false);
-		cs->icc_powered = false;
+		iso_fsm_slot_deactivate(ss);
 		cs->cmd_busy = false;
+#ifdef PREFETCH_ATR_ON_INSERTION
+	} else if (!cs->icc_powered && !cs->cmd_busy) {
+		/* started by iso_handle_fsm_events(), not from the card detection path */
+		ss->prefetch = PREFETCH_REQUESTED;
+#endif
 	}
 }
 
@@ -129,29 +339,38 @@ static void iso_fsm_slot_icc_power_on_async(struct ccid_slot *cs, struct msgb *m
 		cctl = CUART_CTL_POWER_5V0;
 	}
 
-	if (!cs->icc_powered) {
-		/* FIXME: do this via a FSM? */
-		card_uart_ctrl(ss->cuart, CUART_CTL_RST, true);
-		osmo_fsm_inst_dispatch(ss->fi, ISO7816_E_RESET_ACT_IND, NULL);
-		card_uart_ctrl(ss->cuart, cctl, true);
-		osmo_fsm_inst_dispatch(ss->fi, ISO7816_E_POWER_UP_IND, NULL);
+#ifdef PREFETCH_ATR_ON_INSERTION
+	if (ss->prefetch == PREFETCH_ATR_CACHED && ss->power == cctl) {
+		/* card was activated on insertion, hand out the ATR we already have */
+		LOGPCS(cs, LOGL_DEBUG, "answering power-up from cached ATR\n");
+		ss->prefetch = PREFETCH_NONE;
 		cs->icc_powered = true;
-		card_uart_ctrl(ss->cuart, CUART_CTL_CLOCK, true);
-	#ifdef OCTSIMFWBUILD
-		delay_us(10000);
-	#else
-		usleep(10000);
-	#endif
+		msgb_free(msg);
+		ccid_slot_send_unbusy(cs, ccid_gen_data_block(cs, ss->seq, CCID_CMD_STATUS_OK, 0,
+							      ss->atr, ss->atr_len));
+		return;
+	}
+	if (ss->prefetch == PREFETCH_WAIT_ATR && ss->power == cctl) {
+		/* activation already past RST, the ATR will be reported to the host */
+		ss->prefetch = PREFETCH_NONE;
+		cs->icc_powered = true;
+		msgb_free(msg);
+		return;
+	}
+	/* another voltage class, or not far enough to be worth keeping: start over */
+	iso_fsm_slot_prefetch_abort(ss);
+#endif
 
-		osmo_fsm_inst_dispatch(ss->fi, ISO7816_E_RESET_REL_IND, NULL);
-		card_uart_ctrl(ss->cuart, CUART_CTL_RST, false);
+	if (!cs->icc_powered) {
+		iso_fsm_slot_cold_reset(ss, cctl);
 	} else { /* warm reset */
+		iso_fsm_slot_reset_pars(cs);
 		card_uart_ctrl(ss->cuart, CUART_CTL_RST, true);
 		osmo_fsm_inst_dispatch(ss->fi, ISO7816_E_RESET_ACT_IND, NULL);
 	#ifdef OCTSIMFWBUILD
-		delay_us(10000);
+		delay_us(RST_HOLD_MS * 1000);
 	#else
-		usleep(10000);
+		usleep(RST_HOLD_MS * 1000);
 	#endif
 		osmo_fsm_inst_dispatch(ss->fi, ISO7816_E_RESET_REL_IND, NULL);
 		card_uart_ctrl(ss->cuart, CUART_CTL_RST, false);
@@ -190,6 +409,8 @@ static void iso_fsm_clot_user_cb(struct osmo_fsm_inst *fi, int event, int cause,
 		asm volatile("dmb st": : :"memory");
 #endif
 		cs->event = event;
+		if (cs->ci->ops->slot_event)
+			cs->ci->ops->slot_event(cs->ci, cs);
 		break;
 	default:
 		LOGPCS(cs, LOGL_NOTICE, "%s(event=%d, cause=%d, data=%p) unhandled\n",
@@ -203,6 +424,7 @@ static int iso_handle_fsm_events(struct ccid_slot *cs, bool enable)
 {
 	struct iso_fsm_slot *ss = ccid_slot2iso_fsm_slot(cs);
 	struct msgb *tpdu, *resp;
+	int tc1, frame;
 	volatile uint32_t event = cs->event;
 	volatile void * volatile data = cs->event_data;
 
@@ -215,12 +437,19 @@ static int iso_handle_fsm_events(struct ccid_slot *cs, bool enable)
 	case ISO7816_E_WTIME_EXP:
 		tpdu = data;
 		LOGPCS(cs, LOGL_DEBUG, "%s(event=%d, data=0)\n", __func__, event);
+		iso_fsm_slot_track_result(ss, cs->pars.di, false);
 
 		/* perform deactivation */
-		card_uart_ctrl(ss->cuart, CUART_CTL_RST, true);
-		card_uart_ctrl(ss->cuart, CUART_CTL_POWER_5V0, false);
-		cs->icc_powered = false;
-
+		iso_fsm_slot_deactivate(ss);
+
+#ifdef PREFETCH_ATR_ON_INSERTION
+		if (ss->prefetch == PREFETCH_WAIT_ATR) {
+			/* nobody asked for this activation, the host will power up again */
+			ss->prefetch = PREFETCH_NONE;
+			cs->event = 0;
+			break;
+		}
+#endif
 		resp = ccid_gen_data_block(cs, ss->seq, CCID_CMD_STATUS_FAILED, CCID_ERR_ICC_MUTE, 0, 0);
 		ccid_slot_send_unbusy(cs, resp);
 		cs->event = 0;
@@ -236,6 +465,28 @@ static int iso_handle_fsm_events(struct ccid_slot *cs, bool enable)
 		}
 
 		LOGPCS(cs, LOGL_DEBUG, "%s(event=%d, data=%s)\n", __func__, event, msgb_hexdump(tpdu));
+
+		/* extra guard time (TC1) applies to everything we send after the ATR; beyond what the
+		 * UART can do, the card is still used with the longest frame, as it always was */
+		tc1 = iso7816_3_atr_tc1(msgb_data(tpdu), msgb_length(tpdu));
+		tc1 = tc1 > 0 ? tc1 : 0;
+		frame = card_uart_ctrl(ss->cuart, CUART_CTL_CHAR_FRAME, iso7816_3_char_frame_etu(tc1, false));
+		if (frame < 0)
+			LOGPCS(cs, LOGL_ERROR, "can't set up extra guard time N=%d: %d\n", tc1, frame);
+		else if (frame < iso7816_3_char_frame_etu(tc1, false))
+			LOGPCS(cs, LOGL_NOTICE, "extra guard time N=%d too long for the UART, sending %d etu "
+				"frames\n", tc1, frame);
+		cs->pars.t0.guard_time_etu = tc1;
+#ifdef PREFETCH_ATR_ON_INSERTION
+		if (ss->prefetch == PREFETCH_WAIT_ATR) {
+			/* keep the ATR until the host asks for it */
+			ss->atr_len = OSMO_MIN(msgb_length(tpdu), sizeof(ss->atr));
+			memcpy(ss->atr, msgb_data(tpdu), ss->atr_len);
+			ss->prefetch = PREFETCH_ATR_CACHED;
+			cs->event = 0;
+			break;
+		}
+#endif
 		resp = ccid_gen_data_block(cs, ss->seq, CCID_CMD_STATUS_OK, 0, msgb_data(tpdu), msgb_length(tpdu));
 		ccid_slot_send_unbusy(cs, resp);
 		cs->event = 0;
@@ -245,10 +496,15 @@ static int iso_handle_fsm_events(struct ccid_slot *cs, bool enable)
 		LOGPCS(cs, LOGL_DEBUG, "%s(event=%d, data=%s)\n", __func__, event, msgb_hexdump(tpdu));
 
 		/* perform deactivation */
-		card_uart_ctrl(ss->cuart, CUART_CTL_RST, true);
-		card_uart_ctrl(ss->cuart, CUART_CTL_POWER_5V0, false);
-		cs->icc_powered = false;
+		iso_fsm_slot_deactivate(ss);
 
+#ifdef PREFETCH_ATR_ON_INSERTION
+		if (ss->prefetch == PREFETCH_WAIT_ATR) {
+			ss->prefetch = PREFETCH_NONE;
+			cs->event = 0;
+			break;
+		}
+#endif
 		resp = ccid_gen_data_block(cs, ss->seq, CCID_CMD_STATUS_FAILED, CCID_ERR_ICC_MUTE, msgb_data(tpdu), msgb_length(tpdu));
 		ccid_slot_send_unbusy(cs, resp);
 		cs->event = 0;
@@ -258,17 +514,17 @@ static int iso_handle_fsm_events(struct ccid_slot *cs, bool enable)
 		tpdu = data;
 		LOGPCS(cs, LOGL_DEBUG, "%s(event=%d, data=%s)\n", __func__, event,
 			msgb_hexdump(tpdu));
+		iso_fsm_slot_track_result(ss, cs->pars.di, true);
 		resp = ccid_gen_data_block(cs, ss->seq, CCID_CMD_STATUS_OK, 0, msgb_l4(tpdu), msgb_l4len(tpdu));
 		ccid_slot_send_unbusy(cs, resp);
 		cs->event = 0;
 		break;
 	case ISO7816_E_TPDU_FAILED_IND:
 		tpdu = data;
+		iso_fsm_slot_track_result(ss, cs->pars.di, false);
 
 		/* perform deactivation */
-		card_uart_ctrl(ss->cuart, CUART_CTL_RST, true);
-		card_uart_ctrl(ss->cuart, CUART_CTL_POWER_5V0, false);
-		cs->icc_powered = false;
+		iso_fsm_slot_deactivate(ss);
 
 		LOGPCS(cs, LOGL_DEBUG, "%s(event=%d, data=%s)\n", __func__, event, msgb_hexdump(tpdu));
 		/* FIXME: other error causes than card removal?*/
@@ -279,10 +535,6 @@ static int iso_handle_fsm_events(struct ccid_slot *cs, bool enable)
 	case ISO7816_E_PPS_DONE_IND:
 		tpdu = data;
 		/* pps was successful, so we know these values are fine */
-		uint16_t F = iso7816_3_fi_table[cs->proposed_pars.fi];
-		uint8_t D = iso7816_3_di_table[cs->proposed_pars.di];
-		uint32_t fmax = iso7816_3_fmax_table[cs->proposed_pars.fi];
-		uint8_t D_or_one = D > 0 ? D : 1;
 
 		/* 7816-3 5.2.3
 		 * No  information  shall  be  exchanged  when  switching  the
@@ -291,15 +543,19 @@ static int iso_handle_fsm_events(struct ccid_slot *cs, bool enable)
 		 * - after ATR while card is idle
 		 * - after PPS while card is idle
 		 */
-#ifndef FAKE_CCID_SETPARAMETERS
+#ifndef PPS_KEEP_CLOCK_AND_WTIME
+		uint8_t D = iso7816_3_di_table[cs->proposed_pars.di];
+		uint32_t fmax = iso7816_3_fmax_table[cs->proposed_pars.fi];
+		uint8_t D_or_one = D > 0 ? D : 1;
+
 		card_uart_ctrl(ss->cuart, CUART_CTL_SET_CLOCK_FREQ, fmax);
-		card_uart_ctrl(ss->cuart, CUART_CTL_SET_FD, F/D);
+		card_uart_ctrl(ss->cuart, CUART_CTL_SET_FD, cs->proposed_pars.fi << 4 | cs->proposed_pars.di);
 		card_uart_ctrl(ss->cuart, CUART_CTL_WTIME, cs->proposed_pars.t0.waiting_integer * 960 * D_or_one);
 
 		cs->pars = cs->proposed_pars;
 #else
 		//card_uart_ctrl(ss->cuart, CUART_CTL_SET_CLOCK_FREQ, fmax);
-		card_uart_ctrl(ss->cuart, CUART_CTL_SET_FD, F/D);
+		card_uart_ctrl(ss->cuart, CUART_CTL_SET_FD, cs->proposed_pars.fi << 4 | cs->proposed_pars.di);
 		//card_uart_ctrl(ss->cuart, CUART_CTL_WTIME, cs->proposed_pars.t0.waiting_integer);
 
 		cs->pars.fi = cs->proposed_pars.fi;
@@ -320,11 +576,10 @@ static int iso_handle_fsm_events(struct ccid_slot *cs, bool enable)
 		/* fall-through */
 	case ISO7816_E_PPS_FAILED_IND:
 		tpdu = data;
+		iso_fsm_slot_track_result(ss, cs->proposed_pars.di, false);
 
 		/* perform deactivation */
-		card_uart_ctrl(ss->cuart, CUART_CTL_RST, true);
-		card_uart_ctrl(ss->cuart, CUART_CTL_POWER_5V0, false);
-		cs->icc_powered = false;
+		iso_fsm_slot_deactivate(ss);
 
 		/* failed fi/di */
 		resp = ccid_gen_parameters_t0(cs, ss->seq, CCID_CMD_STATUS_FAILED, 10);
@@ -341,6 +596,9 @@ static int iso_handle_fsm_events(struct ccid_slot *cs, bool enable)
 	}
 
 out:
+#ifdef PREFETCH_ATR_ON_INSERTION
+	iso_fsm_slot_prefetch_poll(ss);
+#endif
 	card_uart_wtime_poll(ss->cuart);
 	return 0;
 }
@@ -387,9 +645,14 @@ static void iso_fsm_slot_set_power(struct ccid_slot *cs, bool enable)
 	if (enable) {
 		card_uart_ctrl(ss->cuart, CUART_CTL_POWER_5V0, true);
 		cs->icc_powered = true;
+		ss->power = CUART_CTL_POWER_5V0;
 	} else {
+#ifdef PREFETCH_ATR_ON_INSERTION
+		iso_fsm_slot_prefetch_abort(ss);
+#endif
 		card_uart_ctrl(ss->cuart, CUART_CTL_POWER_5V0, false);
 		cs->icc_powered = false;
+		iso_fsm_slot_reset_pars(cs);
 	}
 }
 
@@ -409,42 +672,84 @@ static void iso_fsm_slot_set_clock(struct ccid_slot *cs, enum ccid_clock_command
 	}
 }
 
+/* exchange a PPS for cs->proposed_pars with the activated card, the result is reported like
+ * that of a SetParameters with the given bSeq */
+static void iso_fsm_slot_start_pps(struct iso_fsm_slot *ss, uint8_t seq)
+{
+	struct ccid_slot *cs = ss->cs;
+	uint8_t PPS1;
+
+	ss->seq = seq;
+
+	/* don't go back to a rate this card failed at before */
+	if (ss->di_limit && iso7816_3_di_table[cs->proposed_pars.di] > iso7816_3_di_table[ss->di_limit]) {
+		LOGPCS(cs, LOGL_NOTICE, "limiting D=%u to D=%u\n", iso7816_3_di_table[cs->proposed_pars.di],
+			iso7816_3_di_table[ss->di_limit]);
+		cs->proposed_pars.di = ss->di_limit;
+	}
+	PPS1 = (cs->proposed_pars.fi << 4 | cs->proposed_pars.di);
+
+	/* When using D=64, the interface device shall ensure a delay of at least 16 etu between the
+	 * leading edge of the last received character and the leading edge of the character transmitted
+	 * for initiating a command: the cuart driver extends its rx -> tx delay accordingly */
+
+	LOGPCS(cs, LOGL_DEBUG, "scheduling PPS transfer, PPS1: %2x\n", PPS1);
+
+	/* pass PPS1 instead of msgb */
+	osmo_fsm_inst_dispatch(ss->fi, ISO7816_E_XCEIVE_PPS_CMD, (void *)(uintptr_t)PPS1);
+
+	/* continues in iso_fsm_clot_user_cb once response/error/timeout is received */
+}
+
 static int iso_fsm_slot_set_params(struct ccid_slot *cs, uint8_t seq, enum ccid_protocol_num proto,
 				const struct ccid_pars_decoded *pars_dec)
 {
 	struct iso_fsm_slot *ss = ccid_slot2iso_fsm_slot(cs);
-	uint8_t PPS1 = (pars_dec->fi << 4 | pars_dec->di);
+	int frame;
 
 	/* see 6.1.7 for error offsets */
 	if(proto != CCID_PROTOCOL_NUM_T0)
 		return -7;
 
-	if(pars_dec->t0.guard_time_etu != 0)
-		return -12;
-
 	if(pars_dec->clock_stop != CCID_CLOCK_STOP_NOTALLOWED)
 		return -14;
 
-	ss->seq = seq;
+	/* the PPS is exchanged with an activated card only */
+	if (!cs->icc_powered)
+		return -CCID_ERR_ICC_MUTE;
 
-	/* FIXME:
-	When  using  D=64,  the  interface  device  shall  ensure  a  delay
-	  of  at  least  16  etu  between  the  leading  edge  of  the last
-	   received character and the leading edge of the character transmitted
-	    for initiating a command.
-	    -> we can't really do 4 stop bits?!
-	*/
+	/* nothing is changed before this point, a rejected request leaves the slot as it was */
 
-	LOGPCS(cs, LOGL_DEBUG, "scheduling PPS transfer, PPS1: %2x\n", PPS1);
+	/* bGuardTimeT0 is TC1 of the ATR and applies immediately, independent of PPS */
+	frame = card_uart_ctrl(ss->cuart, CUART_CTL_CHAR_FRAME,
+			       iso7816_3_char_frame_etu(pars_dec->t0.guard_time_etu, false));
+	if (frame < 0)
+		return -12;
+	if (frame < iso7816_3_char_frame_etu(pars_dec->t0.guard_time_etu, false))
+		LOGPCS(cs, LOGL_NOTICE, "extra guard time N=%u too long for the UART, sending %d etu frames\n",
+			pars_dec->t0.guard_time_etu, frame);
+	cs->pars.t0.guard_time_etu = pars_dec->t0.guard_time_etu;
 
-#ifdef FAKE_CCID_SETPARAMETERS
-	ccid_slot_send_unbusy(cs, ccid_gen_parameters_t0(cs, ss->seq, CCID_CMD_STATUS_OK, 0));
-#else
-	/* pass PPS1 instead of msgb */
-	osmo_fsm_inst_dispatch(ss->fi, ISO7816_E_XCEIVE_PPS_CMD, (void*)PPS1);
-#endif
+	iso_fsm_slot_start_pps(ss, seq);
+	return 0;
+}
 
-	/* continues in iso_fsm_clot_user_cb once response/error/timeout is received */
+/*! Negotiate Fi/Di with a PPS exchange right after the ATR, like a SetParameters of the host;
+ *  for the slot benchmark of the firmware. Like a CCID command, it needs an idle slot, which
+ *  stays busy until the RDR_to_PC_Parameters response with the given bSeq.
+ *  \returns 0 if the PPS was started; negative on error */
+int iso_fsm_slot_pps(struct ccid_slot *cs, uint8_t seq, uint8_t fi, uint8_t di)
+{
+	struct iso_fsm_slot *ss = ccid_slot2iso_fsm_slot(cs);
+
+	if (cs->cmd_busy || !cs->icc_powered)
+		return -EBUSY;
+
+	cs->cmd_busy = true;
+	cs->proposed_pars = cs->pars;
+	cs->proposed_pars.fi = fi;
+	cs->proposed_pars.di = di;
+	iso_fsm_slot_start_pps(ss, seq);
 	return 0;
 }
 
@@ -0,0 +1,13 @@
+#pragma once
+/* CCID slot on top of the ISO 7816-3 FSM and a card UART
+ *
+ * (C) 2019 by sysmocom - s.f.m.c. GmbH
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <stdint.h>
+
+#include "ccid_device.h"
+
+int iso_fsm_slot_pps(struct ccid_slot *cs, uint8_t seq, uint8_t fi, uint8_t di);
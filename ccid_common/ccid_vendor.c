@@ -0,0 +1,300 @@
+/* Vendor specific bulk protocol to the CCID slots, see ccid_vendor.h
+ *
+ * The commands are converted in place to the corresponding CCID messages and handed to the
+ * CCID layer like those of the CCID interface, each with a bSeq of its own. The response
+ * with that bSeq is taken back from the CCID layer before it reaches the CCID IN endpoint,
+ * and converted in place to a response frame.
+ *
+ * (C) 2019 by sysmocom - s.f.m.c. GmbH
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <stddef.h>
+#include <string.h>
+
+#include <osmocom/core/msgb.h>
+#include <osmocom/core/utils.h>
+#include <osmocom/core/logging.h>
+
+#include "ccid_proto.h"
+#include "ccid_device.h"
+#include "ccid_vendor.h"
+#ifdef OCTSIMFWBUILD
+#include "msgb_pool.h"
+#endif
+
+/* the CCID header of a command is that much longer than struct ccid_vendor_hdr */
+#define CCID_VENDOR_HDR_GROWTH	(sizeof(struct ccid_pc_to_rdr_xfr_block) - sizeof(struct ccid_vendor_hdr))
+
+/* msgb for a frame; NULL if none is available. Received commands must leave enough for the
+ * responses of all slots, while responses may take the last one. */
+static struct msgb *ccid_vendor_msgb_alloc(bool is_cmd)
+{
+#ifdef OCTSIMFWBUILD
+	if (is_cmd && g_ccid_msgb_pool.avail <= NR_SLOTS)
+		return NULL;
+	return msgb_pool_get(&g_ccid_msgb_pool);
+#else
+	return msgb_alloc(300, "ccid_vendor");
+#endif
+}
+
+static int ccid_vendor_send_err(struct ccid_vendor *cv, struct msgb *msg, uint8_t slot_nr,
+				uint16_t tag, uint8_t err)
+{
+	struct ccid_vendor_hdr *vh;
+
+	msgb_trim(msg, 0);
+	vh = (struct ccid_vendor_hdr *) msgb_put(msg, sizeof(*vh));
+	vh->type = CCID_VND_RSP_ERR;
+	vh->slot = slot_nr;
+	osmo_store16le(tag, &vh->tag);
+	osmo_store16le(1, &vh->len);
+	msgb_put_u8(msg, err);
+	return cv->send(cv, msg);
+}
+
+/* check the header of a received command
+ * \returns 0 if valid; offset of the bad field otherwise */
+static int ccid_vendor_check_hdr(const struct ccid_vendor_hdr *vh)
+{
+	uint16_t len = osmo_load16le(&vh->len);
+
+	switch (vh->type) {
+	case CCID_VND_POWER_ON:
+		if (len > 1)
+			return offsetof(struct ccid_vendor_hdr, len);
+		break;
+	case CCID_VND_POWER_OFF:
+		if (len != 0)
+			return offsetof(struct ccid_vendor_hdr, len);
+		break;
+	case CCID_VND_XFR:
+		if (len > CCID_VENDOR_MAX_DATA)
+			return offsetof(struct ccid_vendor_hdr, len);
+		break;
+	default:
+		return offsetof(struct ccid_vendor_hdr, type);
+	}
+	if (vh->slot >= NR_SLOTS)
+		return offsetof(struct ccid_vendor_hdr, slot);
+	return 0;
+}
+
+/* split the received OUT transfers into commands, as long as there are msgbs for them */
+static void ccid_vendor_parse(struct ccid_vendor *cv)
+{
+	while (!llist_empty(&cv->rx_queue)) {
+		struct msgb *msg = llist_entry(cv->rx_queue.next, struct msgb, list);
+
+		while (msgb_length(msg)) {
+			struct msgb *frame = cv->rx_frame;
+			struct ccid_vendor_hdr *vh;
+			unsigned int want, n;
+			int bad;
+
+			if (!frame) {
+				if (cv->num_queued >= CCID_VENDOR_MAX_QUEUED)
+					return;
+				frame = ccid_vendor_msgb_alloc(true);
+				if (!frame)
+					return;
+				/* room to grow the header into the CCID one */
+				msgb_reserve(frame, CCID_VENDOR_HDR_GROWTH);
+				cv->rx_frame = frame;
+			}
+
+			vh = (struct ccid_vendor_hdr *) msgb_data(frame);
+			if (msgb_length(frame) < sizeof(*vh))
+				want = sizeof(*vh) - msgb_length(frame);
+			else
+				want = sizeof(*vh) + osmo_load16le(&vh->len) - msgb_length(frame);
+			n = OSMO_MIN(want, msgb_length(msg));
+			memcpy(msgb_put(frame, n), msgb_data(msg), n);
+			msgb_pull(msg, n);
+
+			if (msgb_length(frame) == sizeof(*vh) && (bad = ccid_vendor_check_hdr(vh))) {
+				LOGP(DCCID, LOGL_ERROR, "vendor: bad command %s\n", msgb_hexdump(frame));
+				cv->rx_frame = NULL;
+				ccid_vendor_send_err(cv, frame, vh->slot, osmo_load16le(&vh->tag), bad);
+				/* no way to find the next command */
+				break;
+			}
+			if (msgb_length(frame) == sizeof(*vh) + osmo_load16le(&vh->len)) {
+				cv->rx_frame = NULL;
+				msgb_enqueue(&cv->slot[vh->slot].cmd_queue, frame);
+				cv->num_queued++;
+			}
+		}
+
+		llist_del(&msg->list);
+		msgb_free(msg);
+	}
+}
+
+/* hand the next command of a slot to the CCID layer, if the slot is idle */
+static void ccid_vendor_dispatch(struct ccid_vendor *cv, uint8_t slot_nr)
+{
+	struct ccid_vendor_slot *vs = &cv->slot[slot_nr];
+	struct ccid_slot *cs = &cv->ci->slot[slot_nr];
+	struct ccid_vendor_hdr *vh;
+	union ccid_pc_to_rdr *u;
+	struct msgb *msg;
+	uint8_t type, pwrsel = 0;
+	uint16_t tag, len;
+
+	if (vs->active || cs->cmd_busy || llist_empty(&vs->cmd_queue))
+		return;
+	msg = msgb_dequeue(&vs->cmd_queue);
+	cv->num_queued--;
+
+	vh = (struct ccid_vendor_hdr *) msgb_data(msg);
+	type = vh->type;
+	tag = osmo_load16le(&vh->tag);
+	len = osmo_load16le(&vh->len);
+	if (type == CCID_VND_POWER_ON && len)
+		pwrsel = vh->data[0];
+
+	/* the data of an XfrBlock directly follows the CCID header */
+	u = (union ccid_pc_to_rdr *) msgb_push(msg, CCID_VENDOR_HDR_GROWTH);
+	memset(u, 0, sizeof(u->xfr_block));
+	switch (type) {
+	case CCID_VND_POWER_ON:
+		u->icc_power_on.hdr.bMessageType = PC_to_RDR_IccPowerOn;
+		u->icc_power_on.bPowerSelect = pwrsel;
+		msgb_trim(msg, sizeof(u->icc_power_on));
+		len = 0;
+		break;
+	case CCID_VND_POWER_OFF:
+		u->icc_power_off.hdr.bMessageType = PC_to_RDR_IccPowerOff;
+		msgb_trim(msg, sizeof(u->icc_power_off));
+		break;
+	case CCID_VND_XFR:
+		u->xfr_block.hdr.bMessageType = PC_to_RDR_XfrBlock;
+		break;
+	}
+	osmo_store32le(len, &u->xfr_block.hdr.dwLength);
+	u->xfr_block.hdr.bSlot = slot_nr;
+	u->xfr_block.hdr.bSeq = cv->seq++;
+
+	vs->active = true;
+	vs->tag = tag;
+	vs->seq = u->xfr_block.hdr.bSeq;
+	ccid_handle_out(cv->ci, msg);
+}
+
+/*! Initialize the vendor protocol state of a CCID instance */
+void ccid_vendor_init(struct ccid_vendor *cv, struct ccid_instance *ci,
+		      int (*send)(struct ccid_vendor *cv, struct msgb *msg))
+{
+	unsigned int i;
+
+	cv->ci = ci;
+	cv->send = send;
+	INIT_LLIST_HEAD(&cv->rx_queue);
+	cv->rx_frame = NULL;
+	cv->num_queued = 0;
+	cv->seq = 0;
+	for (i = 0; i < NR_SLOTS; i++) {
+		INIT_LLIST_HEAD(&cv->slot[i].cmd_queue);
+		cv->slot[i].active = false;
+	}
+}
+
+/*! Take a received OUT transfer; it is parsed by ccid_vendor_poll() */
+void ccid_vendor_rx(struct ccid_vendor *cv, struct msgb *msg)
+{
+	msgb_enqueue(&cv->rx_queue, msg);
+}
+
+/*! Parse the received OUT transfers and hand the commands to the idle slots. To be called
+ *  after the slots made progress or msgbs were freed, not from within the CCID layer. */
+void ccid_vendor_poll(struct ccid_vendor *cv)
+{
+	unsigned int i;
+
+	ccid_vendor_parse(cv);
+
+	for (i = 0; i < NR_SLOTS; i++) {
+		struct ccid_vendor_slot *vs = &cv->slot[i];
+
+		/* the slot gave up on the command without a response, e.g. on card removal */
+		if (vs->active && !cv->ci->slot[i].cmd_busy) {
+			struct msgb *msg = ccid_vendor_msgb_alloc(false);
+			if (!msg)
+				continue;
+			vs->active = false;
+			ccid_vendor_send_err(cv, msg, i, vs->tag, CCID_ERR_ICC_MUTE);
+		}
+		ccid_vendor_dispatch(cv, i);
+	}
+
+	/* dispatching made room in the queues */
+	ccid_vendor_parse(cv);
+}
+
+/*! Take the response to a command of the vendor protocol from the CCID layer.
+ *  \param[in] msg response on its way to the CCID IN endpoint
+ *  \returns true if it was one, ownership of msg is transferred then */
+bool ccid_vendor_handle_resp(struct ccid_vendor *cv, struct msgb *msg)
+{
+	const struct ccid_header_in *chi = (const struct ccid_header_in *) msgb_data(msg);
+	struct ccid_vendor_slot *vs;
+	struct ccid_vendor_hdr *vh;
+	uint8_t slot_nr, sts, err;
+
+	if (msgb_length(msg) < sizeof(struct ccid_rdr_to_pc_slot_status) || chi->hdr.bSlot >= NR_SLOTS)
+		return false;
+	slot_nr = chi->hdr.bSlot;
+	vs = &cv->slot[slot_nr];
+	if (!vs->active || chi->hdr.bSeq != vs->seq)
+		return false;
+
+	sts = chi->bStatus & CCID_CMD_STATUS_MASK;
+	err = chi->bError;
+	if (cv->ci->slot[slot_nr].cmd_busy) {
+		/* the host of the vendor protocol just waits */
+		if (sts == CCID_CMD_STATUS_TIME_EXT) {
+			msgb_free(msg);
+			return true;
+		}
+		/* a command of the CCID interface rejected as busy, with the same bSeq */
+		return false;
+	}
+	vs->active = false;
+
+	if (sts != CCID_CMD_STATUS_OK) {
+		ccid_vendor_send_err(cv, msg, slot_nr, vs->tag, err);
+		return true;
+	}
+
+	/* DataBlock and SlotStatus have the same header length, the data follows */
+	vh = (struct ccid_vendor_hdr *) msgb_pull(msg, CCID_VENDOR_HDR_GROWTH);
+	vh->type = CCID_VND_RSP_OK;
+	vh->slot = slot_nr;
+	osmo_store16le(vs->tag, &vh->tag);
+	osmo_store16le(msgb_length(msg) - sizeof(*vh), &vh->len);
+	cv->send(cv, msg);
+	return true;
+}
+
+/*! Drop all commands and received data, e.g. on USB reset */
+void ccid_vendor_reset(struct ccid_vendor *cv)
+{
+	struct msgb *msg;
+	unsigned int i;
+
+	while ((msg = msgb_dequeue(&cv->rx_queue)))
+		msgb_free(msg);
+	if (cv->rx_frame) {
+		msgb_free(cv->rx_frame);
+		cv->rx_frame = NULL;
+	}
+	for (i = 0; i < NR_SLOTS; i++) {
+		while ((msg = msgb_dequeue(&cv->slot[i].cmd_queue)))
+			msgb_free(msg);
+		cv->slot[i].active = false;
+	}
+	cv->num_queued = 0;
+}
@@ -0,0 +1,100 @@
+#pragma once
+/* Vendor specific bulk protocol to the CCID slots
+ *
+ * CCID allows one command per slot at a time, and host drivers serialize the commands of
+ * all slots of a reader. Hosts driving many slots at a high rate may use this protocol on
+ * the vendor specific interface instead. It carries frames, packed back to back in both
+ * directions, so that one USB transfer carries as many of them as fit:
+ *
+ *   struct ccid_vendor_hdr, all fields little endian, followed by len bytes of data
+ *
+ * Commands (host -> device, bulk OUT):
+ *   CCID_VND_POWER_ON	data: none or bPowerSelect as in PC_to_RDR_IccPowerOn
+ *   CCID_VND_POWER_OFF	data: none
+ *   CCID_VND_XFR	data: TPDU, as in PC_to_RDR_XfrBlock
+ *
+ * Responses (device -> host, bulk IN), with slot and tag of their command:
+ *   CCID_VND_RSP_OK	data: ATR (power on), response TPDU (xfr), none (power off)
+ *   CCID_VND_RSP_ERR	data: bError as in the CCID responses; for a malformed command,
+ *			the offset of the bad field in struct ccid_vendor_hdr
+ *
+ * Any number of commands may be outstanding per slot, they are executed in order. The tag
+ * is chosen by the host and only echoed. Commands may straddle OUT transfers. Responses
+ * never straddle IN transfers, which hold up to CCID_VENDOR_MAX_XFER bytes; the host reads
+ * with buffers at least that large. After a malformed command, the rest of its OUT
+ * transfer is dropped.
+ *
+ * The slots are shared with the CCID interface: a command waits until the slot is idle,
+ * and commands of the CCID interface are rejected as busy while a vendor command runs.
+ *
+ * (C) 2019 by sysmocom - s.f.m.c. GmbH
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <osmocom/core/linuxlist.h>
+
+#include "ccid_device.h"
+
+enum ccid_vendor_type {
+	CCID_VND_POWER_ON	= 0x01,
+	CCID_VND_POWER_OFF	= 0x02,
+	CCID_VND_XFR		= 0x03,
+	CCID_VND_RSP_OK		= 0x81,
+	CCID_VND_RSP_ERR	= 0x82,
+};
+
+struct ccid_vendor_hdr {
+	uint8_t type;		/* enum ccid_vendor_type */
+	uint8_t slot;
+	uint16_t tag;
+	uint16_t len;
+	uint8_t data[0];
+} __attribute__ ((packed));
+
+/* largest data of a command, as dwMaxCCIDMessageLength of the CCID interface */
+#define CCID_VENDOR_MAX_DATA	262
+/* largest IN transfer */
+#define CCID_VENDOR_MAX_XFER	320
+/* commands received but not yet handed to their slot, over all slots */
+#define CCID_VENDOR_MAX_QUEUED	8
+
+struct ccid_vendor_slot {
+	/* received commands, waiting for the slot */
+	struct llist_head cmd_queue;
+	/* a command was handed to the CCID layer, its response is pending */
+	bool active;
+	/* tag and bSeq of that command */
+	uint16_t tag;
+	uint8_t seq;
+};
+
+struct ccid_vendor {
+	struct ccid_instance *ci;
+	/* transmit a frame on the IN endpoint; ownership of the msgb is transferred */
+	int (*send)(struct ccid_vendor *cv, struct msgb *msg);
+	/* received OUT transfers, not yet parsed into commands */
+	struct llist_head rx_queue;
+	/* command being reassembled from the OUT transfers */
+	struct msgb *rx_frame;
+	/* number of commands in the cmd_queue of all slots */
+	unsigned int num_queued;
+	/* bSeq of the next command handed to the CCID layer */
+	uint8_t seq;
+	struct ccid_vendor_slot slot[NR_SLOTS];
+};
+
+void ccid_vendor_init(struct ccid_vendor *cv, struct ccid_instance *ci,
+		      int (*send)(struct ccid_vendor *cv, struct msgb *msg));
+void ccid_vendor_rx(struct ccid_vendor *cv, struct msgb *msg);
+void ccid_vendor_poll(struct ccid_vendor *cv);
+bool ccid_vendor_handle_resp(struct ccid_vendor *cv, struct msgb *msg);
+void ccid_vendor_reset(struct ccid_vendor *cv);
+
+/* are received OUT transfers waiting to be parsed? */
+static inline bool ccid_vendor_rx_busy(const struct ccid_vendor *cv)
+{
+	return !llist_empty(&cv->rx_queue);
+}
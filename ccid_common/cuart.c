@@ -31,6 +31,7 @@ const struct value_string card_uart_event_vals[] = {
 	OSMO_VALUE_STRING(CUART_E_RX_COMPLETE),
 	OSMO_VALUE_STRING(CUART_E_RX_TIMEOUT),
 	OSMO_VALUE_STRING(CUART_E_TX_COMPLETE),
+	OSMO_VALUE_STRING(CUART_E_RST_RELEASED),
 	{ 0, NULL }
 };
 
@@ -98,7 +99,7 @@ int card_uart_open(struct card_uart *cuart, const char *driver_name, const char
 
 	cuart->wtime_etu = 9600; /* ISO 7816-3 Section 8.1 */
 	cuart->rx_enabled = true;
-	cuart->rx_threshold = 1;
+	cuart->rx_post.data = NULL;
 	cuart_set_deadline(cuart, 0);
 
 	rc = drv->ops->open(cuart, device_name);
@@ -126,6 +127,11 @@ int card_uart_ctrl(struct card_uart *cuart, enum card_uart_ctl ctl, int arg)
 	OSMO_ASSERT(cuart->driver->ops);
 	OSMO_ASSERT(cuart->driver->ops->ctrl);
 
+	/* resetting or deactivating the card ends any reception */
+	if ((ctl == CUART_CTL_RST && arg) ||
+	    ((ctl == CUART_CTL_POWER_5V0 || ctl == CUART_CTL_POWER_3V0 || ctl == CUART_CTL_POWER_1V8) && !arg))
+		card_uart_rx_cancel(cuart);
+
 	rc = cuart->driver->ops->ctrl(cuart, ctl, arg);
 	if (rc < 0)
 		return rc;
@@ -154,7 +160,6 @@ int card_uart_ctrl(struct card_uart *cuart, enum card_uart_ctl ctl, int arg)
 		if (!arg) {
 			card_uart_wtime_stop(cuart);
 			cuart->tx_busy = false;
-			cuart->rx_threshold = 1;
 			cuart->wtime_etu = 9600; /* ISO 7816-3 Section 8.1 */
 		}
 
@@ -182,21 +187,58 @@ int card_uart_tx(struct card_uart *cuart, const uint8_t *data, size_t len, bool
 	return cuart->driver->ops->async_tx(cuart, data, len);
 }
 
-int card_uart_rx(struct card_uart *cuart, uint8_t *data, size_t len)
+int card_uart_rx_post(struct card_uart *cuart, uint8_t *data, size_t len)
 {
 	OSMO_ASSERT(cuart);
 	OSMO_ASSERT(cuart->driver);
 	OSMO_ASSERT(cuart->driver->ops);
 	OSMO_ASSERT(cuart->driver->ops->async_rx);
+	OSMO_ASSERT(!cuart->rx_post.data);
+	OSMO_ASSERT(data && len);
+
+	cuart->rx_post.len = len;
+	cuart->rx_post.count = 0;
+	cuart->rx_post.data = data;
+
 	return cuart->driver->ops->async_rx(cuart, data, len);
 }
 
-void card_uart_set_rx_threshold(struct card_uart *cuart, size_t rx_threshold)
+size_t card_uart_rx_cancel(struct card_uart *cuart)
+{
+	OSMO_ASSERT(cuart);
+	OSMO_ASSERT(cuart->driver);
+	OSMO_ASSERT(cuart->driver->ops);
+
+	if (!cuart->rx_post.data)
+		return 0;
+
+	if (cuart->driver->ops->rx_cancel)
+		cuart->driver->ops->rx_cancel(cuart);
+	cuart->rx_post.data = NULL;
+
+	return cuart->rx_post.count;
+}
+
+RAMFUNC_HOT void card_uart_rx_byte(struct card_uart *cuart, uint8_t byte)
+{
+	if (!cuart->rx_post.data) {
+		card_uart_notification(cuart, CUART_E_RX_SINGLE, &byte);
+		return;
+	}
+
+	cuart->rx_post.data[cuart->rx_post.count++] = byte;
+	if (cuart->rx_post.count >= cuart->rx_post.len)
+		card_uart_rx_complete(cuart, cuart->rx_post.count);
+}
+
+RAMFUNC_HOT void card_uart_rx_complete(struct card_uart *cuart, size_t count)
 {
-	cuart->rx_threshold = rx_threshold;
+	cuart->rx_post.count = count;
+	cuart->rx_post.data = NULL;
+	card_uart_notification(cuart, CUART_E_RX_COMPLETE, (void *) count);
 }
 
-void card_uart_notification(struct card_uart *cuart, enum card_uart_event evt, void *data)
+RAMFUNC_HOT void card_uart_notification(struct card_uart *cuart, enum card_uart_event evt, void *data)
 {
 	OSMO_ASSERT(cuart);
 	OSMO_ASSERT(cuart->handle_event);
@@ -208,6 +250,11 @@ void card_uart_notification(struct card_uart *cuart, enum card_uart_event evt, v
 		if (cuart->rx_after_tx_compl)
 			card_uart_ctrl(cuart, CUART_CTL_RX, true);
 		break;
+	case CUART_E_RST_RELEASED:
+		/* the ATR deadline has been armed when RST was released, but the card only now sees it */
+		if (cuart_get_deadline(cuart))
+			card_uart_wtime_restart(cuart);
+		break;
 //	case CUART_E_RX_COMPLETE:
 //		osmo_timer_del(&cuart->wtime_tmr);
 //		break;
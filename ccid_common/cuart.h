@@ -22,20 +22,32 @@
 #include <stdbool.h>
 #include <osmocom/core/linuxlist.h>
 #include <osmocom/core/select.h>
-#include "utils_ringbuffer.h"
 #include "libosmo_emb.h"
 
+/* on the card UART interrupt path: located in RAM if the firmware is built with
+ * WITH_RAMFUNC_HOT, as in the ASF utils.h */
+#ifndef RAMFUNC_HOT
+#if defined(OCTSIMFWBUILD) && defined(WITH_RAMFUNC_HOT)
+#define RAMFUNC_HOT __attribute__((section(".ramfunc")))
+#else
+#define RAMFUNC_HOT
+#endif
+#endif
+
 struct usart_async_descriptor;
 
 enum card_uart_event {
 	/* a single byte was received, it's present at the (uint8_t *) data location */
 	CUART_E_RX_SINGLE,
-	/* an entire block of data was received */
+	/* the buffer posted by card_uart_rx_post() is full, data is the number of bytes (size_t) */
 	CUART_E_RX_COMPLETE,
 	CUART_E_RX_TIMEOUT,
 	/* an entire block of data was written, as instructed in prior card_uart_tx() call */
 	CUART_E_TX_COMPLETE,
 	CUART_E_HW_ERROR, /* might be uart parity or mystery error, might be something else */
+	/* RST has been released at the card, which may be after CUART_CTL_RST returned; the ATR
+	 * is timed from here */
+	CUART_E_RST_RELEASED,
 };
 
 extern const struct value_string card_uart_event_vals[];
@@ -51,10 +63,13 @@ enum card_uart_ctl {
 	CUART_CTL_SET_CLOCK_FREQ, /* set ICC clock frequency (hz)*/
 	CUART_CTL_RST,		/* enable/disable ICC reset */
 	CUART_CTL_WTIME,	/* set the waiting time (in etu) */
-	CUART_CTL_SET_FD,
+	CUART_CTL_SET_FD,	/* set F and D, arg is Fi << 4 | Di as in PPS1 */
 	CUART_CTL_GET_BAUDRATE,
 	CUART_CTL_GET_CLOCK_FREQ,
 	CUART_CTL_ERROR_AND_INV, /* enable error interrupt and maybe inverse signalling according to arg */
+	CUART_CTL_CHAR_FRAME,	/* set the transmitted character frame length (in etu, 12 + extra guard time);
+				 * a UART that can't send frames this long uses its longest one, returns the
+				 * length used */
 };
 
 struct card_uart;
@@ -63,7 +78,10 @@ struct card_uart_ops {
 	int (*open)(struct card_uart *cuart, const char *device_name);
 	int (*close)(struct card_uart *cuart);
 	int (*async_tx)(struct card_uart *cuart, const uint8_t *data, size_t len);
+	/* start receiving into the buffer posted in cuart->rx_post */
 	int (*async_rx)(struct card_uart *cuart, uint8_t *data, size_t len);
+	/* optional: stop receiving into the posted buffer, updating cuart->rx_post.count */
+	void (*rx_cancel)(struct card_uart *cuart);
 
 	int (*ctrl)(struct card_uart *cuart, enum card_uart_ctl ctl, int arg);
 };
@@ -95,9 +113,14 @@ struct card_uart {
 	/* should the receiver automatically be nabled after TX completion? */
 	bool rx_after_tx_compl;
 
-	/*! after how many bytes should we notify the user? If this is '1', we will
-	 *  issue CUART_E_RX_SINGLE; if it is > 1, we will issue CUART_E_RX_COMPLETE */
-	uint32_t rx_threshold;
+	/*! receive buffer posted by card_uart_rx_post(): while there is none, every received byte is
+	 *  reported by CUART_E_RX_SINGLE, else the driver fills it and issues CUART_E_RX_COMPLETE */
+	struct {
+		uint8_t *data;
+		size_t len;
+		/* number of bytes received into it so far */
+		size_t count;
+	} rx_post;
 
 	uint32_t wtime_etu;
 	/* deadline in jiffies (ms) for card response timeout, 0 = inactive.
@@ -109,10 +132,6 @@ struct card_uart {
 	/* driver-specific private data */
 	union {
 		struct {
-			/* ringbuffer on receive side */
-			uint8_t rx_buf[256];
-			struct ringbuffer rx_ringbuf;
-
 			/* pointer to (user-allocated) transmit buffer and length */
 			const uint8_t *tx_buf;
 			size_t tx_buf_len;
@@ -127,9 +146,23 @@ struct card_uart {
 		struct {
 			struct usart_async_descriptor *usa_pd;
 			uint8_t slot_nr;
-			/* in us, required, no delay breaks _rx_ */
+			/* delay before transmitting after reception, in CPU cycles (DWT->CYCCNT);
+			 * required, no delay breaks _rx_ */
 			uint32_t extrawait_after_rx;
 			uint32_t current_baudrate;
+			/* character errors since the last good character, recovered by repetition */
+			uint8_t char_errors;
+			/* number of bytes the RX DMA channel has been set up for, 0 if it is idle */
+			uint16_t dma_rx_len;
+			/* NCN8025 writes in flight: RST release, to be reported by CUART_E_RST_RELEASED,
+			 * and a card clock change the baud rate has to wait for */
+			bool rst_pending;
+			bool clock_pending;
+			/* Fi << 4 | Di to be set once the card clock changed, 0 if none */
+			uint8_t fidi_deferred;
+			/* transmission waiting for fidi_deferred */
+			const uint8_t *tx_deferred;
+			size_t tx_deferred_len;
 		} asf4;
 	} u;
 };
@@ -153,13 +186,19 @@ int card_uart_close(struct card_uart *cuart);
 /*! Schedule (asynchronous) transmit data via UART; optionally enable Rx after completion */
 int card_uart_tx(struct card_uart *cuart, const uint8_t *data, size_t len, bool rx_after_complete);
 
-/*! Schedule (asynchronous) receive data via UART (after CUART_E_RX_COMPLETE) */
-int card_uart_rx(struct card_uart *cuart, uint8_t *data, size_t len);
+/*! Post a buffer to (asynchronously) receive len bytes into, CUART_E_RX_COMPLETE tells when it is full */
+int card_uart_rx_post(struct card_uart *cuart, uint8_t *data, size_t len);
+
+/*! Cancel a posted receive buffer, returns the number of bytes received into it */
+size_t card_uart_rx_cancel(struct card_uart *cuart);
 
 int card_uart_ctrl(struct card_uart *cuart, enum card_uart_ctl ctl, int arg);
 
-/*! Set the Rx notification threshold in number of bytes received */
-void card_uart_set_rx_threshold(struct card_uart *cuart, size_t rx_threshold);
+/*! For drivers: a byte has been received, store it in the posted buffer or report it */
+void card_uart_rx_byte(struct card_uart *cuart, uint8_t byte);
+
+/*! For drivers: the posted buffer has been filled, count is the number of bytes in it */
+void card_uart_rx_complete(struct card_uart *cuart, size_t count);
 
 /* (re)start the software WTIME timer */
 void card_uart_wtime_restart(struct card_uart *cuart);
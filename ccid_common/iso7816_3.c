@@ -121,3 +121,43 @@ int32_t iso7816_3_calculate_wt(uint8_t wi, uint16_t fi, uint8_t di, uint16_t f,
 
 	return wi * 960UL * (fi/f) * (di/d); // calculate timeout value in ETU
 }
+
+/*
+ * TC1 encodes the extra guard time integer N (see ISO/IEC 7816-3 section 8.3)
+ * - the interface device shall wait GT = 12 ETU + R x N / f between the leading edges of two characters it sends
+ * - R is F/D, so N is given in ETU (T=15 indicating something else is not supported here)
+ * - N = 255 means the minimum: 12 ETU for T=0 (error signal window) and 11 ETU for T=1
+ */
+
+int iso7816_3_atr_tc1(const uint8_t *atr, size_t atr_len)
+{
+	size_t i = 2;
+	uint8_t y1;
+
+	if (atr_len < 2) {
+		return -1;
+	}
+	y1 = atr[1] >> 4; // T0 indicates the presence of TA1, TB1 and TC1
+	if (!(y1 & 0x4)) {
+		return 0; // no TC1: N = 0
+	}
+	if (y1 & 0x1) {
+		i++; // skip TA1
+	}
+	if (y1 & 0x2) {
+		i++; // skip TB1
+	}
+	if (i >= atr_len) {
+		return -2;
+	}
+
+	return atr[i];
+}
+
+uint16_t iso7816_3_char_frame_etu(uint8_t n, bool t1)
+{
+	if (255 == n) {
+		return t1 ? 11 : 12;
+	}
+	return 12 + n;
+}
@@ -20,6 +20,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 /** default clock rate conversion integer Fd
  *  @implements ISO/IEC 7816-3:2006(E) section 8.1
@@ -96,3 +97,18 @@ bool iso7816_3_valid_d(uint8_t d);
  *  @implements ISO/IEC 7816-3:2006(E) section 8.1 and 10.2
  */
 int32_t iso7816_3_calculate_wt(uint8_t wi, uint16_t fi, uint8_t di, uint16_t f, uint8_t d);
+/** get the extra guard time integer N (TC1) from an ATR
+ *  @param[in] atr ATR bytes, starting with TS
+ *  @param[in] atr_len number of ATR bytes
+ *  @return N, 0 if TC1 is absent, or < 0 if the ATR is too short
+ *  @implements ISO/IEC 7816-3:2006(E) section 8.2.2 and 8.3
+ */
+int iso7816_3_atr_tc1(const uint8_t *atr, size_t atr_len);
+/** calculate the character frame length (minimum delay between the leading edges of two
+ *  consecutive characters sent by the interface device)
+ *  @param[in] n extra guard time integer N, as indicated in TC1
+ *  @param[in] t1 if protocol T=1 is used
+ *  @return character frame length in ETU (12 + N, or 11/12 for N=255 with T=1/T=0)
+ *  @implements ISO/IEC 7816-3:2006(E) section 8.3
+ */
+uint16_t iso7816_3_char_frame_etu(uint8_t n, bool t1);
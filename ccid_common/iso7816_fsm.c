@@ -278,7 +278,7 @@ uint32_t fi_cycles2ms(struct osmo_fsm_inst *fi, uint32_t cyclces)
 }
 
 /* card UART notifies us: dispatch to (main ISO7816-3) FSM */
-static void tpdu_uart_notification(struct card_uart *cuart, enum card_uart_event evt, void *data)
+static RAMFUNC_HOT void tpdu_uart_notification(struct card_uart *cuart, enum card_uart_event evt, void *data)
 {
 	struct osmo_fsm_inst *fi = (struct osmo_fsm_inst *) cuart->priv;
 	OSMO_ASSERT(fi->fsm == &iso7816_3_fsm);
@@ -304,6 +304,9 @@ static void tpdu_uart_notification(struct card_uart *cuart, enum card_uart_event
 	case CUART_E_HW_ERROR:
 		osmo_fsm_inst_dispatch(fi, ISO7816_E_HW_ERR_IND, data);
 		break;
+	case CUART_E_RST_RELEASED:
+		/* the ATR deadline is restarted by card_uart_notification() */
+		break;
 	}
 }
 
@@ -457,6 +460,8 @@ static void iso7816_3_allstate_action(struct osmo_fsm_inst *fi, uint32_t event,
 		/* no break */
 	case ISO7816_E_CARD_REMOVAL:
 		/* FIXME: power off? */
+		/* the uart must not write into a tpdu that is handed back to the user */
+		card_uart_rx_cancel(ip->uart);
 		if(fi->state == ISO7816_S_WAIT_ATR || fi->state == ISO7816_S_IN_ATR)
 			ip->user_cb(fi, ISO7816_E_ATR_ERR_IND, 0, atp->atr);
 
@@ -470,6 +475,7 @@ static void iso7816_3_allstate_action(struct osmo_fsm_inst *fi, uint32_t event,
 		break;
 	case ISO7816_E_POWER_DN_IND:
 	case ISO7816_E_RESET_ACT_IND:
+		card_uart_rx_cancel(ip->uart);
 		osmo_fsm_inst_state_chg(fi, ISO7816_S_RESET, 0, 0);
 		break;
 	case ISO7816_E_ABORT_REQ:
@@ -481,6 +487,8 @@ static void iso7816_3_allstate_action(struct osmo_fsm_inst *fi, uint32_t event,
 			osmo_fsm_inst_dispatch(ip->atr_fi, event, data);
 			break;
 		}
+		card_uart_rx_cancel(ip->uart);
+
 		if(fi->state == ISO7816_S_WAIT_PPS_RSP || fi->state == ISO7816_S_IN_PPS_RSP)
 			ip->user_cb(fi, ISO7816_E_PPS_UNSUPPORTED_IND, 0, ppp->tx_cmd);
 
@@ -1025,7 +1033,6 @@ static void pps_s_pps_req_init_action(struct osmo_fsm_inst *fi, uint32_t event,
 		msgb_put_u8(pps_to_transmit, 0xff ^ (1 << 4) ^ PPS1);
 
 		osmo_fsm_inst_state_chg(fi, PPS_S_TX_PPS_REQ, 0, 0);
-		card_uart_set_rx_threshold(ip->uart, 1);
 		card_uart_tx(ip->uart, msgb_data(pps_to_transmit), msgb_length(pps_to_transmit), true);
 		break;
 	default:
@@ -1295,7 +1302,6 @@ static void tpdu_s_tx_hdr_action(struct osmo_fsm_inst *fi, uint32_t event, void
 		return;
 	case ISO7816_E_TX_COMPL:
 
-		card_uart_set_rx_threshold(ip->uart, 1);
 		card_uart_ctrl(ip->uart, CUART_CTL_RX_TIMER_HINT, 1);
 		/* Rx of single byte is already enabled by previous card_uart_tx() call */
 		osmo_fsm_inst_state_chg(fi, TPDU_S_PROCEDURE, 0, 0);
@@ -1309,7 +1315,7 @@ static void tpdu_s_tx_hdr_action(struct osmo_fsm_inst *fi, uint32_t event, void
 #if 0
 #include <hal_gpio.h>
 #endif
-static void tpdu_s_procedure_action(struct osmo_fsm_inst *fi, uint32_t event, void *data)
+static RAMFUNC_HOT void tpdu_s_procedure_action(struct osmo_fsm_inst *fi, uint32_t event, void *data)
 {
 	struct tpdu_fsm_priv *tfp = get_tpdu_fsm_priv(fi);
 	struct osim_apdu_cmd_hdr *tpduh = msgb_tpdu_hdr(tfp->tpdu);
@@ -1323,14 +1329,12 @@ static void tpdu_s_procedure_action(struct osmo_fsm_inst *fi, uint32_t event, vo
 		LOGPFSML(fi, LOGL_DEBUG, "Received 0x%02x from UART\n", byte);
 		if (byte == 0x60) {
 			/* NULL: wait for another procedure byte */
-			card_uart_set_rx_threshold(ip->uart, 1);
 			card_uart_ctrl(ip->uart, CUART_CTL_RX_TIMER_HINT, 1);
 			osmo_fsm_inst_state_chg(fi, TPDU_S_PROCEDURE, 0, 0);
 		} else if ((byte >= 0x60 && byte <= 0x6f) || (byte >= 0x90 && byte <= 0x9f)) {
 			//msgb_apdu_sw(tfp->apdu) = byte << 8;
 			msgb_put_u8(tfp->tpdu, byte);
 			/* receive second SW byte (SW2) */
-			card_uart_set_rx_threshold(ip->uart, 1);
 			card_uart_ctrl(ip->uart, CUART_CTL_RX_TIMER_HINT, 1);
 			osmo_fsm_inst_state_chg(fi, TPDU_S_SW2, 0, 0);
 			break;
@@ -1346,17 +1350,22 @@ static void tpdu_s_procedure_action(struct osmo_fsm_inst *fi, uint32_t event, vo
 				card_uart_tx(ip->uart, msgb_l2(tfp->tpdu), msgb_l2len(tfp->tpdu), true);
 				osmo_fsm_inst_state_chg(fi, TPDU_S_TX_REMAINING, 0, 0);
 			} else {
-				/* 7816-3 10.3.2 special case outgoing transfer 0 means 256 */
-				int len_expected = tpduh->p3 == 0 ? 256 : tpduh->p3;
-
-				card_uart_set_rx_threshold(ip->uart, len_expected);
-				card_uart_ctrl(ip->uart, CUART_CTL_RX_TIMER_HINT, len_expected);
-				/* if the expected length is only one byte, cuart will issue
-				 * TPDU_S_RX_SINGLE instead of TPDU_S_RX_REMAINING (OS#4741) */
-				if (len_expected == 1)
+				/* 7816-3 10.3.2 special case outgoing transfer 0 means 256; some bytes
+				 * may already have been received one by one after INS ^ 0xFF */
+				int len_expected = (tpduh->p3 == 0 ? 256 : tpduh->p3) - msgb_l2len(tfp->tpdu);
+
+				if (len_expected == 1) {
+					/* a single byte is reported as TPDU_S_RX_SINGLE anyway (OS#4741) */
+					card_uart_ctrl(ip->uart, CUART_CTL_RX_TIMER_HINT, 1);
 					osmo_fsm_inst_state_chg(fi, TPDU_S_RX_SINGLE, 0, 0);
-				else
+				} else {
+					/* let the UART receive the data straight into the tpdu, the state
+					 * changes first as the post may complete immediately */
+					OSMO_ASSERT(msgb_tailroom(tfp->tpdu) >= len_expected);
 					osmo_fsm_inst_state_chg(fi, TPDU_S_RX_REMAINING, 0, 0);
+					card_uart_ctrl(ip->uart, CUART_CTL_RX_TIMER_HINT, len_expected);
+					card_uart_rx_post(ip->uart, msgb_data(tfp->tpdu) + msgb_length(tfp->tpdu), len_expected);
+				}
 			}
 		} else if (byte == (tpduh->ins ^ 0xFF)) {
 			/* transmit/recieve single byte then wait for proc */
@@ -1366,7 +1375,6 @@ static void tpdu_s_procedure_action(struct osmo_fsm_inst *fi, uint32_t event, vo
 				card_uart_tx(ip->uart, msgb_l3(tfp->tpdu), 1, false);
 				osmo_fsm_inst_state_chg(fi, TPDU_S_TX_SINGLE, 0, 0);
 			} else {
-				card_uart_set_rx_threshold(ip->uart, 1);
 				card_uart_ctrl(ip->uart, CUART_CTL_RX_TIMER_HINT, 1);
 				osmo_fsm_inst_state_chg(fi, TPDU_S_RX_SINGLE, 0, 0);
 			}
@@ -1379,7 +1387,7 @@ static void tpdu_s_procedure_action(struct osmo_fsm_inst *fi, uint32_t event, vo
 }
 
 /* UART is transmitting remaining data; we wait for ISO7816_E_TX_COMPL */
-static void tpdu_s_tx_remaining_action(struct osmo_fsm_inst *fi, uint32_t event, void *data)
+static RAMFUNC_HOT void tpdu_s_tx_remaining_action(struct osmo_fsm_inst *fi, uint32_t event, void *data)
 {
 	struct osmo_fsm_inst *parent_fi = fi->proc.parent;
 	struct iso7816_3_priv *ip = get_iso7816_3_priv(parent_fi);
@@ -1388,7 +1396,6 @@ static void tpdu_s_tx_remaining_action(struct osmo_fsm_inst *fi, uint32_t event,
 	case ISO7816_E_RX_SINGLE:
 		return;
 	case ISO7816_E_TX_COMPL:
-		card_uart_set_rx_threshold(ip->uart, 1);
 		card_uart_ctrl(ip->uart, CUART_CTL_RX_TIMER_HINT, 1);
 		osmo_fsm_inst_state_chg(fi, TPDU_S_SW1, 0, 0);
 		break;
@@ -1398,7 +1405,7 @@ static void tpdu_s_tx_remaining_action(struct osmo_fsm_inst *fi, uint32_t event,
 }
 
 /* UART is transmitting single byte of data; we wait for ISO7816_E_TX_COMPL */
-static void tpdu_s_tx_single_action(struct osmo_fsm_inst *fi, uint32_t event, void *data)
+static RAMFUNC_HOT void tpdu_s_tx_single_action(struct osmo_fsm_inst *fi, uint32_t event, void *data)
 {
 	struct tpdu_fsm_priv *tfp = get_tpdu_fsm_priv(fi);
 	struct osmo_fsm_inst *parent_fi = fi->proc.parent;
@@ -1409,7 +1416,6 @@ static void tpdu_s_tx_single_action(struct osmo_fsm_inst *fi, uint32_t event, vo
 		return;
 	case ISO7816_E_TX_COMPL:
 		tfp->tpdu->l3h += 1;
-		card_uart_set_rx_threshold(ip->uart, 1);
 		card_uart_ctrl(ip->uart, CUART_CTL_RX_TIMER_HINT, 1);
 		if (msgb_l3len(tfp->tpdu))
 			osmo_fsm_inst_state_chg(fi, TPDU_S_PROCEDURE, 0, 0);
@@ -1422,28 +1428,24 @@ static void tpdu_s_tx_single_action(struct osmo_fsm_inst *fi, uint32_t event, vo
 }
 
 /* UART is receiving remaining data; we wait for ISO7816_E_RX_COMPL */
-static void tpdu_s_rx_remaining_action(struct osmo_fsm_inst *fi, uint32_t event, void *data)
+static RAMFUNC_HOT void tpdu_s_rx_remaining_action(struct osmo_fsm_inst *fi, uint32_t event, void *data)
 {
 	struct tpdu_fsm_priv *tfp = get_tpdu_fsm_priv(fi);
 	struct osim_apdu_cmd_hdr *tpduh = msgb_tpdu_hdr(tfp->tpdu);
 	struct osmo_fsm_inst *parent_fi = fi->proc.parent;
 	struct iso7816_3_priv *ip = get_iso7816_3_priv(parent_fi);
-	int rc;
 
 	/* 7816-3 10.3.2 special case outgoing transfer 0 means 256 */
 	int len_expected = tpduh->p3 == 0 ? 256 : tpduh->p3;
 
 	switch (event) {
 	case ISO7816_E_RX_COMPL:
-		/* retrieve pending byte(s) */
-		rc = card_uart_rx(ip->uart, msgb_l2(tfp->tpdu), len_expected);
-		OSMO_ASSERT(rc > 0);
-		msgb_put(tfp->tpdu, rc);
+		/* the UART received the data into the buffer posted at the tail of the tpdu */
+		msgb_put(tfp->tpdu, (size_t) data);
 		if (msgb_l2len(tfp->tpdu) != len_expected) {
 			LOGPFSML(fi, LOGL_ERROR, "expected %u bytes; read %d\n", len_expected,
 				 msgb_l2len(tfp->tpdu));
 		}
-		card_uart_set_rx_threshold(ip->uart, 1);
 		card_uart_ctrl(ip->uart, CUART_CTL_RX_TIMER_HINT, 1);
 		osmo_fsm_inst_state_chg(fi, TPDU_S_SW1, 0, 0);
 		break;
@@ -1453,7 +1455,7 @@ static void tpdu_s_rx_remaining_action(struct osmo_fsm_inst *fi, uint32_t event,
 }
 
 /* UART is receiving single byte of data; we wait for ISO7816_E_RX_SINGLE */
-static void tpdu_s_rx_single_action(struct osmo_fsm_inst *fi, uint32_t event, void *data)
+static RAMFUNC_HOT void tpdu_s_rx_single_action(struct osmo_fsm_inst *fi, uint32_t event, void *data)
 {
 	struct tpdu_fsm_priv *tfp = get_tpdu_fsm_priv(fi);
 	struct osim_apdu_cmd_hdr *tpduh = msgb_tpdu_hdr(tfp->tpdu);
@@ -1467,7 +1469,6 @@ static void tpdu_s_rx_single_action(struct osmo_fsm_inst *fi, uint32_t event, vo
 		LOGPFSML(fi, LOGL_DEBUG, "Received 0x%02x from UART\n", byte);
 		msgb_put_u8(tfp->tpdu, byte);
 
-		card_uart_set_rx_threshold(ip->uart, 1);
 		card_uart_ctrl(ip->uart, CUART_CTL_RX_TIMER_HINT, 1);
 
 		/* determine if number of expected bytes received */
@@ -1481,7 +1482,7 @@ static void tpdu_s_rx_single_action(struct osmo_fsm_inst *fi, uint32_t event, vo
 	}
 }
 
-static void tpdu_s_sw1_action(struct osmo_fsm_inst *fi, uint32_t event, void *data)
+static RAMFUNC_HOT void tpdu_s_sw1_action(struct osmo_fsm_inst *fi, uint32_t event, void *data)
 {
 	struct tpdu_fsm_priv *tfp = get_tpdu_fsm_priv(fi);
 	struct osmo_fsm_inst *parent_fi = fi->proc.parent;
@@ -1494,14 +1495,12 @@ static void tpdu_s_sw1_action(struct osmo_fsm_inst *fi, uint32_t event, void *da
 		LOGPFSML(fi, LOGL_DEBUG, "Received 0x%02x from UART\n", byte);
 		if (byte == 0x60) {
 			/* NULL: wait for actual SW1 */
-			card_uart_set_rx_threshold(ip->uart, 1);
 			card_uart_ctrl(ip->uart, CUART_CTL_RX_TIMER_HINT, 1);
 			osmo_fsm_inst_state_chg(fi, TPDU_S_SW1, 0, 0);
 		} else {
 			/* record byte */
 			//msgb_apdu_sw(tfp->apdu) = byte << 8;
 			msgb_put_u8(tfp->tpdu, byte);
-			card_uart_set_rx_threshold(ip->uart, 1);
 			card_uart_ctrl(ip->uart, CUART_CTL_RX_TIMER_HINT, 1);
 			osmo_fsm_inst_state_chg(fi, TPDU_S_SW2, 0, 0);
 		}
@@ -1511,7 +1510,7 @@ static void tpdu_s_sw1_action(struct osmo_fsm_inst *fi, uint32_t event, void *da
 	}
 }
 
-static void tpdu_s_sw2_action(struct osmo_fsm_inst *fi, uint32_t event, void *data)
+static RAMFUNC_HOT void tpdu_s_sw2_action(struct osmo_fsm_inst *fi, uint32_t event, void *data)
 {
 	struct tpdu_fsm_priv *tfp = get_tpdu_fsm_priv(fi);
 	struct osmo_fsm_inst *parent_fi = fi->proc.parent;
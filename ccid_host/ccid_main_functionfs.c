@@ -171,6 +171,7 @@ static const struct {
 #include <osmocom/core/logging.h>
 
 #include "ccid_device.h"
+#include "ccid_in_sched.h"
 #include "ccid_slot_sim.h"
 extern struct ccid_slot_ops iso_fsm_slot_ops;
 
@@ -188,7 +189,7 @@ struct ufunc_handle {
 	struct osmo_fd ep_in;
 	struct osmo_fd ep_out;
 	struct osmo_fd ep_int;
-	struct llist_head ep_in_queue;
+	struct ccid_in_sched in_sched;
 	struct llist_head ep_int_queue;
 #ifndef FUNCTIONFS_SUPPORTS_POLL
 	struct osmo_fd aio_evfd;
@@ -325,7 +326,7 @@ static void aio_refill_out(struct ufunc_handle *uh)
 	OSMO_ASSERT(rc >= 0);
 }
 
-/* dequeue the next msgb from ep_in_queue and set up AIO for it */
+/* dequeue the next msgb from in_sched and set up AIO for it */
 static void dequeue_aio_write_in(struct ufunc_handle *uh)
 {
 	struct aio_help *ah = &uh->aio_in;
@@ -335,7 +336,7 @@ static void dequeue_aio_write_in(struct ufunc_handle *uh)
 	if (ah->msg)
 		return;
 
-	d = msgb_dequeue(&uh->ep_in_queue);
+	d = ccid_in_sched_dequeue(&uh->in_sched);
 	if (!d)
 		return;
 
@@ -457,7 +458,7 @@ static int ep0_init(struct ufunc_handle *uh)
 	osmo_fd_register(&uh->ep_out);
 #endif
 
-	INIT_LLIST_HEAD(&uh->ep_in_queue);
+	ccid_in_sched_init(&uh->in_sched);
 	rc = open("ep3", O_RDWR);
 	assert(rc >= 0);
 	osmo_fd_setup(&uh->ep_in, rc, 0, &ep_in_cb, uh, 3);
@@ -493,8 +494,8 @@ static int ccid_ops_send_in(struct ccid_instance *ci, struct msgb *msg)
 {
 	struct ufunc_handle *uh = ci->priv;
 
-	/* append to the queue */
-	msgb_enqueue(&uh->ep_in_queue, msg);
+	/* append to the queue of its slot */
+	ccid_in_sched_enqueue(&uh->in_sched, msg);
 
 	/* trigger, if needed */
 #ifndef FUNCTIONFS_SUPPORTS_POLL
@@ -521,9 +522,17 @@ static int ccid_ops_send_int(struct ccid_instance *ci, struct msgb *msg)
 	return 0;
 }
 
+static int ccid_ops_set_in_prio(struct ccid_instance *ci, uint8_t slot_nr, enum ccid_in_prio prio)
+{
+	struct ufunc_handle *uh = ci->priv;
+
+	return ccid_in_sched_set_prio(&uh->in_sched, slot_nr, prio);
+}
+
 static const struct ccid_ops c_ops = {
 	.send_in = ccid_ops_send_in,
 	.send_int = ccid_ops_send_int,
+	.set_in_prio = ccid_ops_set_in_prio,
 };
 
 void *g_tall_ctx;
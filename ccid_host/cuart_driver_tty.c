@@ -28,7 +28,6 @@
 #include <osmocom/core/utils.h>
 
 #include "cuart.h"
-#include "utils_ringbuffer.h"
 
 /***********************************************************************
  * low-level helper routines
@@ -126,7 +125,7 @@ static int tty_uart_fd_cb(struct osmo_fd *ofd, unsigned int what)
 
 	if (what & OSMO_FD_READ) {
 		int i;
-		/* read any pending bytes and feed them into ring buffer */
+		/* read any pending bytes and feed them into the posted buffer */
 		rc = read(ofd->fd, buf, sizeof(buf));
 		OSMO_ASSERT(rc > 0);
 		for (i = 0; i < rc; i++) {
@@ -149,16 +148,7 @@ static int tty_uart_fd_cb(struct osmo_fd *ofd, unsigned int what)
 				continue;
 
 			card_uart_wtime_restart(cuart);
-
-			if (cuart->rx_threshold == 1) {
-				/* bypass ringbuffer and report byte directly */
-				card_uart_notification(cuart, CUART_E_RX_SINGLE, &buf[i]);
-			} else {
-				/* go via ringbuffer and notify only after threshold */
-				ringbuffer_put(&cuart->u.tty.rx_ringbuf, buf[i]);
-				if (ringbuffer_num(&cuart->u.tty.rx_ringbuf) >= cuart->rx_threshold)
-					card_uart_notification(cuart, CUART_E_RX_COMPLETE, NULL);
-			}
+			card_uart_rx_byte(cuart, buf[i]);
 		}
 	}
 	if (what & OSMO_FD_WRITE) {
@@ -191,10 +181,6 @@ static int tty_uart_open(struct card_uart *cuart, const char *device_name)
 {
 	int rc;
 
-	rc = ringbuffer_init(&cuart->u.tty.rx_ringbuf, cuart->u.tty.rx_buf, sizeof(cuart->u.tty.rx_buf));
-	if (rc < 0)
-		return rc;
-
 	cuart->u.tty.ofd.fd = -1;
 	rc = osmo_serial_init(device_name, B9600);
 	if (rc < 0)
@@ -243,17 +229,10 @@ static int tty_uart_async_tx(struct card_uart *cuart, const uint8_t *data, size_
 
 static int tty_uart_async_rx(struct card_uart *cuart, uint8_t *data, size_t len)
 {
-	int rc, i;
 	OSMO_ASSERT(cuart->driver == &tty_uart_driver);
 
-	/* FIXME: actually do this asynchronously */
-	for (i = 0; i < len; i++) {
-		rc = ringbuffer_get(&cuart->u.tty.rx_ringbuf, &data[i]);
-		if (rc < 0)
-			return i;
-	}
-
-	return i;
+	/* nothing to start, tty_uart_fd_cb() fills the posted buffer from what it reads */
+	return 0;
 }
 
 static int tty_uart_ctrl(struct card_uart *cuart, enum card_uart_ctl ctl, int arg)
@@ -285,10 +264,33 @@ static int tty_uart_ctrl(struct card_uart *cuart, enum card_uart_ctl ctl, int ar
 		_set_rts(cuart->u.tty.ofd.fd, arg ? true : false);
 		if (arg)
 			_flush(cuart->u.tty.ofd.fd);
+		else
+			card_uart_notification(cuart, CUART_E_RST_RELEASED, NULL);
 		break;
 	case CUART_CTL_WTIME:
 		/* no driver-specific handling of this */
 		break;
+	case CUART_CTL_CHAR_FRAME:
+		/* start + 8 data + parity bit, followed by one or two stop bits; a tty can't do more */
+		if (arg < 11)
+			return -EINVAL;
+		if (arg > 12)
+			arg = 12;
+		rc = tcgetattr(cuart->u.tty.ofd.fd, &tio);
+		if (rc < 0) {
+			perror("tcgetattr()");
+			return -EIO;
+		}
+		if (arg == 12)
+			tio.c_cflag |= CSTOPB;
+		else
+			tio.c_cflag &= ~CSTOPB;
+		rc = tcsetattr(cuart->u.tty.ofd.fd, TCSADRAIN, &tio);
+		if (rc < 0) {
+			perror("tcsetattr()");
+			return -EIO;
+		}
+		return arg;
 	case CUART_CTL_POWER_5V0:
 	case CUART_CTL_POWER_3V0:
 	case CUART_CTL_POWER_1V8:
@@ -43,23 +43,16 @@ static void handle_event(struct card_uart *cuart, enum card_uart_event evt, void
 
 static int get_atr(uint8_t *atr, size_t max_len)
 {
-	int rc;
-	int i = 0;
-
 	card_uart_ctrl(&g_cuart, CUART_CTL_RST, true);
 	usleep(100000);
+	card_uart_rx_post(&g_cuart, atr, max_len);
 	card_uart_ctrl(&g_cuart, CUART_CTL_RST, false);
 
 	sleep(1);
 	osmo_select_main(true);
 
-	for (i = 0; i < max_len; i++) {
-		rc = card_uart_rx(&g_cuart, &atr[i], 1);
-		if (rc <= 0)
-			break;
-	}
-
-	return i;
+	/* the ATR is shorter than the buffer, take what has been received */
+	return card_uart_rx_cancel(&g_cuart);
 }
 
 static void test_apdu(void)
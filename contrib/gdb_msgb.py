@@ -36,8 +36,9 @@ class MsgbListPrinter(gdb.Command):
             if not args:
                 # print("Usage: print-msgb-list list_head")
                 # return
-                heads_names = [[f"g_ccid_s.{epn}.list"] for epn in ["in_ep", "irq_ep", "out_ep"]] #  f"*(struct msgb*)g_ccid_s.{epn}.in_progress"
-                heads_names = [nested_item for item in heads_names for nested_item in item]  + [f"g_ccid_s.free_q"]
+                heads_names = [[f"g_ccid_s.iface[0].{epn}.list"] for epn in ["in_ep", "out_ep"]] #  f"*(struct msgb*)g_ccid_s.{epn}.in_progress"
+                heads_names = [nested_item for item in heads_names for nested_item in item]  + ["g_ccid_msgb_pool.free"]
+                heads_names += [f"g_ccid_s.iface[0].in_sched.queue[{i}]" for i in range(8)]
                 heads = [gdb.parse_and_eval(i) for i in heads_names]
 
             else:
@@ -0,0 +1,300 @@
+/* Log target writing binary records into a RAM ring, drained to the debug UART by the
+ * main loop. See binlog.h for the record format.
+ *
+ * Nothing is formatted on the target: a record is the address of the format string plus
+ * the raw arguments, so that logging costs little more than copying them, and never waits
+ * for the UART. Records which don't fit into the ring are counted and reported by a record
+ * of their own once there is room again.
+ *
+ * (C) 2019 by sysmocom - s.f.m.c. GmbH
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <hal_atomic.h>
+#include <utils.h>
+#include <osmocom/core/logging.h>
+
+#include "driver_init.h"
+#include "libosmo_emb.h"
+#include "command.h"
+#include "binlog.h"
+
+/* the records go out on the debug UART, the "log" command is read on its shell */
+#ifndef ENABLE_DBG_UART7
+#error "BINLOG needs the debug UART, build with DEBUG_UART=1 (costs slot 7)"
+#endif
+
+/* must be a power of 2 */
+#define BINLOG_RING_SIZE	2048
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wlarger-than="
+/* records, each preceded by its length */
+static uint8_t binlog_ring[BINLOG_RING_SIZE];
+#pragma GCC diagnostic pop
+
+static struct {
+	/* free running write and read positions in binlog_ring */
+	uint32_t head;
+	uint32_t tail;
+	/* records lost since the last report of dropped records */
+	uint32_t dropped;
+	/* totals, for the "log" command */
+	uint32_t written;
+	uint32_t dropped_total;
+	struct log_target *target;
+} binlog_state;
+
+/* record being built, only accessed with interrupts disabled */
+static uint8_t binlog_rec[BINLOG_MAX_RECORD];
+
+static bool binlog_put(uint8_t *out, unsigned int size, unsigned int *len, const void *val,
+		       unsigned int val_len)
+{
+	if (*len + val_len > size)
+		return false;
+	memcpy(out + *len, val, val_len);
+	*len += val_len;
+	return true;
+}
+
+/* copy the arguments of the conversions of a format string from ap to out
+ * \param[out] trunc set if not all of them fit
+ * \returns number of bytes written to out */
+static unsigned int binlog_put_args(uint8_t *out, unsigned int size, bool *trunc, const char *fmt,
+				    va_list ap)
+{
+	unsigned int len = 0;
+	const char *p = fmt;
+
+	*trunc = false;
+	while ((p = strchr(p, '%'))) {
+		unsigned int lng = 0;
+		uint32_t u32;
+		uint64_t u64;
+		double d;
+		const char *s;
+		uint8_t slen;
+		bool ok = true;
+
+		p++;
+		/* flags, width, precision */
+		while (*p && strchr("-+ #0123456789.*", *p)) {
+			if (*p == '*') {
+				u32 = va_arg(ap, int);
+				if (!binlog_put(out, size, &len, &u32, sizeof(u32)))
+					goto out_trunc;
+			}
+			p++;
+		}
+		/* length modifiers: only long long is wider than int */
+		while (*p && strchr("hlLjztq", *p)) {
+			if (*p == 'l')
+				lng++;
+			else if (*p == 'j' || *p == 'q')
+				lng += 2;
+			p++;
+		}
+
+		switch (*p) {
+		case '\0':
+			return len;
+		case '%':
+			break;
+		case 'd': case 'i': case 'u': case 'o': case 'x': case 'X': case 'c':
+			if (lng >= 2) {
+				u64 = va_arg(ap, long long);
+				ok = binlog_put(out, size, &len, &u64, sizeof(u64));
+			} else {
+				u32 = va_arg(ap, int);
+				ok = binlog_put(out, size, &len, &u32, sizeof(u32));
+			}
+			break;
+		case 'p':
+			u32 = (uintptr_t) va_arg(ap, void *);
+			ok = binlog_put(out, size, &len, &u32, sizeof(u32));
+			break;
+		case 's':
+			s = va_arg(ap, const char *);
+			if (!s)
+				s = "(null)";
+			slen = strnlen(s, BINLOG_MAX_STR);
+			ok = binlog_put(out, size, &len, &slen, sizeof(slen))
+			     && binlog_put(out, size, &len, s, slen);
+			break;
+		case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+			d = va_arg(ap, double);
+			ok = binlog_put(out, size, &len, &d, sizeof(d));
+			break;
+		case 'n':
+			va_arg(ap, void *);
+			break;
+		default:
+			/* unknown conversion, the type of its argument is unknown as well */
+			goto out_trunc;
+		}
+		if (!ok)
+			goto out_trunc;
+		p++;
+	}
+	return len;
+
+out_trunc:
+	*trunc = true;
+	return len;
+}
+
+static bool binlog_ring_put(const uint8_t *rec, unsigned int len)
+{
+	unsigned int i;
+
+	if (BINLOG_RING_SIZE - (binlog_state.head - binlog_state.tail) < len + 1)
+		return false;
+	binlog_ring[binlog_state.head++ % BINLOG_RING_SIZE] = len;
+	for (i = 0; i < len; i++)
+		binlog_ring[binlog_state.head++ % BINLOG_RING_SIZE] = rec[i];
+	return true;
+}
+
+/* report the records dropped so far, if there is room for it */
+static bool binlog_put_dropped(void)
+{
+	struct {
+		struct binlog_hdr hdr;
+		uint32_t num;
+	} __attribute__ ((packed)) rec = {
+		.hdr = {
+			.time = get_jiffies(),
+		},
+		.num = binlog_state.dropped,
+	};
+
+	if (!binlog_ring_put((const uint8_t *) &rec, sizeof(rec)))
+		return false;
+	binlog_state.dropped = 0;
+	return true;
+}
+
+/* call-back function to the logging framework, may be called from interrupt context */
+static void binlog_raw_output(struct log_target *target, int subsys, unsigned int level,
+			      const char *file, int line, int cont, const char *format, va_list ap)
+{
+	struct binlog_hdr *bh = (struct binlog_hdr *) binlog_rec;
+	unsigned int len;
+	bool trunc;
+
+	CRITICAL_SECTION_ENTER()
+	bh->fmt = (uintptr_t) format;
+	bh->file = (uintptr_t) file;
+	bh->time = get_jiffies();
+	bh->line = line;
+	bh->subsys = subsys;
+	bh->flags = (level & BINLOG_F_LEVEL) | (cont ? BINLOG_F_CONT : 0);
+	len = binlog_put_args(bh->args, sizeof(binlog_rec) - sizeof(*bh), &trunc, format, ap);
+	if (trunc)
+		bh->flags |= BINLOG_F_TRUNC;
+
+	if ((binlog_state.dropped && !binlog_put_dropped())
+	    || !binlog_ring_put(binlog_rec, sizeof(*bh) + len)) {
+		binlog_state.dropped++;
+		binlog_state.dropped_total++;
+	} else {
+		binlog_state.written++;
+	}
+	CRITICAL_SECTION_LEAVE()
+}
+
+/* encode a record of at most 254 bytes, which needs just one code byte per zero byte
+ * \returns length of the encoding, one more than len */
+static unsigned int cobs_encode(uint8_t *out, const uint8_t *in, unsigned int len)
+{
+	unsigned int code_idx = 0, o = 1, i;
+	uint8_t code = 1;
+
+	for (i = 0; i < len; i++) {
+		if (in[i] == 0) {
+			out[code_idx] = code;
+			code_idx = o++;
+			code = 1;
+		} else {
+			out[o++] = in[i];
+			code++;
+		}
+	}
+	out[code_idx] = code;
+	return o;
+}
+
+/*! Write the records as long as the debug UART has room for them, from the main loop */
+void binlog_drain(void)
+{
+	/* delimiter, COBS encoded record, delimiter */
+	static uint8_t frame[BINLOG_MAX_RECORD + 3];
+	static uint8_t rec[BINLOG_MAX_RECORD];
+
+	while (binlog_state.head != binlog_state.tail) {
+		unsigned int len, i, space;
+
+		CRITICAL_SECTION_ENTER()
+		space = UART_debug.tx.size - ringbuffer_num(&UART_debug.tx);
+		len = binlog_ring[binlog_state.tail % BINLOG_RING_SIZE];
+		if (space >= len + 3) {
+			for (i = 0; i < len; i++)
+				rec[i] = binlog_ring[(binlog_state.tail + 1 + i) % BINLOG_RING_SIZE];
+			binlog_state.tail += len + 1;
+		}
+		CRITICAL_SECTION_LEAVE()
+
+		/* the UART would overwrite what it hasn't sent yet */
+		if (space < len + 3)
+			break;
+		frame[0] = 0;
+		len = cobs_encode(frame + 1, rec, len);
+		frame[len + 1] = 0;
+		io_write(&UART_debug.io, frame, len + 2);
+	}
+}
+
+DEFUN(cmd_log, cmd_log_cmd, "log", "Binary log: log [debug|info|notice|error|fatal]")
+{
+	int level;
+
+	if (argc >= 2) {
+		level = log_parse_level(argv[1]);
+		if (level < 0) {
+			printf("Unknown log level: '%s'\r\n", argv[1]);
+			return;
+		}
+		log_set_log_level(binlog_state.target, level);
+	}
+	printf("binlog: level %s, %lu records written, %lu dropped, %lu/%u bytes queued\r\n",
+		log_level_str(binlog_state.target->loglevel), (unsigned long)binlog_state.written,
+		(unsigned long)binlog_state.dropped_total,
+		(unsigned long)(binlog_state.head - binlog_state.tail), BINLOG_RING_SIZE);
+}
+
+/*! Create the binary log target and register the "log" command
+ *  \returns the target, to be added with log_add_target() */
+struct log_target *log_target_create_binlog(void)
+{
+	struct log_target *target;
+
+	target = log_target_create();
+	if (!target)
+		return NULL;
+
+	target->type = LOG_TGT_TYPE_STDERR;
+	target->raw_output = binlog_raw_output;
+	/* everything else is in the record anyway */
+	target->print_category = false;
+	target->print_level = false;
+	binlog_state.target = target;
+
+	command_register(&cmd_log_cmd);
+	return target;
+}
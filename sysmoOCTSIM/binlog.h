@@ -0,0 +1,46 @@
+#pragma once
+/* Binary log records, decoded on the host by binlog_decode.py
+ *
+ * Instead of formatting log messages on the target, a record only carries the address of
+ * the format string (and of the source file name) in the firmware image, followed by the
+ * arguments in binary. The decoder looks the strings up in the ELF file of the firmware.
+ *
+ * Arguments follow the header in the order of the conversions of the format string, all
+ * little endian:
+ *   4 bytes	int and smaller, long, size_t, char, pointers, '*' width/precision
+ *   8 bytes	long long, double
+ *   1+n bytes	string: length, then the characters without NUL (at most BINLOG_MAX_STR)
+ *
+ * On the debug UART, each record is COBS encoded and enclosed in 0x00 bytes, so that
+ * records can be told apart from the text printed in between.
+ */
+
+#include <stdint.h>
+
+struct binlog_hdr {
+	/* format string; 0 for a record reporting dropped records (one 4 byte argument: their number) */
+	uint32_t fmt;
+	/* source file name */
+	uint32_t file;
+	/* jiffies (ms) */
+	uint32_t time;
+	uint16_t line;
+	uint8_t subsys;
+	/* log level, BINLOG_F_* */
+	uint8_t flags;
+	uint8_t args[0];
+} __attribute__ ((packed));
+
+#define BINLOG_F_LEVEL		0x0f
+/* continuation of the previous record (LOGPC) */
+#define BINLOG_F_CONT		0x40
+/* the arguments didn't fit into the record, the remaining ones are missing */
+#define BINLOG_F_TRUNC		0x80
+
+/* largest record, so that its COBS encoding needs a single code byte */
+#define BINLOG_MAX_RECORD	254
+/* longest string argument, longer ones are cut */
+#define BINLOG_MAX_STR		48
+
+struct log_target *log_target_create_binlog(void);
+void binlog_drain(void);
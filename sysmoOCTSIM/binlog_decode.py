@@ -0,0 +1,174 @@
+#!/usr/bin/python3
+
+# This script decodes the binary log records written to the debug UART by a firmware built
+# with BINLOG=1 (see binlog.h). The format strings and source file names are looked up in
+# the ELF file of that very firmware build. Text printed between the records is passed on.
+#
+# usage: binlog_decode.py gcc/sysmoOCTSIM.elf [capture file or serial device]
+
+import re, struct, sys
+
+# category names, in the order of the enum in logging.h
+CATEGORIES = ['CCID', 'USB', 'ISO7816', 'ATR', 'TPDU', 'PPS', 'CARD']
+# followed by the ones of libosmocore
+LIB_CATEGORIES = ['DLGLOBAL', 'DLLAPD', 'DLINP', 'DLMUX', 'DLMI', 'DLMIB', 'DLSMS', 'DLCTRL', 'DLGTP',
+		  'DLSTATS', 'DLGSUP', 'DLOAP', 'DLSS7', 'DLSCCP', 'DLSUA', 'DLM3UA', 'DLMGCP', 'DLJIBUF',
+		  'DLRSPRO']
+LEVELS = {1: 'DEBUG', 3: 'INFO', 5: 'NOTICE', 7: 'ERROR', 8: 'FATAL'}
+
+F_LEVEL = 0x0f
+F_CONT = 0x40
+F_TRUNC = 0x80
+HDR = struct.Struct('<IIIHBB')
+
+CONVERSION = re.compile(r'%([-+ #0]*)(\*|\d+)?(?:\.(\*|\d*))?(hh|h|ll|l|L|j|z|t|q)?([diouxXcpsfFeEgGaAn%])')
+
+class Elf:
+	"""read-only access to the initialized data of an ELF32 little endian file"""
+	def __init__(self, path):
+		with open(path, 'rb') as f:
+			self.data = f.read()
+		if self.data[:6] != b'\x7fELF\x01\x01':
+			raise ValueError('%s is not a 32 bit little endian ELF file' % path)
+		phoff, = struct.unpack_from('<I', self.data, 28)
+		phentsize, phnum = struct.unpack_from('<HH', self.data, 42)
+		self.segments = []
+		for i in range(phnum):
+			p_type, p_offset, p_vaddr, p_paddr, p_filesz = struct.unpack_from('<IIIII', self.data,
+											  phoff + i * phentsize)
+			# PT_LOAD
+			if p_type == 1:
+				self.segments.append((p_vaddr, p_offset, p_filesz))
+
+	def string(self, addr):
+		for vaddr, offset, size in self.segments:
+			if vaddr <= addr < vaddr + size:
+				start = offset + addr - vaddr
+				end = self.data.index(b'\0', start)
+				return self.data[start:end].decode('latin-1')
+		return None
+
+def cobs_decode(frame):
+	out = bytearray()
+	i = 0
+	while i < len(frame):
+		code = frame[i]
+		if code == 0 or i + code > len(frame):
+			return None
+		out += frame[i + 1:i + code]
+		i += code
+		if code < 0xff and i < len(frame):
+			out.append(0)
+	return bytes(out)
+
+def format_args(fmt, args):
+	"""format a printf style string with the arguments as encoded by binlog_put_args()"""
+	pos = 0
+
+	def take(size, signed):
+		nonlocal pos
+		if pos + size > len(args):
+			raise IndexError
+		val = int.from_bytes(args[pos:pos + size], 'little', signed=signed)
+		pos += size
+		return val
+
+	def take_str():
+		nonlocal pos
+		n = take(1, False)
+		if pos + n > len(args):
+			raise IndexError
+		s = args[pos:pos + n].decode('latin-1')
+		pos += n
+		return s
+
+	def conv(m):
+		flags, width, prec, length, c = m.groups()
+		if c == '%':
+			return '%'
+		if width == '*':
+			width = str(take(4, True))
+		if prec == '*':
+			prec = str(take(4, True))
+		spec = '%' + flags + (width or '') + ('.' + prec if prec is not None else '')
+		wide = length in ('ll', 'j', 'q')
+		if c in 'di':
+			return (spec + 'd') % take(8 if wide else 4, True)
+		if c in 'uoxX':
+			return (spec + c.replace('u', 'd')) % take(8 if wide else 4, False)
+		if c == 'c':
+			return (spec + 'c') % take(4, False)
+		if c == 'p':
+			return '0x%x' % take(4, False)
+		if c == 's':
+			return (spec + 's') % take_str()
+		if c == 'n':
+			return ''
+		d, = struct.unpack('<d', take(8, False).to_bytes(8, 'little'))
+		return (spec + c) % d
+
+	def conv_or_missing(m):
+		# the arguments of a truncated record end early
+		try:
+			return conv(m)
+		except IndexError:
+			return '<?>'
+
+	return CONVERSION.sub(conv_or_missing, fmt)
+
+def decode_record(elf, rec):
+	if len(rec) < HDR.size:
+		return '<short record: %s>\n' % rec.hex()
+	fmt_addr, file_addr, time, line, subsys, flags = HDR.unpack_from(rec)
+	args = rec[HDR.size:]
+
+	if fmt_addr == 0:
+		return '<%u log records dropped>\n' % struct.unpack_from('<I', args)[0]
+
+	fmt = elf.string(fmt_addr)
+	if fmt is None:
+		msg = '<unknown format 0x%08x: %s>\n' % (fmt_addr, args.hex())
+	else:
+		msg = format_args(fmt, args)
+	if flags & F_TRUNC:
+		msg = msg.rstrip('\n') + ' <truncated>\n'
+	if flags & F_CONT:
+		return msg
+
+	cats = CATEGORIES + LIB_CATEGORIES
+	cat = cats[subsys] if subsys < len(cats) else '<%u>' % subsys
+	level = LEVELS.get(flags & F_LEVEL, str(flags & F_LEVEL))
+	file = (elf.string(file_addr) or '?').rsplit('/', 1)[-1]
+	return '%u.%03u %s %s %s:%u %s' % (time // 1000, time % 1000, cat, level, file, line, msg)
+
+def main():
+	if len(sys.argv) < 2:
+		print('usage: %s firmware.elf [capture file or serial device]' % sys.argv[0], file=sys.stderr)
+		sys.exit(2)
+	elf = Elf(sys.argv[1])
+	inp = open(sys.argv[2], 'rb', buffering=0) if len(sys.argv) > 2 else sys.stdin.buffer
+	out = sys.stdout
+
+	in_frame = False
+	frame = bytearray()
+	while True:
+		data = inp.read(256)
+		if not data:
+			break
+		for b in data:
+			if b != 0:
+				if in_frame:
+					frame.append(b)
+				else:
+					out.write(chr(b).replace('\r', ''))
+				continue
+			if in_frame:
+				rec = cobs_decode(bytes(frame))
+				out.write(decode_record(elf, rec) if rec is not None else
+					  '<bad frame: %s>\n' % frame.hex())
+				frame = bytearray()
+			in_frame = not in_frame
+		out.flush()
+
+if __name__ == '__main__':
+	main()
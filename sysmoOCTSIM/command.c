@@ -76,7 +76,9 @@ void command_print_prompt(void)
 	printf(g_cmds.prompt);
 }
 
-void command_try_recv(void)
+/*! process received characters of the debug UART
+ *  \returns true if there are more characters left to process */
+bool command_try_recv(void)
 {
 #ifdef ENABLE_DBG_UART7
 	unsigned int i = 0;
@@ -85,15 +87,15 @@ void command_try_recv(void)
 	while (usart_async_rings_is_rx_not_empty(&UART_debug) && (i < 10)) {
 		int c = getchar();
 		if (c < 0)
-			return;
+			return false;
 		if (c == '\r' || c == '\n' || g_cmds.buf_idx >= sizeof(g_cmds.buf)-1) {
 			/* skip empty commands */
 			if (g_cmds.buf_idx == 0)
-				return;
+				break;
 			cmd_execute();
 			cmd_buf_reset();
 			printf(g_cmds.prompt);
-			return;
+			break;
 		} else {
 			/* print + append character */
 			putchar(c);
@@ -102,6 +104,9 @@ void command_try_recv(void)
 
 		i++;
 	}
+	return usart_async_rings_is_rx_not_empty(&UART_debug);
+#else
+	return false;
 #endif
 }
 
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <stdbool.h>
+
 struct command_fn {
 	const char *command;
 	const char *help;
@@ -17,5 +19,5 @@ struct command_fn {
 
 void command_init(const char *prompt);
 int command_register(const struct command_fn *cmd);
-void command_try_recv(void);
+bool command_try_recv(void);
 void command_print_prompt(void);
@@ -88,7 +88,7 @@
 // <i> Define whether NACK will be sent on parity error reception.
 // <id> usart_dsnack
 #ifndef CONF_SERCOM_0_USART_DSNACK
-#define CONF_SERCOM_0_USART_DSNACK 0x0
+#define CONF_SERCOM_0_USART_DSNACK 0x1
 #endif
 
 // <o> ISO7816 Maximum Iterations<0-7>
@@ -360,7 +360,7 @@
 // <i> Define whether NACK will be sent on parity error reception.
 // <id> usart_dsnack
 #ifndef CONF_SERCOM_1_USART_DSNACK
-#define CONF_SERCOM_1_USART_DSNACK 0x0
+#define CONF_SERCOM_1_USART_DSNACK 0x1
 #endif
 
 // <o> ISO7816 Maximum Iterations<0-7>
@@ -632,7 +632,7 @@
 // <i> Define whether NACK will be sent on parity error reception.
 // <id> usart_dsnack
 #ifndef CONF_SERCOM_2_USART_DSNACK
-#define CONF_SERCOM_2_USART_DSNACK 0x0
+#define CONF_SERCOM_2_USART_DSNACK 0x1
 #endif
 
 // <o> ISO7816 Maximum Iterations<0-7>
@@ -904,7 +904,7 @@
 // <i> Define whether NACK will be sent on parity error reception.
 // <id> usart_dsnack
 #ifndef CONF_SERCOM_3_USART_DSNACK
-#define CONF_SERCOM_3_USART_DSNACK 0x0
+#define CONF_SERCOM_3_USART_DSNACK 0x1
 #endif
 
 // <o> ISO7816 Maximum Iterations<0-7>
@@ -1176,7 +1176,7 @@
 // <i> Define whether NACK will be sent on parity error reception.
 // <id> usart_dsnack
 #ifndef CONF_SERCOM_4_USART_DSNACK
-#define CONF_SERCOM_4_USART_DSNACK 0x0
+#define CONF_SERCOM_4_USART_DSNACK 0x1
 #endif
 
 // <o> ISO7816 Maximum Iterations<0-7>
@@ -1448,7 +1448,7 @@
 // <i> Define whether NACK will be sent on parity error reception.
 // <id> usart_dsnack
 #ifndef CONF_SERCOM_5_USART_DSNACK
-#define CONF_SERCOM_5_USART_DSNACK 0x0
+#define CONF_SERCOM_5_USART_DSNACK 0x1
 #endif
 
 // <o> ISO7816 Maximum Iterations<0-7>
@@ -1720,7 +1720,7 @@
 // <i> Define whether NACK will be sent on parity error reception.
 // <id> usart_dsnack
 #ifndef CONF_SERCOM_6_USART_DSNACK
-#define CONF_SERCOM_6_USART_DSNACK 0x0
+#define CONF_SERCOM_6_USART_DSNACK 0x1
 #endif
 
 // <o> ISO7816 Maximum Iterations<0-7>
@@ -2264,7 +2264,7 @@
 // <i> Define whether NACK will be sent on parity error reception.
 // <id> usart_dsnack
 #ifndef CONF_SERCOM_7_USART_DSNACK
-#define CONF_SERCOM_7_USART_DSNACK 0x0
+#define CONF_SERCOM_7_USART_DSNACK 0x1
 #endif
 
 // <o> ISO7816 Maximum Iterations<0-7>
@@ -39,8 +39,16 @@
 // <CONF_USB_D_N_EP_MAX"> Max possible (by "Max Endpoint Number" config)
 // <id> usbd_num_ep_sp
 #ifndef CONF_USB_D_NUM_EP_SP
+#if defined(CCID_NUM_IFACES) && CCID_NUM_IFACES > 1
+/* three more for the second CCID interface */
+#define CONF_USB_D_NUM_EP_SP CONF_USB_N_10
+#elif defined(WITH_VENDOR_IF)
+/* two more for the vendor bulk interface */
+#define CONF_USB_D_NUM_EP_SP CONF_USB_N_9
+#else
 #define CONF_USB_D_NUM_EP_SP CONF_USB_N_7
 #endif
+#endif
 
 // </h>
 
@@ -60,8 +68,14 @@
 // <i> The number of physical endpoints - 1
 // <id> usbd_arch_max_ep_n
 #ifndef CONF_USB_D_MAX_EP_N
+#if (defined(CCID_NUM_IFACES) && CCID_NUM_IFACES > 1) || defined(WITH_VENDOR_IF)
+#define CONF_USB_D_MAX_EP_N CONF_USB_N_7
+#elif defined(WITH_DEBUG_CDC)
+#define CONF_USB_D_MAX_EP_N CONF_USB_N_5
+#else
 #define CONF_USB_D_MAX_EP_N CONF_USB_N_4
 #endif
+#endif
 
 // <y> USB Speed Limit
 // <i> Limits the working speed of the device.
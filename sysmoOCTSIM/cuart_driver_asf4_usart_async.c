@@ -22,33 +22,34 @@ static struct usart_async_descriptor* SIM_peripheral_descriptors[] = {&SIM0, &SI
 
 extern struct card_uart *cuart4slot_nr(uint8_t slot_nr);
 
+/* number of consecutive character errors tolerated before the slot is deactivated;
+ * each one has already been repeated by the card (or by us) up to MAXITER times */
+#define SIM_MAX_CHAR_ERRORS 3
+
 /***********************************************************************
  * low-level helper routines
  ***********************************************************************/
 
-static void _SIM_rx_cb(const struct usart_async_descriptor *const io_descr, uint8_t slot_nr)
+static RAMFUNC_HOT void _SIM_rx_cb(const struct usart_async_descriptor *const io_descr, uint8_t slot_nr)
 {
 	struct card_uart *cuart = cuart4slot_nr(slot_nr);
+	uint8_t rx[1];
 	int rc;
 	OSMO_ASSERT(cuart);
 
-	if (cuart->rx_threshold == 1) {
-		/* bypass ringbuffer and report byte directly */
-		uint8_t rx[1];
-		rc = io_read((struct io_descriptor * const)&io_descr->io, rx, sizeof(rx));
-		OSMO_ASSERT(rc == sizeof(rx));
-		card_uart_notification(cuart, CUART_E_RX_SINGLE, rx);
-	} else {
-		/* go via ringbuffer and notify only after threshold */
-		if (ringbuffer_num(&io_descr->rx) >= cuart->rx_threshold)
-			card_uart_notification(cuart, CUART_E_RX_COMPLETE, NULL);
-	}
+	cuart->u.asf4.char_errors = 0;
+
+	/* the ringbuffer only holds the byte until here: it goes to the posted buffer or is reported directly */
+	rc = io_read((struct io_descriptor * const)&io_descr->io, rx, sizeof(rx));
+	OSMO_ASSERT(rc == sizeof(rx));
+	card_uart_rx_byte(cuart, rx[0]);
 }
 
-static void _SIM_tx_cb(const struct usart_async_descriptor *const io_descr, uint8_t slot_nr)
+static RAMFUNC_HOT void _SIM_tx_cb(const struct usart_async_descriptor *const io_descr, uint8_t slot_nr)
 {
 	struct card_uart *cuart = cuart4slot_nr(slot_nr);
 	OSMO_ASSERT(cuart);
+	cuart->u.asf4.char_errors = 0;
 	card_uart_notification(cuart, CUART_E_TX_COMPLETE, io_descr->tx_buffer);
 }
 
@@ -58,7 +59,19 @@ static void _SIM_tx_cb(const struct usart_async_descriptor *const io_descr, uint
 
 static void _SIM_error_cb(const struct usart_async_descriptor *const io_descr, uint8_t slot_nr) {
 	struct card_uart *cuart = cuart4slot_nr(slot_nr);
+	uint8_t status;
 	OSMO_ASSERT(cuart);
+
+	/* ISO 7816-3 7.3 character repetition is done by the SERCOM in ISO7816 mode: a received
+	 * parity error is NACKed and the card repeats the character, a NACK from the card makes
+	 * us retransmit. ITER is only raised once MAXITER repetitions failed, and an overflow
+	 * means data was lost, so only those (or a series of bad characters) are fatal. */
+	status = hri_sercomusart_read_STATUS_reg(io_descr->device.hw);
+	if (!(status & (SERCOM_USART_STATUS_ITER | SERCOM_USART_STATUS_BUFOVF))
+	    && ++cuart->u.asf4.char_errors <= SIM_MAX_CHAR_ERRORS)
+		return;
+
+	cuart->u.asf4.char_errors = 0;
 	card_uart_notification(cuart, CUART_E_HW_ERROR, 0);
 }
 
@@ -175,28 +188,247 @@ static usart_cb_t SIM_error_cb[8] = {
 	SIM4_error_cb, SIM5_error_cb, SIM6_error_cb, SIM7_error_cb,
 };
 
+#if (SIM_DMA != 0)
+/***********************************************************************
+ * DMA transfers
+ ***********************************************************************/
+
+#include <hpl_dma.h>
+#include <utils.h>
+
+/* DMAC channels used for reception and transmission of a slot */
+#define SIM_DMA_CH_RX(slot_nr)	(16 + (slot_nr))
+#define SIM_DMA_CH_TX(slot_nr)	(24 + (slot_nr))
+
+/* write-back descriptors of hpl_dmac, they hold the remaining beat count of a disabled channel */
+extern DmacDescriptor _write_back_section[DMAC_CH_NUM];
+
+static const uint8_t SIM_peripheral_DMAC_ID_RX[] = {SERCOM0_DMAC_ID_RX, SERCOM1_DMAC_ID_RX, SERCOM2_DMAC_ID_RX, SERCOM3_DMAC_ID_RX, SERCOM4_DMAC_ID_RX, SERCOM5_DMAC_ID_RX, SERCOM6_DMAC_ID_RX, SERCOM7_DMAC_ID_RX};
+static const uint8_t SIM_peripheral_DMAC_ID_TX[] = {SERCOM0_DMAC_ID_TX, SERCOM1_DMAC_ID_TX, SERCOM2_DMAC_ID_TX, SERCOM3_DMAC_ID_TX, SERCOM4_DMAC_ID_TX, SERCOM5_DMAC_ID_TX, SERCOM6_DMAC_ID_TX, SERCOM7_DMAC_ID_TX};
+
+/* the posted buffer has been filled */
+static RAMFUNC_HOT void _SIM_dma_rx_done(struct _dma_resource *resource)
+{
+	struct card_uart *cuart = resource->back;
+
+	cuart->rx_post.count += cuart->u.asf4.dma_rx_len;
+	cuart->u.asf4.dma_rx_len = 0;
+	cuart->u.asf4.char_errors = 0;
+	hri_sercomusart_set_INTEN_RXC_bit(cuart->u.asf4.usa_pd->device.hw);
+
+	card_uart_rx_complete(cuart, cuart->rx_post.count);
+}
+
+/* the last byte has been written to DATA: let the TXC interrupt report the end of the transmission */
+static RAMFUNC_HOT void _SIM_dma_tx_done(struct _dma_resource *resource)
+{
+	struct card_uart *cuart = resource->back;
+
+	_usart_async_enable_tx_done_irq(&cuart->u.asf4.usa_pd->device);
+}
+
+static void _SIM_dma_error(struct _dma_resource *resource)
+{
+	struct card_uart *cuart = resource->back;
+
+	card_uart_notification(cuart, CUART_E_HW_ERROR, 0);
+}
+
+/* stop a DMA channel, returns the number of beats it did not transfer */
+static uint32_t sim_dma_stop(uint8_t ch)
+{
+	/* the write-back BTCNT of a running channel is only current once it is suspended;
+	 * a channel which completes or fails meanwhile disables itself with BTCNT written back */
+	if (hri_dmac_get_CHCTRLA_ENABLE_bit(DMAC, ch)) {
+		hri_dmac_write_CHCTRLB_CMD_bf(DMAC, ch, DMAC_CHCTRLB_CMD_SUSPEND_Val);
+		while (!hri_dmac_get_CHINTFLAG_SUSP_bit(DMAC, ch) && hri_dmac_get_CHCTRLA_ENABLE_bit(DMAC, ch));
+		hri_dmac_clear_CHINTFLAG_SUSP_bit(DMAC, ch);
+	}
+	hri_dmac_clear_CHCTRLA_ENABLE_bit(DMAC, ch);
+	while (hri_dmac_get_CHCTRLA_ENABLE_bit(DMAC, ch));
+	/* a completion which has not been handled yet is not reported any more */
+	hri_dmac_clear_CHINTFLAG_TCMPL_bit(DMAC, ch);
+
+	return hri_dmacdescriptor_read_BTCNT_reg(&_write_back_section[ch]);
+}
+
+static void sim_dma_init(struct card_uart *cuart)
+{
+	uint8_t slot_nr = cuart->u.asf4.slot_nr;
+	Sercom *sercom = cuart->u.asf4.usa_pd->device.hw;
+	struct _dma_resource *resource;
+
+	/* one beat per RXC/DRE trigger, byte sized beats */
+	hri_dmac_write_CHCTRLA_reg(DMAC, SIM_DMA_CH_RX(slot_nr),
+				   DMAC_CHCTRLA_TRIGSRC(SIM_peripheral_DMAC_ID_RX[slot_nr]) | DMAC_CHCTRLA_TRIGACT_BURST);
+	_dma_set_source_address(SIM_DMA_CH_RX(slot_nr), (const void *)&sercom->USART.DATA.reg);
+	_dma_srcinc_enable(SIM_DMA_CH_RX(slot_nr), false);
+	_dma_dstinc_enable(SIM_DMA_CH_RX(slot_nr), true);
+	_dma_get_channel_resource(&resource, SIM_DMA_CH_RX(slot_nr));
+	resource->dma_cb.transfer_done = _SIM_dma_rx_done;
+	resource->dma_cb.error = _SIM_dma_error;
+	resource->back = cuart;
+	_dma_set_irq_state(SIM_DMA_CH_RX(slot_nr), DMA_TRANSFER_COMPLETE_CB, true);
+	_dma_set_irq_state(SIM_DMA_CH_RX(slot_nr), DMA_TRANSFER_ERROR_CB, true);
+
+	hri_dmac_write_CHCTRLA_reg(DMAC, SIM_DMA_CH_TX(slot_nr),
+				   DMAC_CHCTRLA_TRIGSRC(SIM_peripheral_DMAC_ID_TX[slot_nr]) | DMAC_CHCTRLA_TRIGACT_BURST);
+	_dma_set_destination_address(SIM_DMA_CH_TX(slot_nr), (const void *)&sercom->USART.DATA.reg);
+	_dma_srcinc_enable(SIM_DMA_CH_TX(slot_nr), true);
+	_dma_dstinc_enable(SIM_DMA_CH_TX(slot_nr), false);
+	_dma_get_channel_resource(&resource, SIM_DMA_CH_TX(slot_nr));
+	resource->dma_cb.transfer_done = _SIM_dma_tx_done;
+	resource->dma_cb.error = _SIM_dma_error;
+	resource->back = cuart;
+	_dma_set_irq_state(SIM_DMA_CH_TX(slot_nr), DMA_TRANSFER_COMPLETE_CB, true);
+	_dma_set_irq_state(SIM_DMA_CH_TX(slot_nr), DMA_TRANSFER_ERROR_CB, true);
+}
+
+/** receive the rest of the posted buffer by DMA
+ *  the RXC interrupt is disabled until the buffer is full, the caller gets a single CUART_E_RX_COMPLETE
+ *  @param[in] cuart card uart of the slot, with a buffer posted
+ */
+static void sim_dma_rx_start(struct card_uart *cuart)
+{
+	struct usart_async_descriptor *usa_pd = cuart->u.asf4.usa_pd;
+	uint8_t ch = SIM_DMA_CH_RX(cuart->u.asf4.slot_nr);
+	uint32_t len;
+
+	CRITICAL_SECTION_ENTER()
+	hri_sercomusart_clear_INTEN_RXC_bit(usa_pd->device.hw);
+
+	/* bytes the RXC interrupt already put into the ringbuffer go first */
+	while (cuart->rx_post.count < cuart->rx_post.len
+	       && ringbuffer_get(&usa_pd->rx, &cuart->rx_post.data[cuart->rx_post.count]) == ERR_NONE)
+		cuart->rx_post.count++;
+
+	len = cuart->rx_post.len - cuart->rx_post.count;
+	if (len) {
+		cuart->u.asf4.dma_rx_len = len;
+		_dma_set_destination_address(ch, &cuart->rx_post.data[cuart->rx_post.count]);
+		_dma_set_data_amount(ch, len);
+		_dma_enable_transaction(ch, false);
+	} else {
+		hri_sercomusart_set_INTEN_RXC_bit(usa_pd->device.hw);
+	}
+	CRITICAL_SECTION_LEAVE()
+
+	if (!len)
+		card_uart_rx_complete(cuart, cuart->rx_post.count);
+}
+
+/* stop a pending DMA reception, counting what has been received so far */
+static void sim_dma_rx_abort(struct card_uart *cuart)
+{
+	CRITICAL_SECTION_ENTER()
+	if (cuart->u.asf4.dma_rx_len) {
+		cuart->rx_post.count += cuart->u.asf4.dma_rx_len - sim_dma_stop(SIM_DMA_CH_RX(cuart->u.asf4.slot_nr));
+		cuart->u.asf4.dma_rx_len = 0;
+		hri_sercomusart_set_INTEN_RXC_bit(cuart->u.asf4.usa_pd->device.hw);
+	}
+	CRITICAL_SECTION_LEAVE()
+}
+
+/** transmit a block by DMA, the caller gets a single CUART_E_TX_COMPLETE once the last byte has been sent
+ *  the buffer must stay valid until then, just like for io_write()
+ */
+static int sim_dma_tx_start(struct card_uart *cuart, const uint8_t *data, size_t len)
+{
+	struct usart_async_descriptor *usa_pd = cuart->u.asf4.usa_pd;
+	uint8_t ch = SIM_DMA_CH_TX(cuart->u.asf4.slot_nr);
+
+	if (!len || len > 0xffff)
+		return -EINVAL;
+
+	/* nothing is left for the byte-by-byte path of the HAL, its TXC handling reports the end */
+	usa_pd->tx_buffer = (uint8_t *)data;
+	usa_pd->tx_buffer_length = len;
+	usa_pd->tx_por = len;
+	usa_pd->stat = USART_ASYNC_STATUS_BUSY;
+
+	_dma_set_source_address(ch, data);
+	_dma_set_data_amount(ch, len);
+	_dma_enable_transaction(ch, false);
+
+	return len;
+}
+
+/* stop both DMA channels of the slot, e.g. when the card is reset or deactivated */
+static void sim_dma_abort(struct card_uart *cuart)
+{
+	sim_dma_rx_abort(cuart);
+	sim_dma_stop(SIM_DMA_CH_TX(cuart->u.asf4.slot_nr));
+	cuart->u.asf4.usa_pd->stat = 0;
+}
+#endif
+
 
-#include <math.h>
 #include "atmel_start.h"
 #include "atmel_start_pins.h"
 #include "config/hpl_gclk_config.h"
+#include "config/peripheral_clk_config.h"
 #include "iso7816_3.h"
 
 /** possible clock sources for the SERCOM peripheral
  *  warning: the definition must match the GCLK configuration
  */
-static const uint8_t sercom_glck_sources[] = {GCLK_PCHCTRL_GEN_GCLK2_Val, GCLK_PCHCTRL_GEN_GCLK4_Val, GCLK_PCHCTRL_GEN_GCLK6_Val};
-
- /** possible clock frequencies in MHz for the SERCOM peripheral
-  *  warning: the definition must match the GCLK configuration
-  */
-static const double sercom_glck_freqs[] = {100E6 / CONF_GCLK_GEN_2_DIV, 100E6 / CONF_GCLK_GEN_4_DIV, 120E6 / CONF_GCLK_GEN_6_DIV};
+static const uint8_t sercom_glck_sources[] = {GCLK_PCHCTRL_GEN_GCLK2_Val, GCLK_PCHCTRL_GEN_GCLK4_Val, GCLK_PCHCTRL_GEN_GCLK6_Val, GCLK_PCHCTRL_GEN_GCLK1_Val, GCLK_PCHCTRL_GEN_GCLK5_Val};
 
 /** the GCLK ID for the SERCOM SIM peripherals
  *  @note: used as index for PCHCTRL
  */
 static const uint8_t SIM_peripheral_GCLK_ID[] = {SERCOM0_GCLK_ID_CORE, SERCOM1_GCLK_ID_CORE, SERCOM2_GCLK_ID_CORE, SERCOM3_GCLK_ID_CORE, SERCOM4_GCLK_ID_CORE, SERCOM5_GCLK_ID_CORE, SERCOM6_GCLK_ID_CORE, SERCOM7_GCLK_ID_CORE};
 
+/** SERCOM clock source, sample rate and BAUD register value for one combination of card clock, F and D */
+struct sim_baud_cfg {
+	/* BAUD register, FP << 13 | BAUD in the fractional modes */
+	uint16_t baud;
+	/* index into sercom_glck_sources, >= ARRAY_SIZE(sercom_glck_sources) if the rate isn't possible */
+	uint8_t gclk;
+	/* CTRLA.SAMPR: 0 = 16x arithmetic, 1 = 16x fractional, 3 = 8x fractional */
+	uint8_t sampr;
+};
+
+/* number of Fi (0..13) and Di (1..9) values which are not RFU */
+#define SIM_NUM_FI 14
+#define SIM_NUM_DI 9
+
+/* one table per card clock divider, indexed by [Fi][Di - 1], generated at build time by
+ * gen_sim_baud_table.py from the GCLK configuration */
+#include "sim_baud_table.h"
+
+static const struct sim_baud_cfg (*const sim_baud_cfgs[])[SIM_NUM_DI] = {
+	[SIM_CLKDIV_1] = sim_baud_cfg_div1,
+	[SIM_CLKDIV_2] = sim_baud_cfg_div2,
+	[SIM_CLKDIV_4] = sim_baud_cfg_div4,
+	[SIM_CLKDIV_8] = sim_baud_cfg_div8,
+};
+
+/* Fd = 372, Dd = 1, encoded like PPS1 */
+#define SIM_DEFAULT_FIDI 0x11
+
+/* RXC is raised about 10 ETU after the leading edge of a received character (start bit, 8 data
+ * bits, parity), we must not start transmitting before its guard time (another ETU) is over */
+#define SIM_RX_TX_DELAY_ETU 1
+/* with D=64 the interface device has to ensure at least 16 ETU between the leading edges of the
+ * last received and the next transmitted character (7816-3 7.2) */
+#define SIM_RX_TX_DELAY_ETU_D64 6
+
+/** error signalling by NACK of received characters with a parity error
+ *  it has to be inhibited until TS of the ATR told us the convention, else a card using the inverse
+ *  convention gets its TS NACKed
+ */
+static void set_error_signalling(void* hw, bool on) {
+
+	if (hri_sercomusart_get_CTRLC_INACK_bit(hw) == !on) {
+		return;
+	}
+
+	hri_sercomusart_clear_CTRLA_ENABLE_bit(hw);
+	hri_sercomusart_write_CTRLC_INACK_bit(hw, !on);
+	hri_sercomusart_set_CTRLA_ENABLE_bit(hw);
+}
+
 /** inverted signalling as per 7816-3 : inverted bit, inverted bit order
  */
 static void set_inverted_signalling(void* hw, bool on) {
@@ -211,73 +443,71 @@ static void set_inverted_signalling(void* hw, bool on) {
 	hri_sercomusart_set_CTRLA_ENABLE_bit(hw);
 }
 
+/** set the length of transmitted characters
+ *  in ISO7816 mode a character consists of start bit, 8 data bits and parity bit (10 ETU), followed by
+ *  GTIME ETU of guard time; GTIME can be 2..7, so only frames of 12 to 17 ETU are possible, longer ones
+ *  are sent as 17 ETU frames
+ *  @param[in] etu character frame length in ETU
+ *  @return frame length set, 0 if shorter than possible
+ */
+static uint16_t set_char_frame(void* hw, uint16_t etu) {
+
+	if (etu < 12) {
+		return 0;
+	}
+	if (etu > 17) {
+		etu = 17;
+	}
+	if (hri_sercomusart_read_CTRLC_GTIME_bf(hw) == etu - 10) {
+		return etu;
+	}
+
+	hri_sercomusart_clear_CTRLA_ENABLE_bit(hw);
+	hri_sercomusart_write_CTRLC_GTIME_bf(hw, etu - 10);
+	hri_sercomusart_set_CTRLA_ENABLE_bit(hw);
+
+	return etu;
+}
+
 /** change baud rate of card slot
- *  @param[in] slotnr slot number for which the baud rate should be set
- *  @param[in] baudrate baud rate in bps to set
- *  @return if the baud rate has been set, else a parameter is out of range
+ *  @param[in] cuart card uart of the slot for which the baud rate should be set
+ *  @param[in] cfg clock source, sample rate and BAUD value to use
+ *  @param[in] baudrate resulting baud rate in bps
+ *  @param[in] rx_tx_delay_etu delay between the last received and the next transmitted character, in ETU
+ *  @return if the baud rate has been set, else it can't be generated
  */
-static bool slot_set_baudrate(struct card_uart *cuart, uint32_t baudrate)
+static bool slot_set_baudrate(struct card_uart *cuart, const struct sim_baud_cfg *cfg, uint32_t baudrate,
+			      uint8_t rx_tx_delay_etu)
 {
 	uint8_t slotnr = cuart->u.asf4.slot_nr;
 	struct usart_async_descriptor* slot = SIM_peripheral_descriptors[slotnr];
 	Sercom *sercom = cuart->u.asf4.usa_pd->device.hw;
+	uint8_t gclk_id = SIM_peripheral_GCLK_ID[slotnr];
 	ASSERT(slotnr < ARRAY_SIZE(SIM_peripheral_descriptors));
 
 	if (NULL == slot) {
 		return false;
 	}
-
-	// calculate the error corresponding to the clock sources
-	uint16_t bauds[ARRAY_SIZE(sercom_glck_freqs)];
-	double errors[ARRAY_SIZE(sercom_glck_freqs)];
-	for (uint8_t i = 0; i < ARRAY_SIZE(sercom_glck_freqs); i++) {
-		double freq = sercom_glck_freqs[i]; // remember possible SERCOM frequency
-		uint32_t min = freq/16. *  (1. - 65535. / 65536.); // calculate the minimum baud rate for this frequency
-		uint32_t max = freq/16. *  (1. - 1. / 65536.); // calculate the maximum baud rate for this frequency
-		if (baudrate < min || baudrate > max) { // baud rate it out of supported range
-			errors[i] = NAN;
-		} else {
-			uint16_t baud = round(65536. * (1. - 16. * (baudrate/freq)));
-			bauds[i] = baud;
-			double actual = freq/16. *  (1. - baud / 65536.);
-			errors[i] = fabs(1.0 - (actual / baudrate));
-		}
-	}
-
-	// find the smallest error
-	uint8_t best = ARRAY_SIZE(sercom_glck_freqs);
-	for (uint8_t i = 0; i < ARRAY_SIZE(sercom_glck_freqs); i++) {
-		if (isnan(errors[i])) {
-			continue;
-		}
-		if (best >= ARRAY_SIZE(sercom_glck_freqs)) {
-			best = i;
-		} else if (errors[i] < errors[best]) {
-			best = i;
-		}
-	}
-	if (best >= ARRAY_SIZE(sercom_glck_freqs)) { // found no clock supporting this baud rate
+	if (cfg->gclk >= ARRAY_SIZE(sercom_glck_sources)) { // found no clock supporting this baud rate
 		return false;
 	}
 
-
 	// update cached values
 	cuart->u.asf4.current_baudrate = baudrate;
-	cuart->u.asf4.extrawait_after_rx = 1./baudrate * 1000 * 1000;
+	cuart->u.asf4.extrawait_after_rx = (uint64_t)rx_tx_delay_etu * CONF_CPU_FREQUENCY / baudrate;
 
-	printf("(%u) switching SERCOM clock to GCLK%u (freq = %lu kHz) and baud rate to %lu bps (baud = %u)\r\n", slotnr, (best + 1) * 2, (uint32_t)(round(sercom_glck_freqs[best] / 1000)), baudrate, bauds[best]);
+	/* the rate is only ever changed while the card is idle (after reset, ATR or PPS, see 7816-3 5.2.3),
+	 * so there is no transmission to wait for */
+	usart_async_disable(slot); // disable SERCOM peripheral
 
-	/* only wait if the uart is enabled.... */
-	if (hri_sercomusart_get_CTRLA_reg(sercom, SERCOM_USART_CTRLA_ENABLE)) {
-		while (!usart_async_is_tx_empty(slot)); // wait for transmission to complete (WARNING no timeout)
-		usart_async_disable(slot); // disable SERCOM peripheral
+	if (hri_gclk_read_PCHCTRL_GEN_bf(GCLK, gclk_id) != sercom_glck_sources[cfg->gclk]) {
+		hri_gclk_clear_PCHCTRL_reg(GCLK, gclk_id, (1 << GCLK_PCHCTRL_CHEN_Pos)); // disable clock for this peripheral
+		while (hri_gclk_get_PCHCTRL_reg(GCLK, gclk_id, (1 << GCLK_PCHCTRL_CHEN_Pos))); // wait until clock is really disabled
+		// it does not seem we need to completely disable the peripheral using hri_mclk_clear_APBDMASK_SERCOMn_bit
+		hri_gclk_write_PCHCTRL_reg(GCLK, gclk_id, sercom_glck_sources[cfg->gclk] | (1 << GCLK_PCHCTRL_CHEN_Pos)); // set peripheral core clock and re-enable it
 	}
-
-	hri_gclk_clear_PCHCTRL_reg(GCLK, SIM_peripheral_GCLK_ID[slotnr], (1 << GCLK_PCHCTRL_CHEN_Pos)); // disable clock for this peripheral
-	while (hri_gclk_get_PCHCTRL_reg(GCLK, SIM_peripheral_GCLK_ID[slotnr], (1 << GCLK_PCHCTRL_CHEN_Pos))); // wait until clock is really disabled
-	// it does not seem we need to completely disable the peripheral using hri_mclk_clear_APBDMASK_SERCOMn_bit
-	hri_gclk_write_PCHCTRL_reg(GCLK, SIM_peripheral_GCLK_ID[slotnr], sercom_glck_sources[best] | (1 << GCLK_PCHCTRL_CHEN_Pos)); // set peripheral core clock and re-enable it
-	usart_async_set_baud_rate(slot, bauds[best]); // set the new baud rate
+	hri_sercomusart_write_CTRLA_SAMPR_bf(sercom, cfg->sampr); // fractional BAUD needs the matching sample rate
+	usart_async_set_baud_rate(slot, cfg->baud); // set the new baud rate
 
 	/* clear pending errors that happened while
 	 * - the interrupt was off (inverse ATR? -> parity error)
@@ -294,14 +524,48 @@ static bool slot_set_baudrate(struct card_uart *cuart, uint32_t baudrate)
 	return true;
 }
 
+/** check F and D for slot_set_fidi()
+ *  @param[in] clkdiv card clock divider
+ *  @param[in] fidi Fi and Di index, encoded like PPS1 (Fi << 4 | Di)
+ *  @return if the baud rate table has an entry for them
+ */
+static bool slot_fidi_valid(enum ncn8025_sim_clkdiv clkdiv, uint8_t fidi)
+{
+	uint8_t fi = fidi >> 4, di = fidi & 0xf;
+
+	if (clkdiv >= ARRAY_SIZE(sim_baud_cfgs) || fi >= SIM_NUM_FI || di < 1 || di > SIM_NUM_DI) {
+		return false;
+	}
+	return iso7816_3_fi_table[fi] != 0;
+}
+
+/** change F and D of card slot, keeping the current card clock
+ *  @param[in] cuart card uart of the slot for which the baud rate should be set
+ *  @param[in] clkdiv card clock divider
+ *  @param[in] fidi Fi and Di index, encoded like PPS1 (Fi << 4 | Di)
+ *  @return if the baud rate has been set, else a parameter is out of range
+ */
+static bool slot_set_fidi(struct card_uart *cuart, enum ncn8025_sim_clkdiv clkdiv, uint8_t fidi)
+{
+	uint8_t fi = fidi >> 4, di = fidi & 0xf;
+	uint8_t delay;
+
+	if (!slot_fidi_valid(clkdiv, fidi)) {
+		return false;
+	}
+
+	uint32_t baudrate = (20000000UL / ncn8025_div_val[clkdiv] * iso7816_3_di_table[di]) / iso7816_3_fi_table[fi];
+	delay = iso7816_3_di_table[di] == 64 ? SIM_RX_TX_DELAY_ETU_D64 : SIM_RX_TX_DELAY_ETU;
+	return slot_set_baudrate(cuart, &sim_baud_cfgs[clkdiv][fi][di - 1], baudrate, delay);
+}
+
 /** change ISO baud rate of card slot
- *  @param[in] slotnr slot number for which the baud rate should be set
- *  @param[in] clkdiv can clock divider
- *  @param[in] f clock rate conversion integer F
- *  @param[in] d baud rate adjustment factor D
+ *  @param[in] cuart card uart of the slot for which the baud rate should be set
+ *  @param[in] clkdiv card clock divider
+ *  @param[in] fidi Fi and Di index, encoded like PPS1 (Fi << 4 | Di)
  *  @return if the baud rate has been set, else a parameter is out of range
  */
-static bool slot_set_isorate(struct card_uart *cuart, enum ncn8025_sim_clkdiv clkdiv, uint16_t f, uint8_t d)
+static bool slot_set_isorate(struct card_uart *cuart, enum ncn8025_sim_clkdiv clkdiv, uint8_t fidi)
 {
 	uint8_t slotnr = cuart->u.asf4.slot_nr;
 	struct usart_async_descriptor* slot = SIM_peripheral_descriptors[slotnr];
@@ -311,14 +575,9 @@ static bool slot_set_isorate(struct card_uart *cuart, enum ncn8025_sim_clkdiv cl
 	if (clkdiv != SIM_CLKDIV_1 && clkdiv != SIM_CLKDIV_2 && clkdiv != SIM_CLKDIV_4 && clkdiv != SIM_CLKDIV_8) {
 		return false;
 	}
-	if (!iso7816_3_valid_f(f)) {
-		return false;
-	}
-	if (!iso7816_3_valid_d(d)) {
-		return false;
-	}
 
-	// set clockdiv
+	/* set clockdiv; the card is in reset (or unpowered), and RST is only released by a later
+	 * write of the same register, so the baud rate can change right away */
 	struct ncn8025_settings settings;
 	ncn8025_get(slotnr, &settings);
 	if (settings.clkdiv != clkdiv) {
@@ -326,38 +585,68 @@ static bool slot_set_isorate(struct card_uart *cuart, enum ncn8025_sim_clkdiv cl
 		ncn8025_set(slotnr, &settings);
 	}
 
-	// calculate desired frequency
-	uint32_t freq = 20000000UL; // maximum frequency
-	switch (clkdiv) {
-	case SIM_CLKDIV_1:
-		freq /= 1;
-		break;
-	case SIM_CLKDIV_2:
-		freq /= 2;
-		break;
-	case SIM_CLKDIV_4:
-		freq /= 4;
-		break;
-	case SIM_CLKDIV_8:
-		freq /= 8;
-		break;
-	}
+	/* whatever waited for the card clock of before is void */
+	CRITICAL_SECTION_ENTER()
+	cuart->u.asf4.clock_pending = false;
+	cuart->u.asf4.fidi_deferred = 0;
+	cuart->u.asf4.tx_deferred = NULL;
+	CRITICAL_SECTION_LEAVE()
 
 	/* error interrupt off after reset due to possbile inverted atr and accompanying parity error
 	 * this was automatically enabled during error callback registration */
 	hri_sercomusart_write_INTEN_ERROR_bit(slot->device.hw, 0);
 
+	set_error_signalling(slot->device.hw, false);
 	set_inverted_signalling(slot->device.hw, false);
 
 	// set baud rate
-	uint32_t baudrate = (freq * d) / f; // calculate actual baud rate
-	return slot_set_baudrate(cuart, baudrate); // set baud rate
+	return slot_set_fidi(cuart, clkdiv, fidi);
 }
 
 /***********************************************************************
  * Interface with card_uart (cuart) core
  ***********************************************************************/
 
+static int asf4_usart_tx_start(struct card_uart *cuart, const uint8_t *data, size_t len)
+{
+#if (SIM_DMA != 0)
+	return sim_dma_tx_start(cuart, data, len);
+#else
+	return io_write(&cuart->u.asf4.usa_pd->io, data, len);
+#endif
+}
+
+/* the NCN8025 of the slot is updated in the background: complete what waited for the write,
+ * or report if it failed */
+static void _SIM_ncn8025_cb(uint8_t slot_nr, int rc, void *data)
+{
+	struct card_uart *cuart = data;
+	struct ncn8025_settings settings;
+	bool rst_released = cuart->u.asf4.rst_pending;
+	uint8_t fidi = cuart->u.asf4.fidi_deferred;
+	const uint8_t *tx = cuart->u.asf4.tx_deferred;
+
+	cuart->u.asf4.rst_pending = false;
+	cuart->u.asf4.clock_pending = false;
+	cuart->u.asf4.fidi_deferred = 0;
+	cuart->u.asf4.tx_deferred = NULL;
+
+	if (rc < 0) {
+		card_uart_notification(cuart, CUART_E_HW_ERROR, 0);
+		return;
+	}
+
+	/* the card runs on the new clock now */
+	if (fidi) {
+		ncn8025_get(slot_nr, &settings);
+		slot_set_fidi(cuart, settings.clkdiv, fidi);
+	}
+	if (tx && asf4_usart_tx_start(cuart, tx, cuart->u.asf4.tx_deferred_len) < 0)
+		card_uart_notification(cuart, CUART_E_HW_ERROR, 0);
+	if (rst_released)
+		card_uart_notification(cuart, CUART_E_RST_RELEASED, NULL);
+}
+
 /* forward-declaration */
 static struct card_uart_driver asf4_usart_driver;
 static int asf4_usart_close(struct card_uart *cuart);
@@ -375,14 +664,20 @@ static int asf4_usart_open(struct card_uart *cuart, const char *device_name)
 
 	cuart->u.asf4.usa_pd = usa_pd;
 	cuart->u.asf4.slot_nr = slot_nr;
+	cuart->u.asf4.rst_pending = false;
 
 	usart_async_register_callback(usa_pd, USART_ASYNC_RXC_CB, SIM_rx_cb[slot_nr]);
 	usart_async_register_callback(usa_pd, USART_ASYNC_TXC_CB, SIM_tx_cb[slot_nr]);
 	usart_async_register_callback(usa_pd, USART_ASYNC_ERROR_CB, SIM_error_cb[slot_nr]);
+	ncn8025_set_cb(slot_nr, _SIM_ncn8025_cb, cuart);
+#if (SIM_DMA != 0)
+	sim_dma_init(cuart);
+#endif
+	/* the ISO7816 T=0 mode (FORM, CMODE, MAXITER, DSNACK) is set up by config/hpl_sercom_config.h */
 	usart_async_enable(usa_pd);
 
 	// set USART baud rate to match the interface (f = 2.5 MHz) and card default settings (Fd = 372, Dd = 1)
-	slot_set_isorate(cuart, SIM_CLKDIV_8, ISO7816_3_DEFAULT_FD, ISO7816_3_DEFAULT_DD);
+	slot_set_isorate(cuart, SIM_CLKDIV_8, SIM_DEFAULT_FIDI);
 
         return 0;
 }
@@ -393,7 +688,11 @@ static int asf4_usart_close(struct card_uart *cuart)
 
 	OSMO_ASSERT(cuart->driver == &asf4_usart_driver);
 
+#if (SIM_DMA != 0)
+	sim_dma_abort(cuart);
+#endif
 	usart_async_disable(usa_pd);
+	ncn8025_set_cb(cuart->u.asf4.slot_nr, NULL, NULL);
 
 	return 0;
 }
@@ -403,10 +702,21 @@ static int asf4_usart_async_tx(struct card_uart *cuart, const uint8_t *data, siz
 	struct usart_async_descriptor *usa_pd = cuart->u.asf4.usa_pd;
 	int rc;
 
+	bool deferred;
+
 	OSMO_ASSERT(cuart->driver == &asf4_usart_driver);
 	OSMO_ASSERT(usart_async_is_tx_empty(usa_pd));
 
-	rc = io_write(&usa_pd->io, data, len);
+	/* not before the baud rate follows a card clock change, _SIM_ncn8025_cb() starts it then */
+	CRITICAL_SECTION_ENTER()
+	deferred = cuart->u.asf4.fidi_deferred != 0;
+	if (deferred) {
+		cuart->u.asf4.tx_deferred = data;
+		cuart->u.asf4.tx_deferred_len = len;
+	}
+	CRITICAL_SECTION_LEAVE()
+
+	rc = deferred ? len : asf4_usart_tx_start(cuart, data, len);
 	if (rc < 0)
 		return rc;
 
@@ -417,11 +727,23 @@ static int asf4_usart_async_tx(struct card_uart *cuart, const uint8_t *data, siz
 
 static int asf4_usart_async_rx(struct card_uart *cuart, uint8_t *data, size_t len)
 {
-	struct usart_async_descriptor *usa_pd = cuart->u.asf4.usa_pd;
-
 	OSMO_ASSERT(cuart->driver == &asf4_usart_driver);
 
-	return io_read(&usa_pd->io, data, len);
+#if (SIM_DMA != 0)
+	/* single bytes are cheaper by interrupt */
+	if (len > 1)
+		sim_dma_rx_start(cuart);
+#endif
+	/* else _SIM_rx_cb() stores every byte in the posted buffer */
+
+	return 0;
+}
+
+static void asf4_usart_rx_cancel(struct card_uart *cuart)
+{
+#if (SIM_DMA != 0)
+	sim_dma_rx_abort(cuart);
+#endif
 }
 
 #include "ccid_device.h"
@@ -430,6 +752,7 @@ static int asf4_usart_ctrl(struct card_uart *cuart, enum card_uart_ctl ctl, int
 {
 	struct ncn8025_settings settings;
 	Sercom *sercom = cuart->u.asf4.usa_pd->device.hw;
+	int rc;
 
 	switch (ctl) {
 	case CUART_CTL_NO_RXTX:
@@ -438,33 +761,58 @@ static int asf4_usart_ctrl(struct card_uart *cuart, enum card_uart_ctl ctl, int
 		 * uart is automatically re-enabled during slot_set_isorate which also clears the errors
 		 * when resetting the slot which happens automatically during error callback handling or powerup
 		 * so the uart usually does not stay disabled for a long time */
-		if (arg)
+		if (arg) {
+#if (SIM_DMA != 0)
+			sim_dma_abort(cuart);
+#endif
 			_usart_async_disable(&cuart->u.asf4.usa_pd->device);
+		}
 		break;
 	case CUART_CTL_RX:
 		if (arg){
 			/* no op */
 		} else {
-			delay_us(cuart->u.asf4.extrawait_after_rx);
+			/* timed by the cycle counter enabled at boot, independent of how the loop compiles
+			 * or where it runs from */
+			uint32_t t = DWT->CYCCNT;
+			while (DWT->CYCCNT - t < cuart->u.asf4.extrawait_after_rx);
 		}
 		break;
 	case CUART_CTL_RST:
+#if (SIM_DMA != 0)
+		sim_dma_abort(cuart);
+#endif
 		ncn8025_get(cuart->u.asf4.slot_nr, &settings);
 		settings.rstin = arg ? true : false;
+		/* the ATR is timed from the release of RST at the card, not from the request: once the
+		 * chip has it, _SIM_ncn8025_cb() issues CUART_E_RST_RELEASED */
+		CRITICAL_SECTION_ENTER()
 		ncn8025_set(cuart->u.asf4.slot_nr, &settings);
+		cuart->u.asf4.rst_pending = !arg && ncn8025_busy(cuart->u.asf4.slot_nr);
+		rc = !arg && !cuart->u.asf4.rst_pending;
+		CRITICAL_SECTION_LEAVE()
 		usart_async_flush_rx_buffer(cuart->u.asf4.usa_pd);
 
-		/* reset everything, card reset resets pps params */
-		if (arg)
-			slot_set_isorate(cuart, SIM_CLKDIV_8, ISO7816_3_DEFAULT_FD, ISO7816_3_DEFAULT_DD);
+		/* reset everything, card reset resets pps params and the extra guard time */
+		if (arg) {
+			slot_set_isorate(cuart, SIM_CLKDIV_8, SIM_DEFAULT_FIDI);
+			set_char_frame(sercom, 12);
+		}
 
+		/* nothing to write, RST has been released already */
+		if (rc)
+			card_uart_notification(cuart, CUART_E_RST_RELEASED, NULL);
 		break;
 
 	case CUART_CTL_POWER_5V0:
 	case CUART_CTL_POWER_3V0:
 	case CUART_CTL_POWER_1V8:
 		/* reset everything */
-		slot_set_isorate(cuart, SIM_CLKDIV_8, ISO7816_3_DEFAULT_FD, ISO7816_3_DEFAULT_DD);
+#if (SIM_DMA != 0)
+		sim_dma_abort(cuart);
+#endif
+		slot_set_isorate(cuart, SIM_CLKDIV_8, SIM_DEFAULT_FIDI);
+		set_char_frame(sercom, 12);
 
 
 		enum ncn8025_sim_voltage v = CUART_CTL_POWER_5V0;
@@ -500,13 +848,24 @@ static int asf4_usart_ctrl(struct card_uart *cuart, enum card_uart_ctl ctl, int
 		if(arg < 5000000)
 			clkdiv = SIM_CLKDIV_8;
 		settings.clkdiv = clkdiv;
+		/* the caller switches the baud rate next, CUART_CTL_SET_FD defers that until the
+		 * card clock changed */
+		CRITICAL_SECTION_ENTER()
 		ncn8025_set(cuart->u.asf4.slot_nr, &settings);
+		cuart->u.asf4.clock_pending = ncn8025_busy(cuart->u.asf4.slot_nr);
+		CRITICAL_SECTION_LEAVE()
 		break;
 	case CUART_CTL_SET_FD:
 		ncn8025_get(cuart->u.asf4.slot_nr, &settings);
-		uint8_t divider = ncn8025_div_val[settings.clkdiv];
-		uint32_t baudrate = (20e6/divider)/arg;
-		slot_set_baudrate(cuart, baudrate);
+		if (!slot_fidi_valid(settings.clkdiv, arg))
+			return -EINVAL;
+		CRITICAL_SECTION_ENTER()
+		if (cuart->u.asf4.clock_pending)
+			cuart->u.asf4.fidi_deferred = arg;
+		rc = cuart->u.asf4.clock_pending;
+		CRITICAL_SECTION_LEAVE()
+		if (!rc)
+			slot_set_fidi(cuart, settings.clkdiv, arg);
 		break;
 	case CUART_CTL_GET_BAUDRATE:
 		return cuart->u.asf4.current_baudrate;
@@ -517,6 +876,7 @@ static int asf4_usart_ctrl(struct card_uart *cuart, enum card_uart_ctl ctl, int
 		break;
 	case CUART_CTL_ERROR_AND_INV:
 		set_inverted_signalling(sercom, arg);
+		set_error_signalling(sercom, true);
 
 		/* clear pending errors that happened while the interrupt was off (ATR) and enable it*/
 		hri_sercomusart_clear_interrupt_ERROR_bit(sercom);
@@ -524,6 +884,11 @@ static int asf4_usart_ctrl(struct card_uart *cuart, enum card_uart_ctl ctl, int
 		volatile uint8_t dummy = hri_sercomusart_read_RXERRCNT_reg(sercom);
 		hri_sercomusart_set_INTEN_ERROR_bit(sercom);
 		break;
+	case CUART_CTL_CHAR_FRAME:
+		rc = set_char_frame(sercom, arg);
+		if (!rc)
+			return -EINVAL;
+		return rc;
 	default:
 		return 0;
 	}
@@ -535,6 +900,7 @@ static const struct card_uart_ops asf4_usart_ops = {
 	.close = asf4_usart_close,
 	.async_tx = asf4_usart_async_tx,
 	.async_rx = asf4_usart_async_rx,
+	.rx_cancel = asf4_usart_rx_cancel,
 	.ctrl = asf4_usart_ctrl,
 };
 
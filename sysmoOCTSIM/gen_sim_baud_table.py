@@ -0,0 +1,143 @@
+#!/usr/bin/python3
+
+# This script generates the SERCOM clock source, sample rate and BAUD register values used by
+# cuart_driver_asf4_usart_async.c for every combination of card clock divider, Fi and Di,
+# so that changing the rate at run time is a table lookup instead of soft-float math.
+#
+# The generator frequencies are derived from the GCLK and oscillator configuration.
+#
+# usage: gen_sim_baud_table.py config/hpl_gclk_config.h config/hpl_oscctrl_config.h > sim_baud_table.h
+
+import re, sys
+
+# NCN8025 CLKDIV encoding (enum ncn8025_sim_clkdiv) and resulting divider
+CLKDIVS = [('SIM_CLKDIV_1', 1), ('SIM_CLKDIV_2', 2), ('SIM_CLKDIV_4', 4), ('SIM_CLKDIV_8', 8)]
+
+# ISO/IEC 7816-3:2006(E) table 7 and 8; 0 is RFU
+FI_TABLE = [372, 372, 558, 744, 1116, 1488, 1860, 0, 0, 512, 768, 1024, 1536, 2048]
+DI_TABLE = [1, 2, 4, 8, 16, 32, 64, 12, 20]
+
+# SERCOM clock sources, GCLK generator numbers in the order of sercom_glck_sources[] in the driver
+GCLK_SOURCES = [2, 4, 6, 1, 5]
+# the generator which also drives the card clock (divided by the NCN8025): rates derived from it
+# are locked to the card, so it is preferred over any other source with the same error
+CARD_CLOCK_GCLK = 5
+# nominal DFLL48M output, in open as well as closed loop mode
+DFLL_FREQ = 48e6
+XOSC32K_FREQ = 32768
+
+# CTRLA.SAMPR values
+SAMPR_16X_ARITH = 0
+SAMPR_16X_FRAC = 1
+SAMPR_8X_FRAC = 3
+
+
+def read_conf(conf_files):
+    """the CONF_ defines of the Atmel Start configuration headers"""
+    conf = {}
+    for conf_file in conf_files:
+        with open(conf_file) as f:
+            for line in f:
+                m = re.match(r'#define (CONF_\w+) (\w+)\s*$', line)
+                if m:
+                    conf[m.group(1)] = m.group(2)
+    return conf
+
+
+def conf_int(conf, name):
+    return int(conf[name], 0)
+
+
+def osc_freq(conf, src):
+    """frequency of the oscillator selected by CONF_GCLK_GEN_n_SOURCE"""
+    m = re.match(r'GCLK_GENCTRL_SRC_(XOSC|DPLL)(\d)$', src)
+    if src == 'GCLK_GENCTRL_SRC_DFLL':
+        if not conf_int(conf, 'CONF_DFLL_ENABLE'):
+            sys.exit('DFLL not enabled')
+        return DFLL_FREQ
+    if m and m.group(1) == 'XOSC':
+        if not conf_int(conf, 'CONF_XOSC%s_ENABLE' % m.group(2)):
+            sys.exit('XOSC%s not enabled' % m.group(2))
+        return conf_int(conf, 'CONF_XOSC%s_FREQUENCY' % m.group(2))
+    if m and m.group(1) == 'DPLL':
+        dpll = 'CONF_FDPLL%s_' % m.group(2)
+        if not conf_int(conf, dpll + 'ENABLE'):
+            sys.exit('DPLL%s not enabled' % m.group(2))
+        refclk = conf_int(conf, dpll + 'REFCLK')
+        if refclk == 1:
+            fref = XOSC32K_FREQ
+        elif refclk in (2, 3):
+            # the XOSC reference is divided by 2 * (DIV + 1)
+            fref = osc_freq(conf, 'GCLK_GENCTRL_SRC_XOSC%u' % (refclk - 2)) / (2 * (conf_int(conf, dpll + 'DIV') + 1))
+        else:
+            sys.exit('unsupported DPLL%s reference %u' % (m.group(2), refclk))
+        return fref * (conf_int(conf, dpll + 'LDR') + 1 + conf_int(conf, dpll + 'LDRFRAC') / 32)
+    sys.exit('unsupported GCLK source %s' % src)
+
+
+def gclk_freq(conf, gen):
+    if not conf_int(conf, 'CONF_GCLK_GEN_%u_GENEN' % gen):
+        sys.exit('GCLK%u not enabled' % gen)
+    return osc_freq(conf, conf['CONF_GCLK_GEN_%u_SOURCE' % gen]) / conf_int(conf, 'CONF_GCLK_GEN_%u_DIV' % gen)
+
+
+def arith_cfg(rate, fref):
+    """BAUD value and relative error in arithmetic mode with 16x oversampling, None if impossible"""
+    if rate < fref / 16 / 65536 or rate > fref / 16 * (1 - 1 / 65536):
+        return None
+    baud = int(65536 * (1 - 16 * rate / fref) + 0.5)
+    actual = fref / 16 * (1 - baud / 65536)
+    return (baud, abs(1 - actual / rate))
+
+
+def frac_cfg(rate, fref, samples):
+    """BAUD value (FP << 13 | BAUD) and relative error in fractional mode, None if impossible"""
+    m = int(8 * fref / (samples * rate) + 0.5)
+    if m < 8 or m >= 8 * 8192:
+        return None
+    actual = 8 * fref / (samples * m)
+    return ((m % 8) << 13 | m // 8, abs(1 - actual / rate))
+
+
+def best_cfg(rate, frefs):
+    """(baud, gclk index, sampr) with the smallest error, the first candidate wins a tie;
+    8x oversampling is less robust against noise and only used if 16x can't do the rate"""
+    if not rate:
+        return (0, len(frefs), 0)
+    order = sorted(range(len(frefs)), key=lambda i: GCLK_SOURCES[i] != CARD_CLOCK_GCLK)
+    for modes in ([(SAMPR_16X_ARITH, arith_cfg), (SAMPR_16X_FRAC, lambda r, f: frac_cfg(r, f, 16))],
+                  [(SAMPR_8X_FRAC, lambda r, f: frac_cfg(r, f, 8))]):
+        best = None
+        for (sampr, fn) in modes:
+            for i in order:
+                cfg = fn(rate, frefs[i])
+                if cfg and (best is None or cfg[1] < best[3] - 1e-9):
+                    best = (cfg[0], i, sampr, cfg[1])
+        if best:
+            return best[:3]
+    return (0, len(frefs), 0)
+
+
+def main():
+    conf = read_conf(sys.argv[1:3])
+    frefs = [gclk_freq(conf, gen) for gen in GCLK_SOURCES]
+    sim_clock = gclk_freq(conf, CARD_CLOCK_GCLK)
+
+    print('/* generated by gen_sim_baud_table.py from %s, do not edit */' % ' '.join(sys.argv[1:3]))
+    print('/* SERCOM clocks: %s */' % ', '.join('GCLK%u = %u Hz' % (g, f) for (g, f) in zip(GCLK_SOURCES, frefs)))
+    print()
+    for (name, div) in CLKDIVS:
+        print('static const struct sim_baud_cfg sim_baud_cfg_div%u[SIM_NUM_FI][SIM_NUM_DI] = {' % div)
+        for fi, f in enumerate(FI_TABLE):
+            print('\t/* Fi = %u, F = %u */' % (fi, f))
+            entries = []
+            for d in DI_TABLE:
+                baud, gclk, sampr = best_cfg(sim_clock / div * d / f if f else 0, frefs)
+                entries.append('{ %5u, %u, %u }' % (baud, gclk, sampr))
+            print('\t{ %s },' % ', '.join(entries))
+        print('};')
+        print()
+
+
+if __name__ == '__main__':
+    main()
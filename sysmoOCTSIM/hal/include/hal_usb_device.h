@@ -227,6 +227,19 @@ int32_t usb_d_ep_enable(const uint8_t ep);
  */
 void usb_d_ep_disable(const uint8_t ep);
 
+/**
+ *  \brief Use both banks of the initialized bulk endpoint for its direction.
+ *
+ *  A second transfer can then be submitted while the first one is ongoing,
+ *  see \ref _usb_d_dev_ep_set_dual_bank for the restrictions.
+ *
+ *  \param[in] ep The endpoint address.
+ *  \return Operation status.
+ *  \retval 0 Success.
+ *  \retval <0 Error code.
+ */
+int32_t usb_d_ep_set_dual_bank(const uint8_t ep);
+
 /**
  *  \brief Get request data pointer to access received setup request packet
  *  \param[in] ep The endpoint address.
@@ -312,6 +312,22 @@ int32_t _usb_d_dev_ep_enable(const uint8_t ep);
  */
 void _usb_d_dev_ep_disable(const uint8_t ep);
 
+/**
+ * \brief Use both banks of a bulk endpoint for its direction (ping-pong)
+ *
+ * Must be called after initialization, before enabling the endpoint. The
+ * endpoint number can't be used for the other direction. Up to two transfers
+ * can be queued; each is a single multi-packet transaction, so the buffer must
+ * be word aligned in RAM and the size of an OUT transfer a multiple of the
+ * endpoint size.
+ *
+ * \param[in] ep The endpoint address.
+ * \return Operation result status.
+ * \retval 0 Success.
+ * \retval <0 Error code.
+ */
+int32_t _usb_d_dev_ep_set_dual_bank(const uint8_t ep);
+
 /**
  * \brief Set/Clear/Get USB device endpoint stall status
  * \param[in] ep Endpoint address.
@@ -95,6 +95,8 @@ struct usb_d_ep {
 	struct usb_ep_xfer xfer;
 	/** Endpoint callbacks. */
 	struct usb_d_ep_callbacks callbacks;
+	/** Two transfers can be ongoing, one per bank. */
+	bool dual_bank;
 };
 
 /**
@@ -385,6 +387,22 @@ void usb_d_ep_deinit(const uint8_t ep)
 	}
 	_usb_d_dev_ep_deinit(ep);
 	ept->xfer.hdr.ep = 0xFF;
+	ept->dual_bank   = false;
+}
+
+int32_t usb_d_ep_set_dual_bank(const uint8_t ep)
+{
+	int8_t  ep_index = _usb_d_find_ep(ep);
+	int32_t rc;
+	if (ep_index < 0) {
+		return -USB_ERR_PARAM;
+	}
+	rc = _usb_d_dev_ep_set_dual_bank(ep);
+	if (rc < 0) {
+		return rc;
+	}
+	usb_d_inst.ep[ep_index].dual_bank = true;
+	return ERR_NONE;
 }
 
 int32_t usb_d_ep_enable(const uint8_t ep)
@@ -439,7 +457,8 @@ int32_t usb_d_ep_transfer(const struct usb_d_transfer *xfer)
 
 	atomic_enter_critical(&flags);
 	state = ept->xfer.hdr.state;
-	if (state == USB_EP_S_IDLE) {
+	/* A dual bank endpoint takes a second transfer, the HPL reports when both banks are busy. */
+	if (state == USB_EP_S_IDLE || (ept->dual_bank && state == USB_EP_S_X_DATA)) {
 		ept->xfer.hdr.state = USB_EP_S_X_DATA;
 		atomic_leave_critical(&flags);
 	} else {
@@ -132,6 +132,18 @@ extern "C" {
 #define RAMFUNC __attribute__((section(".ramfunc")))
 #endif
 
+/**
+ * \brief Function on a time critical interrupt path, located in RAM when built
+ * with WITH_RAMFUNC_HOT (see also cuart.h)
+ */
+#ifndef RAMFUNC_HOT
+#ifdef WITH_RAMFUNC_HOT
+#define RAMFUNC_HOT RAMFUNC
+#else
+#define RAMFUNC_HOT
+#endif
+#endif
+
 /**
  * \brief No-init section.
  * Place a data object or a function in a no-init section.
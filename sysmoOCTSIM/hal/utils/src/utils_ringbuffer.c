@@ -31,6 +31,7 @@
  *
  */
 #include "utils_ringbuffer.h"
+#include "utils.h"
 
 /**
  * \brief Ringbuffer init
@@ -59,7 +60,7 @@ int32_t ringbuffer_init(struct ringbuffer *const rb, void *buf, uint32_t size)
  * \brief Get one byte from ringbuffer
  *
  */
-int32_t ringbuffer_get(struct ringbuffer *const rb, uint8_t *data)
+RAMFUNC_HOT int32_t ringbuffer_get(struct ringbuffer *const rb, uint8_t *data)
 {
 	ASSERT(rb && data);
 
@@ -76,7 +77,7 @@ int32_t ringbuffer_get(struct ringbuffer *const rb, uint8_t *data)
  * \brief Put one byte to ringbuffer
  *
  */
-int32_t ringbuffer_put(struct ringbuffer *const rb, uint8_t data)
+RAMFUNC_HOT int32_t ringbuffer_put(struct ringbuffer *const rb, uint8_t data)
 {
 	ASSERT(rb);
 
@@ -98,7 +99,7 @@ int32_t ringbuffer_put(struct ringbuffer *const rb, uint8_t data)
 /**
  * \brief Return the element number of ringbuffer
  */
-uint32_t ringbuffer_num(const struct ringbuffer *const rb)
+RAMFUNC_HOT uint32_t ringbuffer_num(const struct ringbuffer *const rb)
 {
 	ASSERT(rb);
 
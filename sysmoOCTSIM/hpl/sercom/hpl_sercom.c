@@ -44,6 +44,7 @@
 #include <hpl_usart_sync.h>
 #include <utils.h>
 #include <utils_assert.h>
+#include "prof.h"
 
 #ifndef CONF_SERCOM_0_USART_ENABLE
 #define CONF_SERCOM_0_USART_ENABLE 0
@@ -583,7 +584,7 @@ void _usart_async_set_irq_state(struct _usart_async_device *const device, const
  *
  * \param[in] p The pointer to interrupt parameter
  */
-static void _sercom_usart_interrupt_handler(struct _usart_async_device *device)
+static RAMFUNC_HOT void _sercom_usart_handle_irq(struct _usart_async_device *device)
 {
 	void *hw = device->hw;
 
@@ -603,11 +604,20 @@ static void _sercom_usart_interrupt_handler(struct _usart_async_device *device)
 		hri_sercomusart_read_DATA_reg(hw);
 		hri_sercomusart_clear_INTFLAG_RXC_bit(hw);
 		device->usart_cb.tx_done_cb(device);
-	} else if (hri_sercomusart_get_interrupt_RXC_bit(hw)) {
-		if (hri_sercomusart_read_STATUS_reg(hw)
-		    & (SERCOM_USART_STATUS_PERR | SERCOM_USART_STATUS_FERR | SERCOM_USART_STATUS_BUFOVF
-		       | SERCOM_USART_STATUS_ISF | SERCOM_USART_STATUS_COLL)) {
-			hri_sercomusart_clear_STATUS_reg(hw, SERCOM_USART_STATUS_MASK);
+	} else if (hri_sercomusart_get_interrupt_RXC_bit(hw) && hri_sercomusart_get_INTEN_RXC_bit(hw)) {
+		/* RXC disabled: a DMA channel reads DATA, don't steal the byte from it */
+		uint32_t status = hri_sercomusart_read_STATUS_reg(hw);
+
+		if (status & (SERCOM_USART_STATUS_PERR | SERCOM_USART_STATUS_FERR | SERCOM_USART_STATUS_BUFOVF
+			      | SERCOM_USART_STATUS_ISF | SERCOM_USART_STATUS_COLL)) {
+			/* the error callback reads STATUS itself, ITER tells repeatable from persistent
+			 * errors: only clear what it has seen, and the ERROR flag of the same event */
+			hri_sercomusart_clear_interrupt_ERROR_bit(hw);
+			device->usart_cb.error_cb(device);
+			hri_sercomusart_clear_STATUS_reg(hw, status);
+			/* the bad character is dropped: reading it clears RXC, otherwise it would be
+			 * delivered as valid once STATUS is clear */
+			hri_sercomusart_read_DATA_reg(hw);
 			return;
 		}
 #if 0
@@ -634,6 +644,14 @@ static void _sercom_usart_interrupt_handler(struct _usart_async_device *device)
 	}
 }
 
+static RAMFUNC_HOT void _sercom_usart_interrupt_handler(struct _usart_async_device *device)
+{
+	uint32_t t = prof_begin();
+
+	_sercom_usart_handle_irq(device);
+	prof_end(PROF_ISR_SERCOM, t);
+}
+
 /**
  * \internal Retrieve ordinal number of the given sercom hardware instance
  *
@@ -40,6 +40,7 @@
 #include <string.h>
 #include <utils_assert.h>
 #include <hal_delay.h>
+#include "prof.h"
 
 /**
  * \brief Dummy callback function
@@ -530,6 +531,19 @@ struct _usb_d_dev_ep {
 		} bits;
 		uint8_t u8;
 	} flags;
+	/** Dual bank (ping-pong) operation, see _usb_d_dev_ep_set_dual_bank(). */
+	struct {
+		/** Both banks are used for the endpoint direction. */
+		uint8_t enabled : 1;
+		/** Bank the next transfer is loaded into. */
+		uint8_t next : 1;
+		/** Bank whose transfer completes next. */
+		uint8_t done : 1;
+		/** Banks loaded with a transfer (bit mask). */
+		uint8_t loaded : 2;
+		/** Size of the transfer loaded into each bank. */
+		uint16_t size[2];
+	} pp;
 };
 
 /** Check if the endpoint is used. */
@@ -1372,6 +1386,162 @@ static inline void _usb_d_dev_trans_out_isr(struct _usb_d_dev_ep *ept, const uin
 	}
 }
 
+/**
+ * \brief Report all transfers loaded into the banks of a dual bank endpoint
+ *        as terminated, in the order they were loaded
+ * \param[in, out] ept Pointer to endpoint information.
+ * \param[in] code Information code passed.
+ */
+static void _usb_d_dev_pp_done_all(struct _usb_d_dev_ep *ept, const int32_t code)
+{
+	uint8_t loaded = ept->pp.loaded;
+	uint8_t n      = ept->pp.done;
+	uint8_t i;
+
+	ept->pp.loaded          = 0;
+	ept->flags.bits.is_busy = 0;
+	/* The callback may load new transfers. */
+	for (i = 0; i < 2; i++, n = !n) {
+		if (loaded & (1u << n)) {
+			dev_inst.ep_callbacks.done(ept->ep, code, 0);
+		}
+	}
+}
+
+/**
+ * \brief Terminate the transfers of a dual bank endpoint
+ * \param[in, out] ept Pointer to endpoint information.
+ * \param[in] code Information code passed.
+ */
+static void _usb_d_dev_pp_stop(struct _usb_d_dev_ep *ept, const int32_t code)
+{
+	uint8_t epn = USB_EP_GET_N(ept->ep);
+	bool    dir = ept->flags.bits.dir;
+	uint8_t n;
+
+	/* NAK both banks */
+	for (n = 0; n < 2; n++) {
+		if (dir) {
+			_usbd_ep_set_in_rdy(epn, n, false);
+		} else {
+			_usbd_ep_set_out_rdy(epn, n, false);
+		}
+	}
+	_usbd_ep_int_ack(epn, USB_D_BANK0_INT_FLAGS | USB_D_BANK1_INT_FLAGS);
+	_usbd_ep_int_dis(epn, USB_D_BANK0_INT_FLAGS | USB_D_BANK1_INT_FLAGS);
+
+	/* The hardware continues with the bank after the last completed one. */
+	n            = (hri_usbendpoint_read_EPSTATUS_reg(USB, epn) & USB_DEVICE_EPSTATUS_CURBK) ? 1 : 0;
+	ept->pp.done = n;
+	ept->pp.next = n;
+	_usb_d_dev_pp_done_all(ept, code);
+}
+
+/**
+ * \brief Load a transfer into the next bank of a dual bank endpoint
+ *
+ * There is no cache: each transfer is a single multi-packet transaction
+ * to/from the buffer, so that the hardware can switch banks on its own.
+ *
+ * \param[in, out] ept Pointer to endpoint information.
+ * \param[in] trans Pointer to the transfer description.
+ * \param[in] dir Endpoint direction.
+ * \return Operation result status.
+ */
+static int32_t _usb_d_dev_pp_trans(struct _usb_d_dev_ep *ept, const struct usb_d_transfer *trans, bool dir)
+{
+	Usb *                 hw        = USB;
+	uint8_t               epn       = USB_EP_GET_N(ept->ep);
+	UsbDeviceDescBank *   bank      = prvt_inst.desc_table[epn].DeviceDescBank;
+	uint16_t              size_mask = (ept->size == 1023) ? 1023 : (ept->size - 1);
+	uint32_t              pcksize   = USB_DEVICE_PCKSIZE_SIZE(_usbd_ep_pcksize_size(ept->size));
+	uint8_t               n;
+	volatile hal_atomic_t flags;
+
+	/* OUT must end with a short packet or fill the buffer exactly. */
+	if (!_usb_is_addr4dma(trans->buf, trans->size) || !_usb_is_aligned(trans->buf)
+	    || trans->size > USB_D_DEV_TRANS_MAX || (!dir && (!trans->size || (trans->size & size_mask)))) {
+		return -USB_ERR_PARAM;
+	}
+	if (ept->flags.bits.is_stalled) {
+		return USB_HALTED;
+	}
+
+	if (dir) {
+		pcksize |= USB_DEVICE_PCKSIZE_BYTE_COUNT(trans->size);
+		if (trans->zlp) {
+			pcksize |= USB_DEVICE_PCKSIZE_AUTO_ZLP;
+		}
+	} else {
+		pcksize |= USB_DEVICE_PCKSIZE_MULTI_PACKET_SIZE(trans->size);
+	}
+
+	atomic_enter_critical(&flags);
+	n = ept->pp.next;
+	if (ept->pp.loaded & (1u << n)) {
+		atomic_leave_critical(&flags);
+		return USB_BUSY;
+	}
+	ept->pp.loaded |= 1u << n;
+	ept->pp.next            = !n;
+	ept->pp.size[n]         = trans->size;
+	ept->flags.bits.is_busy = 1;
+	ept->flags.bits.dir     = dir;
+
+	_usbd_ep_set_buf(epn, n, (uint32_t)trans->buf);
+	bank[n].PCKSIZE.reg = pcksize;
+	_usbd_ep_clear_bank_status(epn, n);
+	hri_usbendpoint_set_EPINTEN_reg(hw, epn, USB_DEVICE_EPINTFLAG_TRCPT0 << n);
+	if (dir) {
+		_usbd_ep_set_in_rdy(epn, n, true);
+	} else {
+		_usbd_ep_set_out_rdy(epn, n, true);
+	}
+	atomic_leave_critical(&flags);
+
+	return ERR_NONE;
+}
+
+/**
+ * \brief Analyze flags for dual bank endpoint transactions
+ * \param[in] ept Pointer to endpoint information.
+ * \param[in] flags Endpoint interrupt flags.
+ */
+static inline void _usb_d_dev_trans_pp_isr(struct _usb_d_dev_ep *ept, uint8_t flags)
+{
+	uint8_t            epn  = USB_EP_GET_N(ept->ep);
+	UsbDeviceDescBank *bank = prvt_inst.desc_table[epn].DeviceDescBank;
+	uint8_t            n;
+
+	if (flags & (USB_DEVICE_EPINTFLAG_STALL0 | USB_DEVICE_EPINTFLAG_STALL1)) {
+		if (ept->pp.loaded) {
+			_usb_d_dev_pp_stop(ept, USB_TRANS_STALL);
+		} else {
+			_usbd_ep_int_dis(epn, USB_DEVICE_EPINTFLAG_STALL0 | USB_DEVICE_EPINTFLAG_STALL1);
+			dev_inst.ep_callbacks.done(ept->ep, USB_TRANS_STALL, 0);
+		}
+		return;
+	}
+
+	/* Banks complete in the order they were loaded. */
+	n = ept->pp.done;
+	while ((flags & (USB_DEVICE_EPINTFLAG_TRCPT0 << n)) && (ept->pp.loaded & (1u << n))) {
+		flags &= ~(USB_DEVICE_EPINTFLAG_TRCPT0 << n);
+		_usbd_ep_ack_io_cpt(epn, n);
+		_usbd_ep_int_dis(epn, USB_DEVICE_EPINTFLAG_TRCPT0 << n);
+
+		ept->trans_count = ept->flags.bits.dir ? ept->pp.size[n] : bank[n].PCKSIZE.bit.BYTE_COUNT;
+		ept->pp.loaded &= ~(1u << n);
+		ept->pp.done = !n;
+		if (!ept->pp.loaded) {
+			ept->flags.bits.is_busy = 0;
+		}
+		/* The callback may load the bank again. */
+		dev_inst.ep_callbacks.done(ept->ep, USB_TRANS_DONE, ept->trans_count);
+		n = ept->pp.done;
+	}
+}
+
 /**
  * \brief Handles the endpoint interrupts.
  * \param[in] epint Endpoint interrupt summary (by bits).
@@ -1391,7 +1561,9 @@ static inline void _usb_d_dev_handle_eps(uint32_t epint, struct _usb_d_dev_ep *e
 	mask  = hw->DEVICE.DeviceEndpoint[epn].EPINTENSET.reg;
 	flags &= mask;
 	if (flags) {
-		if ((ept->flags.bits.eptype == 0x1) && !_usb_d_dev_ep_is_busy(ept)) {
+		if (ept->pp.enabled) {
+			_usb_d_dev_trans_pp_isr(ept, flags);
+		} else if ((ept->flags.bits.eptype == 0x1) && !_usb_d_dev_ep_is_busy(ept)) {
 			_usb_d_dev_trans_setup_isr(ept, flags);
 		} else if (_usb_d_dev_ep_is_in(ept)) {
 			_usb_d_dev_trans_in_isr(ept, flags);
@@ -1405,7 +1577,7 @@ static inline void _usb_d_dev_handle_eps(uint32_t epint, struct _usb_d_dev_ep *e
  * \brief USB device interrupt handler
  * \param[in] unused The parameter is not used
  */
-static void _usb_d_dev_handler(void)
+static RAMFUNC_HOT void _usb_d_dev_handle_irq(void)
 {
 	Usb *   hw = USB;
 	uint8_t i;
@@ -1426,6 +1598,14 @@ static void _usb_d_dev_handler(void)
 	}
 }
 
+static RAMFUNC_HOT void _usb_d_dev_handler(void)
+{
+	uint32_t t = prof_begin();
+
+	_usb_d_dev_handle_irq();
+	prof_end(PROF_ISR_USB, t);
+}
+
 /**
  * \brief Reset all endpoint software instances
  */
@@ -1433,9 +1613,14 @@ static void _usb_d_dev_reset_epts(void)
 {
 	uint8_t i;
 	for (i = 0; i < USB_D_N_EP; i++) {
-		_usb_d_dev_trans_done(&dev_inst.ep[i], USB_TRANS_RESET);
+		if (dev_inst.ep[i].pp.enabled) {
+			_usb_d_dev_pp_done_all(&dev_inst.ep[i], USB_TRANS_RESET);
+		} else {
+			_usb_d_dev_trans_done(&dev_inst.ep[i], USB_TRANS_RESET);
+		}
 		dev_inst.ep[i].ep       = 0xFF;
 		dev_inst.ep[i].flags.u8 = 0;
+		dev_inst.ep[i].pp.enabled = 0;
 	}
 	memset(prvt_inst.desc_table, 0, sizeof(UsbDeviceDescriptor) * (CONF_USB_D_MAX_EP_N + 1));
 }
@@ -1639,6 +1824,10 @@ int32_t _usb_d_dev_ep_init(const uint8_t ep, const uint8_t attr, const uint16_t
 	if (ept->ep != 0xFF) {
 		return -USB_ERR_REDO;
 	}
+	/* Both banks are used by the other direction. */
+	if (epn && _usb_d_dev_ept(epn, !dir)->pp.enabled) {
+		return -USB_ERR_REDO;
+	}
 	if (ep_type == USB_EP_XTYPE_CTRL) {
 		struct _usb_d_dev_ep *ept_in = _usb_d_dev_ept(epn, !dir);
 		if (ept_in->ep != 0xFF) {
@@ -1676,8 +1865,9 @@ void _usb_d_dev_ep_deinit(uint8_t ep)
 	_usb_d_dev_trans_stop(ept, dir, USB_TRANS_RESET);
 
 	/* Disable the endpoint. */
-	if (_usb_d_dev_ep_is_ctrl(ept)) {
-		hw->DEVICE.DeviceEndpoint[ep].EPCFG.reg = 0;
+	if (_usb_d_dev_ep_is_ctrl(ept) || ept->pp.enabled) {
+		hw->DEVICE.DeviceEndpoint[epn].EPCFG.reg = 0;
+		ept->pp.enabled                          = 0;
 	} else if (USB_EP_GET_DIR(ep)) {
 		hw->DEVICE.DeviceEndpoint[USB_EP_GET_N(ep)].EPCFG.reg &= ~USB_DEVICE_EPCFG_EPTYPE1_Msk;
 	} else {
@@ -1695,6 +1885,7 @@ int32_t _usb_d_dev_ep_enable(const uint8_t ep)
 	struct _usb_d_dev_ep *ept   = _usb_d_dev_ept(epn, dir);
 	uint8_t               epcfg = hri_usbendpoint_read_EPCFG_reg(hw, epn);
 	UsbDeviceDescBank *   bank;
+	uint8_t               n;
 
 	if (epn > CONF_USB_D_MAX_EP_N || !_usb_d_dev_ep_is_used(ept)) {
 		return -USB_ERR_PARAM;
@@ -1720,6 +1911,30 @@ int32_t _usb_d_dev_ep_enable(const uint8_t ep)
 		/* Enable SETUP reception for control endpoint. */
 		_usb_d_dev_trans_setup(ept);
 
+	} else if (ept->pp.enabled) {
+		/* The bank of the other direction becomes the second bank. */
+		if (dir) {
+			epcfg = USB_DEVICE_EPCFG_EPTYPE1(ept->flags.bits.eptype) | USB_DEVICE_EPCFG_EPTYPE0(USB_D_EPTYPE_DUAL);
+		} else {
+			epcfg = USB_DEVICE_EPCFG_EPTYPE0(ept->flags.bits.eptype) | USB_DEVICE_EPCFG_EPTYPE1(USB_D_EPTYPE_DUAL);
+		}
+		hri_usbendpoint_write_EPCFG_reg(hw, epn, epcfg);
+
+		for (n = 0; n < 2; n++) {
+			bank[n].PCKSIZE.reg = USB_DEVICE_PCKSIZE_SIZE(_usbd_ep_pcksize_size(ept->size));
+			/* By default, NAK all token. */
+			if (dir) {
+				_usbd_ep_set_in_rdy(epn, n, false);
+			} else {
+				_usbd_ep_set_out_rdy(epn, n, false);
+			}
+			_usbd_ep_clear_bank_status(epn, n);
+		}
+		hri_usbendpoint_clear_EPSTATUS_reg(hw, epn, USB_DEVICE_EPSTATUS_CURBK);
+		ept->pp.next   = 0;
+		ept->pp.done   = 0;
+		ept->pp.loaded = 0;
+
 	} else if (dir) {
 		/* prevents init->enable->disable->enable again from working without reinit...*/
 		// if (epcfg & USB_DEVICE_EPCFG_EPTYPE1_Msk) {
@@ -1767,6 +1982,27 @@ void _usb_d_dev_ep_disable(const uint8_t ep)
 	}
 }
 
+int32_t _usb_d_dev_ep_set_dual_bank(const uint8_t ep)
+{
+	uint8_t               epn = USB_EP_GET_N(ep);
+	bool                  dir = USB_EP_GET_DIR(ep);
+	struct _usb_d_dev_ep *ept = _usb_d_dev_ept(epn, dir);
+
+	if (epn == 0 || epn > CONF_USB_D_MAX_EP_N || !_usb_d_dev_ep_is_used(ept)) {
+		return -USB_ERR_PARAM;
+	}
+	/* EPCFG.EPTYPE is the transfer type + 1 */
+	if (ept->flags.bits.eptype != USB_EP_XTYPE_BULK + 1) {
+		return -USB_ERR_FUNC;
+	}
+	/* The bank of the other direction must be free. */
+	if (_usb_d_dev_ep_is_used(_usb_d_dev_ept(epn, !dir))) {
+		return -USB_ERR_REDO;
+	}
+	ept->pp.enabled = 1;
+	return USB_OK;
+}
+
 /**
  * \brief Get endpoint stall status
  * \param[in] ept Pointer to endpoint information.
@@ -1792,6 +2028,11 @@ static inline int32_t _usb_d_dev_ep_stall_set(struct _usb_d_dev_ep *ept, bool di
 	uint8_t epn = USB_EP_GET_N(ept->ep);
 	_usbd_ep_set_stall(epn, dir, true);
 	_usbd_ep_int_en(epn, USB_DEVICE_EPINTFLAG_STALL0 << dir);
+	if (ept->pp.enabled) {
+		/* Either bank may receive the next token. */
+		_usbd_ep_set_stall(epn, !dir, true);
+		_usbd_ep_int_en(epn, USB_DEVICE_EPINTFLAG_STALL0 << !dir);
+	}
 	ept->flags.bits.is_stalled = 1;
 	/* In stall interrupt abort the transfer. */
 	return ERR_NONE;
@@ -1816,6 +2057,14 @@ static inline int32_t _usb_d_dev_ep_stall_clr(struct _usb_d_dev_ep *ept, bool di
 		_usbd_ep_ack_stall(epn, dir);
 		_usbd_ep_set_toggle(epn, dir, 0);
 	}
+	if (ept->pp.enabled) {
+		_usbd_ep_set_stall(epn, !dir, false);
+		_usbd_ep_int_dis(epn, USB_DEVICE_EPINTFLAG_STALL0 << !dir);
+		if (_usbd_ep_is_stall_sent(epn, !dir)) {
+			_usbd_ep_ack_stall(epn, !dir);
+			_usbd_ep_set_toggle(epn, dir, 0);
+		}
+	}
 	if (_usb_d_dev_ep_is_ctrl(ept)) {
 		if ((hri_usbendpoint_read_EPSTATUS_reg(USB, epn) & USB_DEVICE_EPSTATUS_STALLRQ_Msk) == 0) {
 			ept->flags.bits.is_stalled = 0;
@@ -1852,7 +2101,7 @@ int32_t _usb_d_dev_ep_stall(const uint8_t ep, const enum usb_ep_stall_ctrl ctrl)
  * \param[in, out] ept Pointer to endpoint information.
  * \param[in] code Information code passed.
  */
-static void _usb_d_dev_trans_done(struct _usb_d_dev_ep *ept, const int32_t code)
+static RAMFUNC_HOT void _usb_d_dev_trans_done(struct _usb_d_dev_ep *ept, const int32_t code)
 {
 	if (!(_usb_d_dev_ep_is_used(ept) && _usb_d_dev_ep_is_busy(ept))) {
 		return;
@@ -1875,6 +2124,10 @@ static void _usb_d_dev_trans_stop(struct _usb_d_dev_ep *ept, bool dir, const int
 	if (!(_usb_d_dev_ep_is_used(ept) && _usb_d_dev_ep_is_busy(ept))) {
 		return;
 	}
+	if (ept->pp.enabled) {
+		_usb_d_dev_pp_stop(ept, code);
+		return;
+	}
 	/* Stop transfer */
 	if (dir) {
 		/* NAK IN */
@@ -1926,6 +2179,9 @@ int32_t _usb_d_dev_ep_trans(const struct usb_d_transfer *trans)
 	if (epn > CONF_USB_D_MAX_EP_N) {
 		return -USB_ERR_PARAM;
 	}
+	if (ept->pp.enabled) {
+		return _usb_d_dev_pp_trans(ept, trans, dir);
+	}
 
 	/* Cases that needs cache:
 	 * 1. Buffer not in RAM (cache all).
@@ -2048,7 +2304,7 @@ void _usb_d_dev_register_ep_callback(const enum usb_d_dev_ep_cb_type type, const
 /**
  * \brief USB interrupt handler
  */
-void USB_0_Handler(void)
+RAMFUNC_HOT void USB_0_Handler(void)
 {
 
 	_usb_d_dev_handler();
@@ -2056,7 +2312,7 @@ void USB_0_Handler(void)
 /**
  * \brief USB interrupt handler
  */
-void USB_1_Handler(void)
+RAMFUNC_HOT void USB_1_Handler(void)
 {
 
 	_usb_d_dev_handler();
@@ -2064,7 +2320,7 @@ void USB_1_Handler(void)
 /**
  * \brief USB interrupt handler
  */
-void USB_2_Handler(void)
+RAMFUNC_HOT void USB_2_Handler(void)
 {
 
 	_usb_d_dev_handler();
@@ -2072,7 +2328,7 @@ void USB_2_Handler(void)
 /**
  * \brief USB interrupt handler
  */
-void USB_3_Handler(void)
+RAMFUNC_HOT void USB_3_Handler(void)
 {
 
 	_usb_d_dev_handler();
@@ -7,8 +7,15 @@
 
 #include <hal_gpio.h>
 #include <hal_delay.h>
+#include <hal_atomic.h>
 #include <err_codes.h>
+#include <utils.h>
 #include "i2c_bitbang.h"
+#include "prof.h"
+
+/* how long a slave may stretch the clock before the transfer is aborted */
+#define I2C_STRETCH_TIMEOUT_US	1000
+#define I2C_STRETCH_TIMEOUT_TICKS	100
 
 #define setsda(adap, val)	gpio_set_pin_level((adap)->pin_sda, val)
 #define setscl(adap, val)	gpio_set_pin_level((adap)->pin_scl, val)
@@ -52,11 +59,15 @@ static inline void scllo(const struct i2c_adapter *adap)
 
 static int sclhi(const struct i2c_adapter *adap)
 {
+	unsigned int us = 0;
+
 	setscl(adap, 1);
 
 	/* wait for slow slaves' clock stretching to complete */
 	while (!getscl(adap)) {
-		/* FIXME: abort at some point */
+		if (++us > I2C_STRETCH_TIMEOUT_US)
+			return ERR_TIMEOUT;
+		delay_us(1);
 	}
 	return 0;
 }
@@ -99,12 +110,12 @@ static int i2c_outb(const struct i2c_adapter *adap, uint8_t outdata)
 		setsda(adap, sb);
 		delay_us((adap->udelay + 1) / 2);
 		if (sclhi(adap) < 0)
-			return -ERR_TIMEOUT;
+			return ERR_TIMEOUT;
 		scllo(adap);
 	}
 	sdahi(adap);
 	if (sclhi(adap) < 0)
-		return -ERR_TIMEOUT;
+		return ERR_TIMEOUT;
 	ack = !getsda(adap);
 	scllo(adap);
 	return ack;
@@ -120,7 +131,7 @@ static int i2c_inb(const struct i2c_adapter *adap)
 	for (i = 0; i < 8; i++) {
 		/* SCL high */
 		if (sclhi(adap) < 0)
-			return -ERR_TIMEOUT;
+			return ERR_TIMEOUT;
 		indata = indata << 1;
 		if (getsda(adap))
 			indata |= 0x01;
@@ -134,7 +145,8 @@ static int i2c_inb(const struct i2c_adapter *adap)
 	return indata;
 }
 
-/*! Single-byte register write. Assumes 8bit register address + 8bit values */
+/*! Single-byte register write. Assumes 8bit register address + 8bit values.
+ *  Blocks until done, so it must not be used on a bus with queued transfers. */
 int i2c_write_reg(const struct i2c_adapter *adap, uint8_t addr, uint8_t reg, uint8_t val)
 {
 	int rc;
@@ -152,7 +164,8 @@ out_stop:
 	return rc;
 }
 
-/*! Single-byte register read. Assumes 8bit register address + 8bit values */
+/*! Single-byte register read. Assumes 8bit register address + 8bit values.
+ *  Blocks until done, so it must not be used on a bus with queued transfers. */
 int i2c_read_reg(const struct i2c_adapter *adap, uint8_t addr, uint8_t reg)
 {
 	int rc;
@@ -174,9 +187,323 @@ out_stop:
 	return rc;
 }
 
+/***********************************************************************
+ * queued transfers, advancing by one half clock cycle per timer tick
+ *
+ * All buses advance in lockstep: their lines are sampled and driven
+ * together, with one register access per PORT group, so transfers on
+ * different buses take no longer than one of them.
+ ***********************************************************************/
+
+enum i2c_phase {
+	I2C_PH_IDLE,
+	I2C_PH_START_SCL,	/* START done: pull SCL low, put the first bit on SDA */
+	I2C_PH_SCL_HI,		/* release SCL for the current bit */
+	I2C_PH_SCL_LO,		/* sample the current bit, pull SCL low, put the next bit on SDA */
+	I2C_PH_REPSTART_SDA,	/* SCL low: release SDA */
+	I2C_PH_REPSTART_SCL,	/* release SCL */
+	I2C_PH_REPSTART,	/* SCL high: pull SDA low */
+	I2C_PH_STOP_SDA,	/* SCL low: pull SDA low */
+	I2C_PH_STOP_SCL,	/* release SCL */
+	I2C_PH_STOP,		/* SCL high: release SDA, the transfer is done */
+};
+
+enum i2c_seg {
+	I2C_SEG_ADDR_W,
+	I2C_SEG_REG,
+	I2C_SEG_VAL,
+	I2C_SEG_REPSTART,
+	I2C_SEG_ADDR_R,
+	I2C_SEG_DATA,
+	I2C_SEG_STOP,
+};
+
+static const uint8_t i2c_seq_write[] = { I2C_SEG_ADDR_W, I2C_SEG_REG, I2C_SEG_VAL, I2C_SEG_STOP };
+static const uint8_t i2c_seq_read[] = { I2C_SEG_ADDR_W, I2C_SEG_REG, I2C_SEG_REPSTART, I2C_SEG_ADDR_R,
+					I2C_SEG_DATA, I2C_SEG_STOP };
+
+static uint8_t i2c_cur_seg(const struct i2c_bus_state *st)
+{
+	return st->cur->read ? i2c_seq_read[st->seg] : i2c_seq_write[st->seg];
+}
+
+/* start the current segment, SCL is low */
+static void i2c_seg_start(struct i2c_bus_state *st)
+{
+	struct i2c_xfer *xfer = st->cur;
+
+	switch (i2c_cur_seg(st)) {
+	case I2C_SEG_ADDR_W:
+		st->out = (xfer->addr << 1) << 1 | 1;
+		break;
+	case I2C_SEG_REG:
+		st->out = xfer->reg << 1 | 1;
+		break;
+	case I2C_SEG_VAL:
+		st->out = xfer->val << 1 | 1;
+		break;
+	case I2C_SEG_ADDR_R:
+		st->out = (xfer->addr << 1 | 1) << 1 | 1;
+		break;
+	case I2C_SEG_DATA:
+		/* release SDA for the slave, then NACK the (only) byte */
+		st->out = 0x1ff;
+		break;
+	case I2C_SEG_REPSTART:
+		st->phase = I2C_PH_REPSTART_SDA;
+		return;
+	case I2C_SEG_STOP:
+		st->phase = I2C_PH_STOP_SDA;
+		return;
+	}
+	st->bit = 0;
+	st->in = 0;
+	st->sda = st->out >> 8;
+	st->phase = I2C_PH_SCL_HI;
+}
+
+/* SCL has been released: is a slave still holding it low? Aborts the transfer on timeout */
+static bool i2c_scl_stretched(struct i2c_bus_state *st)
+{
+	if (st->scl_in) {
+		st->stretch = 0;
+		return false;
+	}
+	if (++st->stretch > I2C_STRETCH_TIMEOUT_TICKS) {
+		/* there is no way to send a STOP, leave the bus released */
+		st->sda = 1;
+		st->stretch = 0;
+		st->rc = ERR_TIMEOUT;
+		st->phase = I2C_PH_STOP;
+	}
+	return true;
+}
+
+static void i2c_xfer_done(struct i2c_bus_state *st)
+{
+	struct i2c_xfer *xfer = st->cur;
+
+	st->cur = NULL;
+	st->phase = I2C_PH_IDLE;
+	xfer->busy = false;
+	prof_end(PROF_I2C, xfer->t_submit);
+	if (xfer->cb)
+		xfer->cb(xfer, st->rc);
+}
+
+/* advance the transfer of a bus by one half clock cycle, based on the sampled line levels */
+static void i2c_step(struct i2c_bus_state *st)
+{
+	switch (st->phase) {
+	case I2C_PH_IDLE:
+		CRITICAL_SECTION_ENTER()
+		if (!llist_empty(&st->queue)) {
+			st->cur = llist_entry(st->queue.next, struct i2c_xfer, list);
+			llist_del(&st->cur->list);
+		}
+		CRITICAL_SECTION_LEAVE()
+		if (!st->cur)
+			return;
+		st->seg = 0;
+		st->rc = 0;
+		st->stretch = 0;
+		/* START: SDA goes low while SCL is high */
+		st->sda = 0;
+		st->phase = I2C_PH_START_SCL;
+		break;
+	case I2C_PH_START_SCL:
+		st->scl = 0;
+		i2c_seg_start(st);
+		break;
+	case I2C_PH_SCL_HI:
+		st->scl = 1;
+		st->phase = I2C_PH_SCL_LO;
+		break;
+	case I2C_PH_SCL_LO:
+		if (i2c_scl_stretched(st))
+			break;
+		st->in = st->in << 1 | st->sda_in;
+		st->scl = 0;
+		if (++st->bit < 9) {
+			st->sda = (st->out >> (8 - st->bit)) & 1;
+			st->phase = I2C_PH_SCL_HI;
+			break;
+		}
+		if (i2c_cur_seg(st) == I2C_SEG_DATA) {
+			st->rc = st->in >> 1;
+		} else if (st->in & 1) {
+			/* no ACK from the slave */
+			st->rc = ERR_IO;
+			st->seg = (st->cur->read ? ARRAY_SIZE(i2c_seq_read) : ARRAY_SIZE(i2c_seq_write)) - 1;
+			i2c_seg_start(st);
+			break;
+		}
+		st->seg++;
+		i2c_seg_start(st);
+		break;
+	case I2C_PH_REPSTART_SDA:
+		st->sda = 1;
+		st->phase = I2C_PH_REPSTART_SCL;
+		break;
+	case I2C_PH_REPSTART_SCL:
+		st->scl = 1;
+		st->phase = I2C_PH_REPSTART;
+		break;
+	case I2C_PH_REPSTART:
+		if (i2c_scl_stretched(st))
+			break;
+		st->sda = 0;
+		st->seg++;
+		st->phase = I2C_PH_START_SCL;
+		break;
+	case I2C_PH_STOP_SDA:
+		st->sda = 0;
+		st->phase = I2C_PH_STOP_SCL;
+		break;
+	case I2C_PH_STOP_SCL:
+		st->scl = 1;
+		st->phase = I2C_PH_STOP;
+		break;
+	case I2C_PH_STOP:
+		if (st->rc != ERR_TIMEOUT && i2c_scl_stretched(st))
+			break;
+		st->sda = 1;
+		i2c_xfer_done(st);
+		break;
+	}
+}
+
+/* sample the lines of the buses with a transfer; a line is only driven low by a slave
+ * if we release it, so only those are switched to input for a moment */
+static void i2c_sample(const struct i2c_adapter *adaps, unsigned int num, uint32_t active)
+{
+	uint32_t mask[GPIO_PORTD + 1] = { 0 };
+	uint32_t in[GPIO_PORTD + 1] = { 0 };
+	unsigned int i;
+
+	for (i = 0; i < num; i++) {
+		const struct i2c_adapter *adap = &adaps[i];
+		if (!(active & (1U << i)))
+			continue;
+		if (adap->state->sda)
+			mask[GPIO_PORT(adap->pin_sda)] |= 1U << GPIO_PIN(adap->pin_sda);
+		if (adap->state->scl)
+			mask[GPIO_PORT(adap->pin_scl)] |= 1U << GPIO_PIN(adap->pin_scl);
+	}
+
+	for (i = 0; i < ARRAY_SIZE(mask); i++) {
+		if (!mask[i])
+			continue;
+		gpio_set_port_direction(i, mask[i], GPIO_DIRECTION_IN);
+		in[i] = gpio_get_port_level(i);
+		gpio_set_port_direction(i, mask[i], GPIO_DIRECTION_OUT);
+	}
+
+	for (i = 0; i < num; i++) {
+		const struct i2c_adapter *adap = &adaps[i];
+		struct i2c_bus_state *st = adap->state;
+		st->sda_in = st->sda && (in[GPIO_PORT(adap->pin_sda)] & (1U << GPIO_PIN(adap->pin_sda)));
+		st->scl_in = st->scl && (in[GPIO_PORT(adap->pin_scl)] & (1U << GPIO_PIN(adap->pin_scl)));
+	}
+}
+
+/* drive the lines of the buses with a transfer: SCL first, so that SDA only changes while SCL is low */
+static void i2c_drive(const struct i2c_adapter *adaps, unsigned int num, uint32_t active)
+{
+	uint32_t scl_hi[GPIO_PORTD + 1] = { 0 }, scl_lo[GPIO_PORTD + 1] = { 0 };
+	uint32_t sda_hi[GPIO_PORTD + 1] = { 0 }, sda_lo[GPIO_PORTD + 1] = { 0 };
+	unsigned int i;
+
+	for (i = 0; i < num; i++) {
+		const struct i2c_adapter *adap = &adaps[i];
+		if (!(active & (1U << i)))
+			continue;
+		if (adap->state->scl)
+			scl_hi[GPIO_PORT(adap->pin_scl)] |= 1U << GPIO_PIN(adap->pin_scl);
+		else
+			scl_lo[GPIO_PORT(adap->pin_scl)] |= 1U << GPIO_PIN(adap->pin_scl);
+		if (adap->state->sda)
+			sda_hi[GPIO_PORT(adap->pin_sda)] |= 1U << GPIO_PIN(adap->pin_sda);
+		else
+			sda_lo[GPIO_PORT(adap->pin_sda)] |= 1U << GPIO_PIN(adap->pin_sda);
+	}
+
+	for (i = 0; i < ARRAY_SIZE(scl_hi); i++) {
+		if (scl_hi[i])
+			gpio_set_port_level(i, scl_hi[i], true);
+		if (scl_lo[i])
+			gpio_set_port_level(i, scl_lo[i], false);
+	}
+	for (i = 0; i < ARRAY_SIZE(sda_hi); i++) {
+		if (sda_hi[i])
+			gpio_set_port_level(i, sda_hi[i], true);
+		if (sda_lo[i])
+			gpio_set_port_level(i, sda_lo[i], false);
+	}
+}
+
+/*! Advance the queued transfers of all buses by one half clock cycle.
+ *  Idle buses are left alone, so they can still be used by the blocking functions.
+ *  \param[in] adaps array of (at most 32) I2C adapters/buses
+ *  \param[in] num number of adapters in the array */
+void i2c_async_tick(const struct i2c_adapter *adaps, unsigned int num)
+{
+	uint32_t active = 0;
+	unsigned int i;
+
+	for (i = 0; i < num; i++) {
+		if (adaps[i].state->cur)
+			active |= 1U << i;
+	}
+	i2c_sample(adaps, num, active);
+
+	for (i = 0; i < num; i++) {
+		i2c_step(adaps[i].state);
+		/* a transfer may just have been started */
+		if (adaps[i].state->cur)
+			active |= 1U << i;
+	}
+	i2c_drive(adaps, num, active);
+}
+
+/*! Does a bus have a transfer in progress or queued? */
+bool i2c_busy(const struct i2c_adapter *adap)
+{
+	return adap->state->cur || !llist_empty(&adap->state->queue);
+}
+
+/*! Queue a single-byte register access, the callback of the transfer reports the result.
+ *  May be called from interrupt context.
+ *  \param[in] adap I2C adapter/bus
+ *  \param[in] xfer transfer, it must stay valid until its callback has been called
+ *  \returns 0 if queued; ERR_BUSY if the transfer is still queued or in progress */
+int i2c_submit(const struct i2c_adapter *adap, struct i2c_xfer *xfer)
+{
+	struct i2c_bus_state *st = adap->state;
+	int rc = ERR_BUSY;
+
+	CRITICAL_SECTION_ENTER()
+	if (!xfer->busy) {
+		xfer->busy = true;
+		xfer->t_submit = prof_begin();
+		llist_add_tail(&xfer->list, &st->queue);
+		rc = 0;
+	}
+	CRITICAL_SECTION_LEAVE()
+
+	if (rc == 0)
+		i2c_async_kick();
+	return rc;
+}
+
 /*! Initialize a given I2C adapter/bus */
 int i2c_init(const struct i2c_adapter *adap)
 {
+	INIT_LLIST_HEAD(&adap->state->queue);
+	adap->state->cur = NULL;
+	adap->state->phase = I2C_PH_IDLE;
+	adap->state->sda = adap->state->scl = true;
+
 	gpio_set_pin_direction(adap->pin_sda, GPIO_DIRECTION_OUT);
 	gpio_set_pin_direction(adap->pin_scl, GPIO_DIRECTION_OUT);
 
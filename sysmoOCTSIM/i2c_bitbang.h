@@ -1,13 +1,67 @@
 #pragma once
 #include <stdint.h>
+#include <stdbool.h>
+#include <osmocom/core/linuxlist.h>
+
+struct i2c_xfer;
+
+/*! completion of a queued transfer, called from interrupt context
+ *  \param[in] xfer the transfer, it may be submitted again from here
+ *  \param[in] rc the register value for a read, 0 for a write; negative on error */
+typedef void (*i2c_xfer_cb_t)(struct i2c_xfer *xfer, int rc);
+
+/*! single-byte register access for i2c_submit() */
+struct i2c_xfer {
+	struct llist_head list;
+	uint8_t addr;
+	uint8_t reg;
+	/* value to write, unused for a read */
+	uint8_t val;
+	bool read;
+	/* queued or in progress */
+	volatile bool busy;
+	/* prof_begin() at i2c_submit(), for the PROF_I2C latency */
+	uint32_t t_submit;
+	i2c_xfer_cb_t cb;
+	void *priv;
+};
+
+/*! state of the transfer engine of one bus */
+struct i2c_bus_state {
+	/* transfers waiting for the bus */
+	struct llist_head queue;
+	/* transfer on the bus, NULL if idle */
+	struct i2c_xfer *cur;
+	/* position in the transfer, see i2c_async_tick() */
+	uint8_t phase;
+	uint8_t seg;
+	uint8_t bit;
+	/* bits shifted out (MSB first, 9 bits incl. ACK) and sampled in */
+	uint16_t out;
+	uint16_t in;
+	/* ticks the clock has been stretched by the slave */
+	uint16_t stretch;
+	/* result passed to the callback */
+	int rc;
+	/* line levels we drive, and the levels sampled at the start of the tick */
+	bool sda, scl;
+	bool sda_in, scl_in;
+};
 
 struct i2c_adapter {
 	uint8_t	pin_scl;
 	uint8_t	pin_sda;
 	uint32_t udelay;
+	struct i2c_bus_state *state;
 };
 
 int i2c_init(const struct i2c_adapter *adap);
 int i2c_write_reg(const struct i2c_adapter *adap, uint8_t addr, uint8_t reg, uint8_t val);
 int i2c_read_reg(const struct i2c_adapter *adap, uint8_t addr, uint8_t reg);
-int i2c_init(const struct i2c_adapter *adap);
+
+int i2c_submit(const struct i2c_adapter *adap, struct i2c_xfer *xfer);
+void i2c_async_tick(const struct i2c_adapter *adaps, unsigned int num);
+bool i2c_busy(const struct i2c_adapter *adap);
+
+/*! provided by the board: call i2c_async_tick() periodically until no bus is busy any more */
+void i2c_async_kick(void);
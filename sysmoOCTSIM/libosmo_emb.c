@@ -7,7 +7,6 @@
 
 
 extern void *g_tall_ctx;
-void *g_msgb_ctx;
 
 /***********************************************************************
  * Timers
@@ -47,6 +46,7 @@ int _gettimeofday(struct timeval *tv, void *tz)
  ***********************************************************************/
 
 #include "logging.h"
+#include "binlog.h"
 #include <osmocom/core/logging.h>
 
 static const struct log_info_cat log_info_cat[] = {
@@ -160,16 +160,22 @@ static struct log_target *log_target_create_stderr_raw(void)
 void libosmo_emb_init(void)
 {
 	struct log_target *stderr_target;
-
-	/* msgb */
-#if 0
-	g_msgb_ctx = talloc_pool(g_tall_ctx, 20480);
-	talloc_set_memlimit(g_msgb_ctx, 20480);
-	msgb_talloc_ctx_init(g_msgb_ctx, 0);
+#ifdef WITH_BINLOG
+	struct log_target *binlog_target;
+	unsigned int i;
 #endif
+
 	/* logging */
 	log_init(&log_info, g_tall_ctx);
-#ifdef ENABLE_DBG_UART7
+#ifdef WITH_BINLOG
+	/* all categories, but only from NOTICE up unless raised with the "log" command */
+	binlog_target = log_target_create_binlog();
+	log_add_target(binlog_target);
+	log_set_all_filter(binlog_target, 1);
+	for (i = 0; i < ARRAY_SIZE(log_info_cat); i++)
+		log_set_category_filter(binlog_target, i, 1, log_info_cat[i].loglevel);
+	log_set_log_level(binlog_target, LOGL_NOTICE);
+#elif defined(ENABLE_DBG_UART7)
 	stderr_target = log_target_create_stderr_raw();
 	log_add_target(stderr_target);
 	log_set_all_filter(stderr_target, 1);
@@ -25,6 +25,9 @@
 
 #include <hal_cache.h>
 #include <hri_port_e54.h>
+#include <hri_eic_e54.h>
+#include <hri_mclk_e54.h>
+#include <peripheral_clk_config.h>
 
 #include "atmel_start.h"
 #include "atmel_start_pins.h"
@@ -34,9 +37,16 @@
 #include "ncn8025.h"
 
 #include "command.h"
+#include "mainloop.h"
+#include "prof.h"
+#include "binlog.h"
+#include "slot_bench.h"
 
 #include "ccid_device.h"
+#include "ccid_in_sched.h"
 #include "usb_descriptors.h"
+#include "libosmo_emb.h"
+#include "logging.h"
 
 static void bdg_bkptpanic(const char *fmt, va_list args)
 {
@@ -53,9 +63,9 @@ static void board_init(void)
 {
 	int i;
 
-	for (i = 0; i < 4; i++)
-		i2c_init(&i2c[i]);
+	octsim_i2c_init();
 
+	/* only queued: the I2C transfers run in the background, on all buses at once */
 	for (i = 0; i < 8; i++)
 		ncn8025_init(i);
 
@@ -75,30 +85,62 @@ static void board_init(void)
 #include <osmocom/core/linuxlist.h>
 #include <osmocom/core/msgb.h>
 #include "linuxlist_atomic.h"
+#include "msgb_pool.h"
 #include "ccid_df.h"
+#include "ccid_proto.h"
+#ifdef WITH_VENDOR_IF
+#include "vendor_df.h"
+#include "ccid_vendor.h"
+#endif
+
+/* msgbs for the USB endpoints and the CCID layer */
+#define NUM_MSGB 24
+/* msgbs kept back from the OUT EP for the responses, one per slot */
+#define NUM_RESP_BUF 8
+/* OUT messages handed to the CCID layer at once */
+#define NUM_OUT_BUF 16
+/* transfers queued on each CCID bulk EP: they are dual-bank, one per bank */
+#define EP_Q_DEPTH 2
+
+struct msgb_pool g_ccid_msgb_pool;
 
 struct usb_ep_q {
 	const char *name;
 	/* msgb queue of pending to-be-transmitted (IN/IRQ) or completed received (OUT)
 	 * USB transfers */
 	struct llist_head list;
-	/* currently ongoing/processed msgb (USB transmit or receive */
-	struct msgb *in_progress;
+	/* msgbs of the ongoing USB transmits or receives, in the order they complete */
+	struct llist_head in_progress;
+	unsigned int num_in_progress;
 };
 
-struct ccid_state {
-	/* msgb queue of free msgs */
-	struct llist_head free_q;
-
-	/* msgb queue of pending to-be-transmitted (IN EP) */
+/* endpoints of one CCID interface; the host numbers its slots from 0 */
+struct ccid_iface_state {
+	/* msgbs being transmitted (IN EP); the pending ones wait in in_sched */
 	struct usb_ep_q in_ep;
-	/* msgb queue of pending to-be-transmitted (IRQ EP) */
-	struct usb_ep_q irq_ep;
+	/* per-slot queues of pending to-be-transmitted (IN EP) */
+	struct ccid_in_sched in_sched;
 	/* msgb queue of completed received (OUT EP) */
 	struct usb_ep_q out_ep;
+	/* NotifySlotChange is being transmitted (IRQ EP) */
+	bool irq_in_progress;
+};
+
+struct ccid_state {
+	struct ccid_iface_state iface[CCID_NUM_IFACES];
 
 	/* bit-mask of card-insert status, as determined from NCN8025 IRQ output */
 	uint8_t card_insert_mask;
+	/* bit-mask of slots whose card-insert status changed since the last NotifySlotChange */
+	uint8_t card_change_mask;
+
+	/* interface and bSlot of the OUT message being handled by the CCID layer */
+	uint8_t cur_out_iface;
+	uint8_t cur_out_slot;
+
+	/* the endpoints are set up, since the host configured the device; nothing may be
+	 * submitted to them before, see usb_eps_poll() */
+	bool eps_ready;
 };
 static volatile struct ccid_state g_ccid_s;
 
@@ -106,27 +148,68 @@ static void ccid_out_read_compl(const uint8_t ep, enum usb_xfer_code code, uint3
 static void ccid_in_write_compl(const uint8_t ep, enum usb_xfer_code code, uint32_t transferred);
 static void ccid_irq_write_compl(const uint8_t ep, enum usb_xfer_code code, uint32_t transferred);
 
+#ifdef WITH_VENDOR_IF
+/* endpoints of the vendor specific interface and its protocol, see ccid_vendor.h */
+struct vendor_state {
+	/* msgb queue of pending to-be-transmitted (IN EP) */
+	struct usb_ep_q in_ep;
+	/* msgb queue of completed received (OUT EP) */
+	struct usb_ep_q out_ep;
+	struct ccid_vendor cv;
+};
+static struct vendor_state g_vnd_s;
+
+static void vnd_out_read_compl(const uint8_t ep, enum usb_xfer_code code, uint32_t transferred);
+static void vnd_in_write_compl(const uint8_t ep, enum usb_xfer_code code, uint32_t transferred);
+static int vnd_send_in(struct ccid_vendor *cv, struct msgb *msg);
+#endif
+
 static void usb_ep_q_init(struct usb_ep_q *ep_q, const char *name)
 {
 	ep_q->name = name;
 	INIT_LLIST_HEAD(&ep_q->list);
-	ep_q->in_progress = NULL;
+	INIT_LLIST_HEAD(&ep_q->in_progress);
+	ep_q->num_in_progress = 0;
+}
+
+/* track msg as ongoing transfer, right before submitting it with interrupts disabled */
+static void usb_ep_q_start(struct usb_ep_q *ep_q, struct msgb *msg)
+{
+	llist_add_tail(&msg->list, &ep_q->in_progress);
+	ep_q->num_in_progress++;
+}
+
+/* take back the msgb of the oldest ongoing transfer */
+static struct msgb *usb_ep_q_complete(struct usb_ep_q *ep_q)
+{
+	struct msgb *msg;
+
+	CRITICAL_SECTION_ENTER()
+	msg = msgb_dequeue(&ep_q->in_progress);
+	if (msg)
+		ep_q->num_in_progress--;
+	CRITICAL_SECTION_LEAVE()
+	return msg;
 }
 
 static void ccid_app_init(void)
 {
-	/* initialize data structures */
-	INIT_LLIST_HEAD(&g_ccid_s.free_q);
-	usb_ep_q_init(&g_ccid_s.in_ep, "IN");
-	usb_ep_q_init(&g_ccid_s.irq_ep, "IRQ");
-	usb_ep_q_init(&g_ccid_s.out_ep, "OUT");
+	uint8_t idx;
+
+	for (idx = 0; idx < CCID_NUM_IFACES; idx++) {
+		struct ccid_iface_state *cis = &g_ccid_s.iface[idx];
 
-	/* OUT endpoint read complete callback (irq context) */
-	ccid_df_register_callback(CCID_DF_CB_READ_OUT, (FUNC_PTR)&ccid_out_read_compl);
-	/* IN endpoint write complete callback (irq context) */
-	ccid_df_register_callback(CCID_DF_CB_WRITE_IN, (FUNC_PTR)&ccid_in_write_compl);
-	/* IRQ endpoint write complete callback (irq context) */
-	ccid_df_register_callback(CCID_DF_CB_WRITE_IRQ, (FUNC_PTR)&ccid_irq_write_compl);
+		/* initialize data structures */
+		usb_ep_q_init(&cis->in_ep, "IN");
+		usb_ep_q_init(&cis->out_ep, "OUT");
+		ccid_in_sched_init(&cis->in_sched);
+	}
+
+#ifdef WITH_VENDOR_IF
+	usb_ep_q_init(&g_vnd_s.in_ep, "VND IN");
+	usb_ep_q_init(&g_vnd_s.out_ep, "VND OUT");
+	ccid_vendor_init(&g_vnd_s.cv, &g_ci, vnd_send_in);
+#endif
 }
 
 /* irqsafe version of msgb_enqueue */
@@ -154,116 +237,158 @@ void msgb_enqueue_irqsafe(struct llist_head *q, struct msgb *msg)
 	CRITICAL_SECTION_LEAVE()
 }
 
-/* submit the next pending (if any) message for the IN EP */
-static int submit_next_in(void)
+/* submit the next pending (if any) messages for the IN EP, while it has a free bank */
+static int submit_next_in(uint8_t idx)
 {
-	struct usb_ep_q *ep_q = &g_ccid_s.in_ep;
-	struct msgb *msg = NULL;
-	int rc;
+	struct ccid_iface_state *cis = &g_ccid_s.iface[idx];
+	struct usb_ep_q *ep_q = &cis->in_ep;
+	int num = 0;
 
-	CRITICAL_SECTION_ENTER()
-	if (!ep_q->in_progress) {
-		msg = msgb_dequeue(&ep_q->list);
-		if (msg)
-			ep_q->in_progress = msg;
-	}
-	CRITICAL_SECTION_LEAVE()
-
-	if (!msg)
+	if (!g_ccid_s.eps_ready)
 		return 0;
 
-	rc = ccid_df_write_in(msgb_data(msg), msgb_length(msg));
-	if (rc != ERR_NONE) {
+	while (true) {
+		struct msgb *msg = NULL;
+		int rc = ERR_NONE;
+
+		/* submit in the order of in_progress */
 		CRITICAL_SECTION_ENTER()
-		ep_q->in_progress = NULL;
-		msgb_enqueue(&g_ccid_s.free_q, msg);
+		if (ep_q->num_in_progress < EP_Q_DEPTH) {
+			msg = ccid_in_sched_dequeue(&cis->in_sched);
+			if (msg) {
+				usb_ep_q_start(ep_q, msg);
+				rc = ccid_df_write_in(idx, msgb_data(msg), msgb_length(msg));
+				if (rc != ERR_NONE) {
+					llist_del(&msg->list);
+					ep_q->num_in_progress--;
+				}
+				/* not dual-bank after all: retry on completion */
+				if (rc == USB_BUSY)
+					ccid_in_sched_return(&cis->in_sched, msg);
+			}
+		}
 		CRITICAL_SECTION_LEAVE()
-		printf("EP %s failed: %d\r\n", ep_q->name, rc);
-		return -1;
-	}
-	return 1;
 
+		if (!msg || rc == USB_BUSY)
+			return num;
+		if (rc != ERR_NONE) {
+			msgb_pool_put(msg);
+			LOGP(DUSB, LOGL_ERROR, "EP %s failed: %d\n", ep_q->name, rc);
+			return -1;
+		}
+		num++;
+	}
 }
 
-/* submit the next pending (if any) message for the IRQ EP */
-static int submit_next_irq(void)
+static unsigned int ccid_gen_notify_slot_change(uint8_t *buf, uint8_t present_bm, uint8_t changed_bm,
+						unsigned int num_slots);
+static uint8_t card_detect_settling(void);
+
+/* submit a NotifySlotChange for the IRQ EP, if any card-insert status of the slots of the
+ * interface changed and is stable */
+static int submit_next_irq(uint8_t idx)
 {
-	struct usb_ep_q *ep_q = &g_ccid_s.irq_ep;
-	struct msgb *msg = NULL;
+	static uint8_t irq_buf[CCID_NUM_IFACES][sizeof(struct ccid_rdr_to_pc_notify_slot_change) + 2];
+	struct ccid_iface_state *cis = &g_ccid_s.iface[idx];
+	const uint8_t shift = idx * CCID_SLOTS_PER_IFACE;
+	const uint8_t mask = ((1 << CCID_SLOTS_PER_IFACE) - 1) << shift;
+	unsigned int len = 0;
+	uint8_t ready;
 	int rc;
 
+	if (!g_ccid_s.eps_ready)
+		return 0;
+
 	CRITICAL_SECTION_ENTER()
-	if (!ep_q->in_progress) {
-		msg = msgb_dequeue(&ep_q->list);
-		if (msg)
-			ep_q->in_progress = msg;
+	/* a slot whose input bounces again is held back until it settles, the others are
+	 * reported without waiting for it */
+	ready = g_ccid_s.card_change_mask & mask & ~card_detect_settling();
+	if (!cis->irq_in_progress && ready) {
+		len = ccid_gen_notify_slot_change(irq_buf[idx], (g_ccid_s.card_insert_mask & mask) >> shift,
+						  ready >> shift, CCID_SLOTS_PER_IFACE);
+		g_ccid_s.card_change_mask &= ~ready;
+		cis->irq_in_progress = true;
 	}
 	CRITICAL_SECTION_LEAVE()
 
-	if (!msg)
+	if (!len)
 		return 0;
 
-	rc = ccid_df_write_irq(msgb_data(msg), msgb_length(msg));
+	rc = ccid_df_write_irq(idx, irq_buf[idx], len);
 	/* may return HALTED/ERROR/DISABLED/BUSY/ERR_PARAM/ERR_FUNC/ERR_DENIED */
 	if (rc != ERR_NONE) {
-		CRITICAL_SECTION_ENTER()
-		ep_q->in_progress = NULL;
-		msgb_enqueue(&g_ccid_s.free_q, msg);
-		CRITICAL_SECTION_LEAVE()
-		printf("EP %s failed: %d\r\n", ep_q->name, rc);
+		cis->irq_in_progress = false;
+		LOGP(DUSB, LOGL_ERROR, "EP IRQ failed: %d\n", rc);
 		return -1;
 	}
 	return 1;
 }
 
-static int submit_next_out(void)
+/* submit free msgbs to the OUT EP, while it has a free bank */
+static int submit_next_out(uint8_t idx)
 {
-	struct usb_ep_q *ep_q = &g_ccid_s.out_ep;
-	struct msgb *msg = NULL;
-	int rc;
+	struct usb_ep_q *ep_q = &g_ccid_s.iface[idx].out_ep;
+	int num = 0;
 
-	CRITICAL_SECTION_ENTER()
-	if (!ep_q->in_progress) {
-		msg = msgb_dequeue(&g_ccid_s.free_q);
-		if (msg) {
-			msgb_reset(msg);
-			ep_q->in_progress = msg;
-		}
-	}
-	CRITICAL_SECTION_LEAVE()
-
-	if (!msg)
+	if (!g_ccid_s.eps_ready)
 		return 0;
 
-	rc = ccid_df_read_out(msgb_data(msg), msgb_tailroom(msg));
-	if (rc != ERR_NONE) {
+	while (true) {
+		struct msgb *msg = NULL;
+		int rc = ERR_NONE;
+
 		CRITICAL_SECTION_ENTER()
-		ep_q->in_progress = NULL;
-		/* re-add to the list of free msgb's */
-		msgb_enqueue(&g_ccid_s.free_q, msg);
+		/* leave enough msgbs for the responses of all slots */
+		if (ep_q->num_in_progress < EP_Q_DEPTH && g_ccid_msgb_pool.avail > NUM_RESP_BUF) {
+			msg = msgb_pool_get(&g_ccid_msgb_pool);
+			usb_ep_q_start(ep_q, msg);
+			rc = ccid_df_read_out(idx, msgb_data(msg), msgb_tailroom(msg));
+			if (rc != ERR_NONE) {
+				llist_del(&msg->list);
+				ep_q->num_in_progress--;
+			}
+		}
 		CRITICAL_SECTION_LEAVE()
-		return 0;
+
+		if (!msg)
+			return num;
+		if (rc != ERR_NONE) {
+			/* return it to the pool */
+			msgb_pool_put(msg);
+			return num;
+		}
+		num++;
 	}
-	return 1;
+}
+
+/* submit free msgbs to the OUT EPs of all interfaces */
+static void submit_next_out_all(void)
+{
+	uint8_t idx;
+
+	for (idx = 0; idx < CCID_NUM_IFACES; idx++)
+		submit_next_out(idx);
 }
 
 /* OUT endpoint read complete callback (irq context) */
 static void ccid_out_read_compl(const uint8_t ep, enum usb_xfer_code code, uint32_t transferred)
 {
-	struct msgb *msg = g_ccid_s.out_ep.in_progress;
+	int8_t idx = ccid_df_ep_to_idx(ep);
+	struct msgb *msg;
+
+	if (idx < 0)
+		return;
+	msg = usb_ep_q_complete(&g_ccid_s.iface[idx].out_ep);
 
 	/*
 	reset: resubmit from main loop when ready
 	unhalt: resubmit immediately
 	*/
 	if (code == USB_XFER_RESET || code == USB_XFER_UNHALT || code == USB_XFER_HALT) {
-		if (msg) {
-			msgb_reset(msg);
-			llist_add_tail_at(&msg->list, &g_ccid_s.free_q);
-			g_ccid_s.out_ep.in_progress = NULL;
-		}
+		if (msg)
+			msgb_pool_put(msg);
 		if (code == USB_XFER_UNHALT) {
-			submit_next_out();
+			submit_next_out(idx);
 		}
 		return;
 	}
@@ -273,112 +398,383 @@ static void ccid_out_read_compl(const uint8_t ep, enum usb_xfer_code code, uint3
 	/* update msgb with the amount of data received */
 	msgb_put(msg, transferred);
 	/* append to list of pending-to-be-handed messages */
-	llist_add_tail_at(&msg->list, &g_ccid_s.out_ep.list);
-	g_ccid_s.out_ep.in_progress = NULL;
+	llist_add_tail_at(&msg->list, &g_ccid_s.iface[idx].out_ep.list);
+	mainloop_schedule(WORK_OUT);
 
 	if(code != USB_XFER_DONE)
 		return;
 
-	/* submit another [free] msgb to receive the next transfer */
-	submit_next_out();
+	/* submit another [free] msgb to the bank which just became free */
+	submit_next_out(idx);
 }
 
 /* IN endpoint write complete callback (irq context) */
 static void ccid_in_write_compl(const uint8_t ep, enum usb_xfer_code code, uint32_t transferred)
 {
-	struct msgb *msg = g_ccid_s.in_ep.in_progress;
+	int8_t idx = ccid_df_ep_to_idx(ep);
+	struct msgb *msg;
+
+	if (idx < 0)
+		return;
+	msg = usb_ep_q_complete(&g_ccid_s.iface[idx].in_ep);
 
 	if (msg) {
-		/* return the message back to the queue of free message buffers */
-		llist_add_tail_at(&msg->list, &g_ccid_s.free_q);
-		g_ccid_s.in_ep.in_progress = NULL;
+		/* return the message back to the pool */
+		msgb_pool_put(msg);
+		/* the OUT EP may be waiting for it */
+		mainloop_schedule(WORK_IN);
 	}
 
 	if (code == USB_XFER_UNHALT)
-		submit_next_in();
+		submit_next_in(idx);
 
 	if(code != USB_XFER_DONE)
 		return;
 
 	/* submit the next pending to-be-transmitted msgb (if any) */
-	submit_next_in();
+	submit_next_in(idx);
 }
 
 /* IRQ endpoint write complete callback (irq context) */
 static void ccid_irq_write_compl(const uint8_t ep, enum usb_xfer_code code, uint32_t transferred)
 {
-	struct msgb *msg = g_ccid_s.irq_ep.in_progress;
+	int8_t idx = ccid_df_ep_to_idx(ep);
+
+	if (idx < 0)
+		return;
+	g_ccid_s.iface[idx].irq_in_progress = false;
+
+	if (code == USB_XFER_UNHALT)
+		submit_next_irq(idx);
+
+	if(code != USB_XFER_DONE)
+		return;
+
+	/* submit the changes accumulated in the meantime (if any) */
+	submit_next_irq(idx);
+}
+
+#ifdef WITH_VENDOR_IF
+/* submit the pending frames to the vendor IN EP, while it has a free bank; the frames
+ * queued behind the first one go into the same transfer, as far as they fit */
+static int submit_next_vnd_in(void)
+{
+	struct usb_ep_q *ep_q = &g_vnd_s.in_ep;
+	int num = 0;
+
+	if (!g_ccid_s.eps_ready)
+		return 0;
+
+	while (true) {
+		struct msgb *msg = NULL;
+		int rc = ERR_NONE;
+
+		CRITICAL_SECTION_ENTER()
+		if (ep_q->num_in_progress < EP_Q_DEPTH) {
+			msg = msgb_dequeue(&ep_q->list);
+			while (msg && !llist_empty(&ep_q->list)) {
+				struct msgb *next = llist_entry(ep_q->list.next, struct msgb, list);
+
+				if (msgb_length(msg) + msgb_length(next) > CCID_VENDOR_MAX_XFER ||
+				    msgb_length(next) > msgb_tailroom(msg))
+					break;
+				memcpy(msgb_put(msg, msgb_length(next)), msgb_data(next), msgb_length(next));
+				llist_del(&next->list);
+				msgb_pool_put(next);
+			}
+			if (msg) {
+				usb_ep_q_start(ep_q, msg);
+				rc = vendor_df_write_in(msgb_data(msg), msgb_length(msg));
+				if (rc != ERR_NONE) {
+					llist_del(&msg->list);
+					ep_q->num_in_progress--;
+				}
+				/* not dual-bank after all: retry on completion */
+				if (rc == USB_BUSY)
+					llist_add(&msg->list, &ep_q->list);
+			}
+		}
+		CRITICAL_SECTION_LEAVE()
+
+		if (!msg || rc == USB_BUSY)
+			return num;
+		if (rc != ERR_NONE) {
+			msgb_pool_put(msg);
+			LOGP(DUSB, LOGL_ERROR, "EP %s failed: %d\n", ep_q->name, rc);
+			return -1;
+		}
+		num++;
+	}
+}
+
+/* submit free msgbs to the vendor OUT EP, while it has a free bank and all received
+ * transfers could be parsed; otherwise the host has to wait */
+static int submit_next_vnd_out(void)
+{
+	struct usb_ep_q *ep_q = &g_vnd_s.out_ep;
+	int num = 0;
+
+	if (!g_ccid_s.eps_ready || ccid_vendor_rx_busy(&g_vnd_s.cv))
+		return 0;
+
+	while (true) {
+		struct msgb *msg = NULL;
+		int rc = ERR_NONE;
+
+		CRITICAL_SECTION_ENTER()
+		/* leave enough msgbs for the responses of all slots */
+		if (ep_q->num_in_progress < EP_Q_DEPTH && g_ccid_msgb_pool.avail > NUM_RESP_BUF) {
+			msg = msgb_pool_get(&g_ccid_msgb_pool);
+			usb_ep_q_start(ep_q, msg);
+			rc = vendor_df_read_out(msgb_data(msg), msgb_tailroom(msg));
+			if (rc != ERR_NONE) {
+				llist_del(&msg->list);
+				ep_q->num_in_progress--;
+			}
+		}
+		CRITICAL_SECTION_LEAVE()
+
+		if (!msg)
+			return num;
+		if (rc != ERR_NONE) {
+			/* return it to the pool */
+			msgb_pool_put(msg);
+			return num;
+		}
+		num++;
+	}
+}
+
+/* vendor OUT endpoint read complete callback (irq context) */
+static void vnd_out_read_compl(const uint8_t ep, enum usb_xfer_code code, uint32_t transferred)
+{
+	struct msgb *msg = usb_ep_q_complete(&g_vnd_s.out_ep);
+
+	/* the main loop resubmits, after parsing what was received */
+	if (code == USB_XFER_RESET || code == USB_XFER_UNHALT || code == USB_XFER_HALT) {
+		if (msg)
+			msgb_pool_put(msg);
+		if (code == USB_XFER_UNHALT)
+			mainloop_schedule(WORK_OUT);
+		return;
+	}
+
+	OSMO_ASSERT(msg);
+	msgb_put(msg, transferred);
+	llist_add_tail_at(&msg->list, &g_vnd_s.out_ep.list);
+	mainloop_schedule(WORK_OUT);
+}
+
+/* vendor IN endpoint write complete callback (irq context) */
+static void vnd_in_write_compl(const uint8_t ep, enum usb_xfer_code code, uint32_t transferred)
+{
+	struct msgb *msg = usb_ep_q_complete(&g_vnd_s.in_ep);
 
 	if (msg) {
-		/* return the message back to the queue of free message buffers */
-		llist_add_tail_at(&msg->list, &g_ccid_s.free_q);
-		g_ccid_s.irq_ep.in_progress = NULL;
+		msgb_pool_put(msg);
+		mainloop_schedule(WORK_IN);
 	}
 
 	if (code == USB_XFER_UNHALT)
-		submit_next_irq();
+		submit_next_vnd_in();
 
 	if(code != USB_XFER_DONE)
 		return;
 
-	/* submit the next pending to-be-transmitted msgb (if any) */
-	submit_next_irq();
+	submit_next_vnd_in();
 }
+#endif
 
-#include "ccid_proto.h"
-static struct msgb *ccid_gen_notify_slot_status(uint8_t old_bm, uint8_t new_bm)
+/* build a NotifySlotChange for num_slots slots in buf, returns its length */
+static unsigned int ccid_gen_notify_slot_change(uint8_t *buf, uint8_t present_bm, uint8_t changed_bm,
+						unsigned int num_slots)
 {
-	uint8_t statusbytes[2] = {0};
-	//struct msgb *msg = ccid_msgb_alloc();
-	struct msgb *msg = msgb_alloc(300,"IRQ");
-	struct ccid_rdr_to_pc_notify_slot_change *nsc =
-		(struct ccid_rdr_to_pc_notify_slot_change *)msgb_put(msg, sizeof(*nsc) + sizeof(statusbytes));
+	struct ccid_rdr_to_pc_notify_slot_change *nsc = (struct ccid_rdr_to_pc_notify_slot_change *)buf;
+	/* two bits per slot */
+	unsigned int len = (num_slots + 3) / 4;
+
 	nsc->bMessageType = RDR_to_PC_NotifySlotChange;
+	memset(nsc->bmSlotCCState, 0, len);
 
-	for(int i = 0; i <8; i++) {
+	for(int i = 0; i < num_slots; i++) {
 		uint8_t byteidx = i >> 2;
-		uint8_t old_bit = (old_bm >> i) & 1;
-		uint8_t new_bit = (new_bm >> i) & 1;
-		uint8_t bv;
-		if (old_bit == new_bit && new_bit == 0)
-			bv = 0x00;
-		else if (old_bit == new_bit && new_bit == 1)
-			bv = 0x01;
-		else if (old_bit != new_bit && new_bit == 0)
-			bv = 0x02;
-		else
-			bv = 0x03;
+		uint8_t bv = ((present_bm >> i) & 1) | ((changed_bm >> i) & 1) << 1;
 
-		statusbytes[byteidx] |= bv << ((i % 4) << 1);
+		nsc->bmSlotCCState[byteidx] |= bv << ((i % 4) << 1);
 	}
 
-	memcpy(&nsc->bmSlotCCState, statusbytes, sizeof(statusbytes));
+	return sizeof(*nsc) + len;
+}
 
-	return msg;
+/***********************************************************************
+ * Card detect
+ ***********************************************************************/
+
+/* time the card detect input of a slot must be stable before a change is reported */
+#define CARD_DETECT_DEBOUNCE_MS	20
+/* slots without EXTINT line are sampled at this interval */
+#define CARD_DETECT_POLL_MS	50
+
+/* NCN8025 INT input of each slot. SIM4_INT (PA02) and SIM5_INT (PA03) could only use EXTINT2/3,
+ * which are taken by SIM2_INT (PC02) and SIM3_INT (PC03): those two slots are polled */
+static const struct {
+	uint32_t pinmux;
+	int8_t extint;
+} card_detect_eic[8] = {
+	{ PINMUX_PC00A_EIC_EXTINT0, 0 },
+	{ PINMUX_PC01A_EIC_EXTINT1, 1 },
+	{ PINMUX_PC02A_EIC_EXTINT2, 2 },
+	{ PINMUX_PC03A_EIC_EXTINT3, 3 },
+	{ 0, -1 },
+	{ 0, -1 },
+	{ PINMUX_PB04A_EIC_EXTINT4, 4 },
+	{ PINMUX_PB05A_EIC_EXTINT5, 5 },
+};
+
+static struct {
+	/* slots whose input changed, until it has been stable for CARD_DETECT_DEBOUNCE_MS */
+	volatile uint8_t settling;
+	/* (low 32 bits of) jiffies at which the input of a settling slot is considered stable */
+	volatile uint32_t deadline[8];
+	/* jiffies of the next sampling of the slots without EXTINT line */
+	uint32_t next_poll;
+} g_card_detect;
+
+/* any of the EXTINT lines of the card detect inputs changed (irq context) */
+static void card_detect_irq(void)
+{
+	uint32_t flags = hri_eic_read_INTFLAG_reg(EIC);
+	uint32_t now = get_jiffies();
+	unsigned int i;
+
+	hri_eic_clear_INTFLAG_reg(EIC, flags);
+
+	/* (re)start the debounce timer of the slot */
+	for (i = 0; i < ARRAY_SIZE(card_detect_eic); i++) {
+		if (card_detect_eic[i].extint < 0 || !(flags & (1U << card_detect_eic[i].extint)))
+			continue;
+		g_card_detect.deadline[i] = now + CARD_DETECT_DEBOUNCE_MS;
+		g_card_detect.settling |= 1 << i;
+	}
+}
+
+void EIC_0_Handler(void) { card_detect_irq(); }
+void EIC_1_Handler(void) { card_detect_irq(); }
+void EIC_2_Handler(void) { card_detect_irq(); }
+void EIC_3_Handler(void) { card_detect_irq(); }
+void EIC_4_Handler(void) { card_detect_irq(); }
+void EIC_5_Handler(void) { card_detect_irq(); }
+
+/* slots whose input is still being debounced */
+static uint8_t card_detect_settling(void)
+{
+	return g_card_detect.settling;
+}
+
+/* sample the inputs of all slots as soon as possible, e.g. after the host forgot their state */
+static void card_detect_rescan(void)
+{
+	uint32_t now = get_jiffies();
+	unsigned int i;
+
+	CRITICAL_SECTION_ENTER()
+	for (i = 0; i < ARRAY_SIZE(g_card_detect.deadline); i++)
+		g_card_detect.deadline[i] = now;
+	g_card_detect.settling = 0xff;
+	CRITICAL_SECTION_LEAVE()
+}
+
+static void card_detect_init(void)
+{
+	uint32_t config = 0, mask = 0;
+	unsigned int i;
+
+	hri_mclk_set_APBAMASK_EIC_bit(MCLK);
+	hri_eic_set_CTRLA_SWRST_bit(EIC);
+	/* clocked by CLK_ULP32K, which needs no GCLK: the latency is irrelevant for card detect */
+	hri_eic_write_CTRLA_reg(EIC, EIC_CTRLA_CKSEL);
+
+	for (i = 0; i < ARRAY_SIZE(card_detect_eic); i++) {
+		int8_t extint = card_detect_eic[i].extint;
+		if (extint < 0)
+			continue;
+		config |= (EIC_CONFIG_SENSE0_BOTH | EIC_CONFIG_FILTEN0) << (4 * extint);
+		mask |= 1U << extint;
+		gpio_set_pin_function(card_detect_eic[i].pinmux >> 16, card_detect_eic[i].pinmux);
+	}
+	hri_eic_write_CONFIG_reg(EIC, 0, config);
+	hri_eic_clear_INTFLAG_reg(EIC, mask);
+	hri_eic_set_INTEN_reg(EIC, mask);
+	hri_eic_set_CTRLA_ENABLE_bit(EIC);
+
+	for (i = 0; i < ARRAY_SIZE(card_detect_eic); i++) {
+		if (card_detect_eic[i].extint >= 0)
+			NVIC_EnableIRQ(EIC_0_IRQn + card_detect_eic[i].extint);
+	}
+
+	card_detect_rescan();
 }
 
-/* check if any card detect state has changed */
+/* report the card detect inputs which have become stable */
 static void poll_card_detect(void)
 {
-	uint8_t new_mask = 0;
-	struct msgb *msg;
+	uint32_t now = get_jiffies();
+	uint8_t old_mask = g_ccid_s.card_insert_mask;
+	uint8_t new_mask = old_mask;
+	uint8_t stable = 0;
 	unsigned int i;
 
-	for (i = 0; i < 8; i++){
-		bool level = ncn8025_interrupt_level(i);
-		new_mask |= level << i;
+	/* sample the slots without EXTINT line */
+	if ((int32_t)(now - g_card_detect.next_poll) >= 0) {
+		g_card_detect.next_poll = now + CARD_DETECT_POLL_MS;
+		for (i = 0; i < ARRAY_SIZE(card_detect_eic); i++) {
+			if (card_detect_eic[i].extint >= 0 || (g_card_detect.settling & (1 << i)))
+				continue;
+			if (ncn8025_interrupt_level(i) == ((old_mask >> i) & 1))
+				continue;
+			CRITICAL_SECTION_ENTER()
+			g_card_detect.deadline[i] = now + CARD_DETECT_DEBOUNCE_MS;
+			g_card_detect.settling |= 1 << i;
+			CRITICAL_SECTION_LEAVE()
+		}
+	}
+
+	if (!g_card_detect.settling)
+		return;
+
+	CRITICAL_SECTION_ENTER()
+	for (i = 0; i < ARRAY_SIZE(card_detect_eic); i++) {
+		if ((g_card_detect.settling & (1 << i)) && (int32_t)(now - g_card_detect.deadline[i]) >= 0)
+			stable |= 1 << i;
+	}
+	g_card_detect.settling &= ~stable;
+	CRITICAL_SECTION_LEAVE()
+
+	for (i = 0; i < ARRAY_SIZE(card_detect_eic); i++) {
+		bool level;
+
+		if (!(stable & (1 << i)))
+			continue;
+		level = ncn8025_interrupt_level(i);
+		new_mask = (new_mask & ~(1 << i)) | (level << i);
 		g_ci.slot_ops->icc_set_insertion_status(&g_ci.slot[i], level);
 	}
 
-	/* notify the user/host about any changes */
-	if (g_ccid_s.card_insert_mask != new_mask) {
-		printf("CARD_DET 0x%02x -> 0x%02x\r\n",
-			g_ccid_s.card_insert_mask, new_mask);
-		msg = ccid_gen_notify_slot_status(g_ccid_s.card_insert_mask, new_mask);
-		msgb_enqueue_irqsafe(&g_ccid_s.irq_ep.list, msg);
+	if (old_mask == new_mask)
+		return;
 
-		g_ccid_s.card_insert_mask = new_mask;
+	LOGP(DCARD, LOGL_NOTICE, "CARD_DET 0x%02x -> 0x%02x\n", old_mask, new_mask);
+	/* the presence input in the NCN8025 shadow register is stale now */
+	for (i = 0; i < 8; i++) {
+		if ((old_mask ^ new_mask) & (1 << i))
+			ncn8025_resync(i);
 	}
+
+	/* the host is notified by submit_next_irq(), of each slot once its input has settled */
+	CRITICAL_SECTION_ENTER()
+	g_ccid_s.card_change_mask |= old_mask ^ new_mask;
+	g_ccid_s.card_insert_mask = new_mask;
+	CRITICAL_SECTION_LEAVE()
 }
 
 /* used to update the usb ext power dev status flag + reset the device when (un)plugging ext power */
@@ -405,10 +801,25 @@ extern void libosmo_emb_init(void);
 extern void libosmo_emb_mainloop(void);
 
 #include "talloc.h"
-#include "logging.h"
+#include "talloc_emb.h"
 
 void *g_tall_ctx;
 
+DEFUN(cmd_mem, cmd_mem_cmd, "mem", "Print memory pool usage")
+{
+	const struct msgb_pool *pool = &g_ccid_msgb_pool;
+
+	printf("msgb pool %s: %u/%u available, low watermark %u, exhausted %u\r\n", pool->name,
+		pool->avail, pool->size, pool->low_watermark, pool->exhausted);
+	printf("ccid: %lu responses dropped for lack of a msgb\r\n", (unsigned long)g_ci.num_resp_dropped);
+#ifdef TALLOC_DEBUG
+	printf("talloc: %u bytes in %u blocks\r\n", (unsigned int)talloc_total_size(NULL),
+		(unsigned int)talloc_total_blocks(NULL));
+#else
+	talloc_emb_print_stats();
+#endif
+}
+
 
 /* Section 9.6 of SAMD5x/E5x Family Data Sheet */
 static int get_chip_unique_serial(uint8_t *out, size_t len)
@@ -490,42 +901,145 @@ static uint32_t data_rates[] = {
 };
 extern struct usb_desc_collection usb_fs_descs;
 
+volatile uint32_t g_mainloop_work;
+/* interval of WORK_TICK */
+#define MAINLOOP_TICK_MS	10
 
 
+
+
+/* hand an OUT message of an interface to the CCID layer, which numbers the slots of all
+ * interfaces consecutively */
+static void ccid_handle_out_iface(uint8_t idx, struct msgb *msg)
+{
+	struct ccid_header *ch = (struct ccid_header *) msgb_data(msg);
+
+	g_ccid_s.cur_out_iface = idx;
+	if (msgb_length(msg) < sizeof(*ch)) {
+		ccid_handle_out(&g_ci, msg);
+		return;
+	}
+	g_ccid_s.cur_out_slot = ch->bSlot;
+	/* a slot number beyond the interface must not reach a slot of the next one */
+	if (ch->bSlot < CCID_SLOTS_PER_IFACE)
+		ch->bSlot += idx * CCID_SLOTS_PER_IFACE;
+	else
+		ch->bSlot = 0xff;
+	ccid_handle_out(&g_ci, msg);
+}
+
+/* hand the received OUT messages to the CCID layer, at most one batch of NUM_OUT_BUF; the
+ * interfaces take turns */
 static int feed_ccid(void)
 {
-	struct usb_ep_q *ep_q = &g_ccid_s.out_ep;
 	struct msgb *msg;
-	int rc;
+	int num = 0;
+
+	while (num < NUM_OUT_BUF) {
+		int prev_num = num;
+		uint8_t idx;
+
+		for (idx = 0; idx < CCID_NUM_IFACES && num < NUM_OUT_BUF; idx++) {
+			msg = msgb_dequeue_irqsafe(&g_ccid_s.iface[idx].out_ep.list);
+			if (!msg)
+				continue;
+			ccid_handle_out_iface(idx, msg);
+			num++;
+		}
+		if (num == prev_num)
+			return num;
+	}
 
-	msg = msgb_dequeue_irqsafe(&g_ccid_s.out_ep.list);
-	if (!msg)
-		return -1;
+	/* let the slots catch up before the next batch */
+	mainloop_schedule(WORK_OUT);
+	return num;
+}
 
-	ccid_handle_out(&g_ci, msg);
-	return 1;
+#ifdef WITH_VENDOR_IF
+/* hand the received vendor OUT transfers to the vendor protocol */
+static void feed_vendor(void)
+{
+	struct msgb *msg;
+
+	while ((msg = msgb_dequeue_irqsafe(&g_vnd_s.out_ep.list)))
+		ccid_vendor_rx(&g_vnd_s.cv, msg);
+}
+
+static int vnd_send_in(struct ccid_vendor *cv, struct msgb *msg)
+{
+	msgb_enqueue_irqsafe(&g_vnd_s.in_ep.list, msg);
+	submit_next_vnd_in();
+	return 0;
 }
+#endif
 
 static int ccid_ops_send_in(struct ccid_instance *ci, struct msgb *msg)
 {
+	struct ccid_header *ch;
+	uint8_t idx;
+
 	/* add just-received msg to tail of endpoint queue */
 	OSMO_ASSERT(msg);
 
-	/* append to list of pending-to-be-handed messages */
-	msgb_enqueue_irqsafe(&g_ccid_s.in_ep.list, msg);
-	submit_next_in();
+#ifdef WITH_BENCH
+	/* responses to the commands of the slot benchmark never reach the host */
+	if (slot_bench_handle_resp(msg))
+		return 0;
+#endif
+#ifdef WITH_VENDOR_IF
+	/* responses to the commands of the vendor interface go back there */
+	if (ccid_vendor_handle_resp(&g_vnd_s.cv, msg))
+		return 0;
+#endif
+
+	/* back to the interface of the slot and its slot number there */
+	ch = (struct ccid_header *) msgb_data(msg);
+	if (ch->bSlot < NR_SLOTS) {
+		idx = ch->bSlot / CCID_SLOTS_PER_IFACE;
+		ch->bSlot %= CCID_SLOTS_PER_IFACE;
+	} else {
+		/* error response to an invalid slot, sent while handling the OUT message */
+		idx = g_ccid_s.cur_out_iface;
+		ch->bSlot = g_ccid_s.cur_out_slot;
+	}
+
+	/* append to the pending-to-be-handed messages of its slot */
+	CRITICAL_SECTION_ENTER()
+	ccid_in_sched_enqueue(&g_ccid_s.iface[idx].in_sched, msg);
+	CRITICAL_SECTION_LEAVE()
+	submit_next_in(idx);
 	return 0;
 }
 
+static int ccid_ops_set_in_prio(struct ccid_instance *ci, uint8_t slot_nr, enum ccid_in_prio prio)
+{
+	uint8_t idx = slot_nr / CCID_SLOTS_PER_IFACE;
+	int rc;
+
+	if (slot_nr >= NR_SLOTS)
+		return -EINVAL;
+
+	CRITICAL_SECTION_ENTER()
+	rc = ccid_in_sched_set_prio(&g_ccid_s.iface[idx].in_sched, slot_nr % CCID_SLOTS_PER_IFACE, prio);
+	CRITICAL_SECTION_LEAVE()
+	return rc;
+}
+
+/* may be called from interrupt context */
+static void ccid_ops_slot_event(struct ccid_instance *ci, struct ccid_slot *cs)
+{
+	mainloop_schedule(WORK_SLOT(cs->slot_nr));
+}
+
 static const struct ccid_ops c_ops = {
 	.send_in = ccid_ops_send_in,
 	.send_int = 0,
+	.slot_event = ccid_ops_slot_event,
+	.set_in_prio = ccid_ops_set_in_prio,
 };
 
 //#######################
 
-#define NUM_OUT_BUF 16
-
 char sernr_buf[16*2+1];
 char product_buf[] = "sysmoOCTSIM "GIT_VERSION;
 //len, type, 2 byte per hex char * 2 for unicode
@@ -534,9 +1048,57 @@ uint8_t product_buf_descr[1 + 1 + (sizeof(product_buf) - 1) * 2];
 
 char rstcause_buf[RSTCAUSE_STR_SIZE];
 
+/* boot phases, timed by the cycle counter from the start of main() */
+enum boot_phase {
+	BOOT_USB_ATTACH,	/* USB attached: the host enumerates while we carry on */
+	BOOT_BOARD,		/* set up of the NCN8025s queued on the I2C buses */
+	BOOT_CCID,		/* CCID layer, slots and memory pools set up */
+	BOOT_USB_CONFIG,	/* configuration set by the host, CCID ready */
+	_NUM_BOOT
+};
+
+static const char *const boot_phase_names[_NUM_BOOT] = {
+	[BOOT_USB_ATTACH]	= "usb attach",
+	[BOOT_BOARD]		= "board",
+	[BOOT_CCID]		= "ccid",
+	[BOOT_USB_CONFIG]	= "usb configured",
+};
+
+static uint32_t g_boot_cycles[_NUM_BOOT];
+
+static void boot_mark(enum boot_phase ph)
+{
+	g_boot_cycles[ph] = DWT->CYCCNT;
+}
+
+static void boot_print(void)
+{
+	unsigned int i;
+
+	printf("Boot:");
+	/* the cycle counter wraps after 35s, e.g. if no host configured us for that long */
+	for (i = 0; i < _NUM_BOOT; i++) {
+		if (g_boot_cycles[i])
+			printf(" %s %lu us", boot_phase_names[i],
+				(unsigned long)(g_boot_cycles[i] / (CONF_CPU_FREQUENCY / 1000000)));
+		else
+			printf(" %s -", boot_phase_names[i]);
+		printf(i < _NUM_BOOT - 1 ? "," : "\r\n");
+	}
+}
+
+DEFUN(cmd_boot, cmd_boot_cmd, "boot", "Print reset cause and boot phase times")
+{
+	printf("Reset cause: %s\r\n", rstcause_buf);
+	boot_print();
+}
+
 void reset_all_stuff_irq(void)
 {
 	SysTick->CTRL &= ~SysTick_CTRL_ENABLE_Msk; // no clock ticks for osmo timers
+	g_ccid_s.eps_ready = false;
+	/* was_unconfigured_flag is set by the caller, before the main loop can run */
+	mainloop_schedule(WORK_USB_RESET);
 
 	Sercom *const sercom_modules[] = SERCOM_INSTS;
 	for (uint32_t i = 0; i < SERCOM_INST_NUM; i++) {
@@ -554,43 +1116,102 @@ void reset_all_stuff_non_irq(void)
 
 	CRITICAL_SECTION_ENTER()
 
-	for (int i = 0; i <= usb_fs_descs.ccid.class.bMaxSlotIndex; i++) {
+	for (int i = 0; i < NR_SLOTS; i++) {
 		g_ci.slot_ops->handle_fsm_events(&g_ci.slot[i], true);
 	}
 
-	for (int i = 0; i <= usb_fs_descs.ccid.class.bMaxSlotIndex; i++) {
+	for (int i = 0; i < NR_SLOTS; i++) {
 		g_ci.slot_ops->icc_set_insertion_status(&g_ci.slot[i], false);
 		g_ci.slot_ops->handle_fsm_events(&g_ci.slot[i], true);
 	}
 
-	for (int i = 0; i <= usb_fs_descs.ccid.class.bMaxSlotIndex; i++) {
+	for (int i = 0; i < NR_SLOTS; i++) {
 		g_ci.slot_ops->handle_fsm_events(&g_ci.slot[i], true);
 	}
 
-	volatile struct usb_ep_q *all_epqs[] = { &g_ccid_s.in_ep, &g_ccid_s.irq_ep, &g_ccid_s.out_ep };
-	for (int i = 0; i < ARRAY_SIZE(all_epqs); i++) {
-		volatile struct usb_ep_q *cur_epq = all_epqs[i];
-		struct msgb *msg;
-		while ((msg = msgb_dequeue_irqsafe(&cur_epq->list))) {
-			msgb_reset(msg);
-			llist_add_tail_at(&msg->list, &g_ccid_s.free_q);
+	for (int idx = 0; idx < CCID_NUM_IFACES; idx++) {
+		volatile struct ccid_iface_state *cis = &g_ccid_s.iface[idx];
+		volatile struct usb_ep_q *all_epqs[] = { &cis->in_ep, &cis->out_ep };
+		for (int i = 0; i < ARRAY_SIZE(all_epqs); i++) {
+			volatile struct usb_ep_q *cur_epq = all_epqs[i];
+			struct msgb *msg;
+			while ((msg = msgb_dequeue_irqsafe(&cur_epq->list)))
+				msgb_pool_put(msg);
+			while ((msg = msgb_dequeue_irqsafe(&cur_epq->in_progress)))
+				msgb_pool_put(msg);
+			cur_epq->num_in_progress = 0;
 		}
-		struct msgb *cur_msg = cur_epq->in_progress;
-		if (cur_msg) {
-			msgb_reset(cur_msg);
-			msgb_enqueue(&g_ccid_s.free_q, cur_msg);
-			cur_epq->in_progress = NULL;
+		ccid_in_sched_flush(&cis->in_sched);
+		cis->irq_in_progress = false;
+	}
+#ifdef WITH_VENDOR_IF
+	{
+		struct usb_ep_q *all_epqs[] = { &g_vnd_s.in_ep, &g_vnd_s.out_ep };
+		for (int i = 0; i < ARRAY_SIZE(all_epqs); i++) {
+			struct usb_ep_q *cur_epq = all_epqs[i];
+			struct msgb *msg;
+			while ((msg = msgb_dequeue_irqsafe(&cur_epq->list)))
+				msgb_pool_put(msg);
+			while ((msg = msgb_dequeue_irqsafe(&cur_epq->in_progress)))
+				msgb_pool_put(msg);
+			cur_epq->num_in_progress = 0;
 		}
+		ccid_vendor_reset(&g_vnd_s.cv);
 	}
+#endif
 
 	SysTick->CTRL |= SysTick_CTRL_ENABLE_Msk;
 
 	// while (!ccid_df_is_enabled())
 	// 	;
+	/* report all inserted cards again */
 	g_ccid_s.card_insert_mask = 0;
+	g_ccid_s.card_change_mask = 0;
+	card_detect_rescan();
 	was_unconfigured_flag = false;
 	CRITICAL_SECTION_LEAVE()
+}
+
+/* set up the endpoints once the host has configured the device, from the main loop. The
+ * slots don't wait for it: without a host, they are only used locally, e.g. by "bench" */
+static void usb_eps_poll(void)
+{
+	uint8_t idx;
+
+	/* the reset after an unconfiguration has to be handled first */
+	if (g_ccid_s.eps_ready || was_unconfigured_flag || !ccid_df_is_enabled())
+		return;
+#ifdef WITH_VENDOR_IF
+	if (!vendor_df_is_enabled())
+		return;
+#endif
+
 	ccid_eps_enable();
+	/* callbacks must be registered after endpoint allocation */
+	for (idx = 0; idx < CCID_NUM_IFACES; idx++) {
+		/* OUT endpoint read complete callback (irq context) */
+		ccid_df_register_callback(idx, CCID_DF_CB_READ_OUT, (FUNC_PTR)&ccid_out_read_compl);
+		/* IN endpoint write complete callback (irq context) */
+		ccid_df_register_callback(idx, CCID_DF_CB_WRITE_IN, (FUNC_PTR)&ccid_in_write_compl);
+		/* IRQ endpoint write complete callback (irq context) */
+		ccid_df_register_callback(idx, CCID_DF_CB_WRITE_IRQ, (FUNC_PTR)&ccid_irq_write_compl);
+	}
+#ifdef WITH_VENDOR_IF
+	vendor_eps_enable();
+	vendor_df_register_callback(VENDOR_DF_CB_READ_OUT, (FUNC_PTR)&vnd_out_read_compl);
+	vendor_df_register_callback(VENDOR_DF_CB_WRITE_IN, (FUNC_PTR)&vnd_in_write_compl);
+#endif
+	g_ccid_s.eps_ready = true;
+	/* the first configuration belongs to the boot, not the later ones */
+	if (!g_boot_cycles[BOOT_USB_CONFIG])
+		boot_mark(BOOT_USB_CONFIG);
+
+	submit_next_out_all();
+	for (idx = 0; idx < CCID_NUM_IFACES; idx++)
+		submit_next_irq(idx);
+#ifdef WITH_VENDOR_IF
+	submit_next_vnd_out();
+#endif
 }
 
 static inline void user_led_set(bool state)
@@ -601,6 +1222,9 @@ static inline void user_led_set(bool state)
 int main(void)
 {
 	osmo_set_panic_handler(&bdg_bkptpanic);
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
 #if 0
 CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk ; //| /* tracing*/
 ////CoreDebug_DEMCR_MON_EN_Msk; /* mon interupt catcher */
@@ -640,13 +1264,23 @@ DWT->FUNCTION1 =    (0b10 << DWT_FUNCTION_DATAVSIZE_Pos) |  /* DATAVSIZE 10 - dw
 	user_led_set(true);
 
 	init_extpower_detect();
-	board_init();
+	/* attach first, the host takes 100ms until it even resets the bus; the rest is set up
+	 * in the meantime, and the slow NCN8025 set up runs in the background */
 	usb_init();
-	usb_start();
-	ccid_app_init();
+	boot_mark(BOOT_USB_ATTACH);
+	board_init();
+	boot_mark(BOOT_BOARD);
 
-#ifdef WITH_DEBUG_CDC
+#if defined(ENABLE_DBG_UART7) || defined(WITH_DEBUG_CDC)
 	command_init("sysmoOCTSIM> ");
+	command_register(&cmd_mem_cmd);
+	command_register(&cmd_boot_cmd);
+#endif
+#ifdef WITH_PROF
+	prof_init();
+#endif
+#ifdef WITH_BENCH
+	slot_bench_init(&g_ci);
 #endif
 	/* boost uart priority by setting all other irqs to uartprio+1 */
 	for(int i = 0; i < PERIPH_COUNT_IRQn; i++)
@@ -675,18 +1309,27 @@ DWT->FUNCTION1 =    (0b10 << DWT_FUNCTION_DATAVSIZE_Pos) |  /* DATAVSIZE 10 - dw
 
 	//prevent spurious interrupts before our driver structs are ready
 	CRITICAL_SECTION_ENTER()
-	ccid_instance_init(&g_ci, &c_ops, &iso_fsm_slot_ops, &usb_fs_descs.ccid.class,
+	ccid_instance_init(&g_ci, &c_ops, &iso_fsm_slot_ops, &usb_fs_descs.ccid[0].class,
 			   data_rates, clock_freqs, "", 0);
 
-	for(int i =0; i < NUM_OUT_BUF; i++){
-		struct msgb *msg = msgb_alloc(300, "ccid");
-		OSMO_ASSERT(msg);
-		/* return the message back to the queue of free message buffers */
-		OSMO_ASSERT(msg->list.next != LLIST_POISON1)
-		llist_add_tail_at(&msg->list, &g_ccid_s.free_q);
-	}
+	/* the last heap allocation of msgbs, from now on they come from the pool */
+	/* a multiple of the bulk packet size, as the dual-bank OUT EP receives without cache */
+	msgb_pool_init(&g_ccid_msgb_pool, "ccid", NUM_MSGB, 320);
 	// submit_next_out();
 	CRITICAL_SECTION_LEAVE()
+
+#ifndef TALLOC_DEBUG
+	/* everything allocated so far stays for good, switch talloc over to its pools */
+	talloc_emb_init_done();
+#endif
+
+	card_detect_init();
+	boot_mark(BOOT_CCID);
+
+	/* the endpoints are set up by usb_eps_poll(), once the host has set the configuration */
+	usb_start();
+	ccid_app_init();
+	boot_print();
 #if 0
 	/* CAN_RX */
 	gpio_set_pin_function(PIN_PB12, GPIO_PIN_FUNCTION_OFF);
@@ -700,33 +1343,84 @@ DWT->FUNCTION1 =    (0b10 << DWT_FUNCTION_DATAVSIZE_Pos) |  /* DATAVSIZE 10 - dw
 #endif
 
 //	command_print_prompt();
+	uint32_t next_tick = get_jiffies();
 	while (true) { // main loop
-		if (was_unconfigured_flag) {
+		uint32_t now = get_jiffies();
+		uint32_t work, t_loop, t;
+
+		if ((int32_t)(now - next_tick) >= 0) {
+			next_tick = now + MAINLOOP_TICK_MS;
+			mainloop_schedule(WORK_TICK);
+		}
+
+		CRITICAL_SECTION_ENTER()
+		work = g_mainloop_work;
+		g_mainloop_work = 0;
+		/* sleep until the next interrupt (at the latest SysTick); a pending interrupt
+		 * ends WFI even while interrupts are masked, so no work can get lost */
+		if (!work)
+			__WFI();
+		CRITICAL_SECTION_LEAVE()
+		if (!work)
+			continue;
+		t_loop = prof_begin();
+
+		if (work & WORK_USB_RESET) {
+			t = prof_begin();
 			reset_all_stuff_non_irq();
-			submit_next_out();
+			prof_end(PROF_LOOP_RESET, t);
 		}
-		poll_extpower_detect();
-		command_try_recv();
-		poll_card_detect();
-		submit_next_irq();
-		for (int i = 0; i <= usb_fs_descs.ccid.class.bMaxSlotIndex; i++){
-			g_ci.slot_ops->handle_fsm_events(&g_ci.slot[i], true);
+		if (work & (WORK_USB_RESET | WORK_TICK))
+			usb_eps_poll();
+		if (work & WORK_TICK) {
+			t = prof_begin();
+			poll_extpower_detect();
+			poll_card_detect();
+			for (int i = 0; i < CCID_NUM_IFACES; i++)
+				submit_next_irq(i);
+			/* card response timeouts are checked by handle_fsm_events() */
+			work |= WORK_SLOT_ALL;
+			prof_end(PROF_LOOP_TICK, t);
 		}
-		feed_ccid();
-		int qs = llist_count_at(&g_ccid_s.free_q);
-		if (qs > NUM_OUT_BUF)
-			for (int i = 0; i < qs - NUM_OUT_BUF; i++) {
-				struct msgb *msg = msgb_dequeue_irqsafe(&g_ccid_s.free_q);
-				if (msg)
-					msgb_free(msg);
+		if (work & WORK_CMD) {
+			t = prof_begin();
+			if (command_try_recv())
+				mainloop_schedule(WORK_CMD);
+			prof_end(PROF_LOOP_CMD, t);
+		}
+		for (int i = 0; i < NR_SLOTS; i++){
+			if (work & WORK_SLOT(i)) {
+				t = prof_begin();
+				g_ci.slot_ops->handle_fsm_events(&g_ci.slot[i], true);
+				prof_end(PROF_SLOT_FSM(i), t);
 			}
-		if (qs < NUM_OUT_BUF)
-			for (int i = 0; i < NUM_OUT_BUF - qs; i++) {
-				struct msgb *msg = msgb_alloc(300, "ccid");
-				OSMO_ASSERT(msg);
-				/* return the message back to the queue of free message buffers */
-				msgb_enqueue_irqsafe(&g_ccid_s.free_q, msg);
+		}
+#ifdef WITH_VENDOR_IF
+		t = prof_begin();
+		if (work & WORK_OUT)
+			feed_vendor();
+		/* slots may have become idle, msgbs available */
+		ccid_vendor_poll(&g_vnd_s.cv);
+		submit_next_vnd_out();
+		prof_end(PROF_LOOP_VENDOR, t);
+#endif
+#ifdef WITH_BENCH
+		/* slots may have become idle */
+		slot_bench_poll();
+#endif
+		if (work & (WORK_OUT | WORK_IN)) {
+			if (work & WORK_OUT) {
+				t = prof_begin();
+				feed_ccid();
+				prof_end(PROF_FEED_CCID, t);
 			}
-		submit_next_out();
+			t = prof_begin();
+			submit_next_out_all();
+			prof_end(PROF_SUBMIT_OUT, t);
+		}
+#ifdef WITH_BINLOG
+		binlog_drain();
+#endif
+		prof_end(PROF_LOOP, t_loop);
 	}
 }
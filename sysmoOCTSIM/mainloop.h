@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdint.h>
+#include <hal_atomic.h>
+
+/* work for the main loop, flagged from interrupt context; the main loop sleeps if there is none */
+enum mainloop_work {
+	WORK_USB_RESET	= (1 << 0),	/* USB configuration was lost */
+	WORK_CMD	= (1 << 1),	/* debug UART received characters */
+	WORK_OUT	= (1 << 2),	/* CCID OUT transfer received */
+	WORK_IN		= (1 << 3),	/* CCID IN transfer completed, msgb returned to the free queue */
+	WORK_TICK	= (1 << 4),	/* periodic: card response timeouts, card detect, ext power */
+};
+/* a slot has an event from its ISO7816 FSMs for handle_fsm_events() */
+#define WORK_SLOT(n)	(1 << (8 + (n)))
+#define WORK_SLOT_ALL	(0xff << 8)
+
+extern volatile uint32_t g_mainloop_work;
+
+static inline void mainloop_schedule(uint32_t work)
+{
+	CRITICAL_SECTION_ENTER()
+	g_mainloop_work |= work;
+	CRITICAL_SECTION_LEAVE()
+}
@@ -0,0 +1,87 @@
+/* Pools of pre-allocated msgbs, so that the USB endpoints and the CCID layer
+ * don't need the heap after initialization.
+ *
+ * (C) 2019 by sysmocom - s.f.m.c. GmbH
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <hal_atomic.h>
+#include <osmocom/core/talloc.h>
+#include <osmocom/core/utils.h>
+#include "msgb_pool.h"
+
+/* each msgb carries a pointer to its pool behind the end of its data area, as msgb_reset()
+ * clears all the header fields which could be used for it */
+static struct msgb_pool **msgb_pool_ptr(struct msgb *msg)
+{
+	return (struct msgb_pool **)(msg->_data + msg->data_len);
+}
+
+/* called by msgb_free() -> talloc_free(); returning -1 keeps the memory */
+static int msgb_pool_destructor(struct msgb *msg)
+{
+	msgb_pool_put(msg);
+	return -1;
+}
+
+/*! Allocate the msgbs of a pool.
+ *  \param[out] pool pool to initialize
+ *  \param[in] name name of the pool and its msgbs
+ *  \param[in] num number of msgbs
+ *  \param[in] size size of each msgb */
+void msgb_pool_init(struct msgb_pool *pool, const char *name, unsigned int num, uint16_t size)
+{
+	unsigned int i;
+
+	pool->name = name;
+	INIT_LLIST_HEAD(&pool->free);
+	pool->size = 0;
+	pool->avail = 0;
+	pool->exhausted = 0;
+
+	for (i = 0; i < num; i++) {
+		struct msgb *msg = msgb_alloc(size + sizeof(struct msgb_pool *), name);
+		OSMO_ASSERT(msg);
+		msg->data_len = size;
+		*msgb_pool_ptr(msg) = pool;
+		talloc_set_destructor(msg, msgb_pool_destructor);
+		llist_add_tail(&msg->list, &pool->free);
+		pool->size++;
+		pool->avail++;
+	}
+	pool->low_watermark = pool->avail;
+}
+
+/*! Take a msgb from a pool, irq-safe.
+ *  \returns empty msgb; NULL if the pool is exhausted */
+struct msgb *msgb_pool_get(struct msgb_pool *pool)
+{
+	struct msgb *msg = NULL;
+
+	CRITICAL_SECTION_ENTER()
+	if (!llist_empty(&pool->free)) {
+		msg = llist_entry(pool->free.next, struct msgb, list);
+		llist_del(&msg->list);
+		pool->avail--;
+		if (pool->avail < pool->low_watermark)
+			pool->low_watermark = pool->avail;
+	} else
+		pool->exhausted++;
+	CRITICAL_SECTION_LEAVE()
+
+	return msg;
+}
+
+/*! Return a msgb to the pool it was taken from, irq-safe. msgb_free() does the same.
+ *  \param[in] msg msgb which is not on any list */
+void msgb_pool_put(struct msgb *msg)
+{
+	struct msgb_pool *pool = *msgb_pool_ptr(msg);
+
+	msgb_reset(msg);
+	CRITICAL_SECTION_ENTER()
+	llist_add_tail(&msg->list, &pool->free);
+	pool->avail++;
+	CRITICAL_SECTION_LEAVE()
+}
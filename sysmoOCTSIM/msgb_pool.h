@@ -0,0 +1,26 @@
+#pragma once
+#include <stdint.h>
+#include <osmocom/core/linuxlist.h>
+#include <osmocom/core/msgb.h>
+
+/*! fixed set of msgbs allocated at init; msgb_free() returns them to their pool */
+struct msgb_pool {
+	const char *name;
+	/* msgbs currently available */
+	struct llist_head free;
+	/* total number of msgbs */
+	unsigned int size;
+	/* number of msgbs in free */
+	unsigned int avail;
+	/* lowest value of avail so far */
+	unsigned int low_watermark;
+	/* number of msgb_pool_get() calls which found the pool empty */
+	unsigned int exhausted;
+};
+
+void msgb_pool_init(struct msgb_pool *pool, const char *name, unsigned int num, uint16_t size);
+struct msgb *msgb_pool_get(struct msgb_pool *pool);
+void msgb_pool_put(struct msgb *msg);
+
+/*! pool of the messages exchanged with the CCID layer */
+extern struct msgb_pool g_ccid_msgb_pool;
@@ -11,12 +11,34 @@
 #include <stdio.h>
 #include <utils_assert.h>
 #include <utils.h>
+#include <hal_atomic.h>
 #include "atmel_start_pins.h"
 #include "octsim_i2c.h"
 #include "ncn8025.h"
 
 #define SX1503_ADDR	0x20
 
+/* IO6 of each bank is an input (!PRESENT), all other bits are outputs */
+#define SX1503_INPUT_MASK	0x40
+
+static struct ncn8025_slot {
+	/*! RAM shadow of the SX1503 data register, so that reading the settings doesn't need
+	 *  any I2C transfer and unchanged settings are not written again. The outputs are
+	 *  what has last been set, the input is only as recent as the last ncn8025_resync(). */
+	uint8_t data;
+	/* the outputs changed again while being written */
+	bool dirty;
+	/* the input may have changed after the read in progress sampled it */
+	bool reread;
+	/* queued I2C transfers, the chip is updated in the background */
+	struct i2c_xfer wr;
+	struct i2c_xfer rd;
+	/* set up of the direction register by ncn8025_init() */
+	struct i2c_xfer dir;
+	ncn8025_cb_t cb;
+	void *cb_data;
+} ncn8025_slots[8];
+
 /*! translate from ncn8025_settings into SX1503 register value */
 static uint8_t ncn8025_encode(const struct ncn8025_settings *set)
 {
@@ -104,35 +126,165 @@ bool ncn8025_interrupt_level(uint8_t slot)
 }
 
 
+static void ncn8025_write(uint8_t slot);
+
+static void ncn8025_report(struct ncn8025_slot *ns, int rc)
+{
+	if (ns->cb)
+		ns->cb(ns - ncn8025_slots, rc, ns->cb_data);
+}
+
+/* the data register has been written, called from interrupt context */
+static void ncn8025_wr_cb(struct i2c_xfer *xfer, int rc)
+{
+	struct ncn8025_slot *ns = xfer->priv;
+
+	if (rc < 0) {
+		/* we don't know what the chip got: read it back, which rewrites it if needed */
+		ncn8025_report(ns, rc);
+		ncn8025_resync(ns - ncn8025_slots);
+		return;
+	}
+
+	if (ns->dirty) {
+		ns->dirty = false;
+		xfer->val = ns->data;
+		i2c_submit(slot2adapter(ns - ncn8025_slots), xfer);
+		return;
+	}
+
+	ncn8025_report(ns, 0);
+}
+
+/* the data register has been read back, called from interrupt context */
+static void ncn8025_rd_cb(struct i2c_xfer *xfer, int rc)
+{
+	struct ncn8025_slot *ns = xfer->priv;
+
+	if (rc < 0) {
+		ncn8025_report(ns, rc);
+	} else {
+		ns->data = (ns->data & ~SX1503_INPUT_MASK) | (rc & SX1503_INPUT_MASK);
+		/* the chip doesn't have the outputs we want, e.g. after a failed write */
+		if ((ns->data ^ rc) & ~SX1503_INPUT_MASK)
+			ncn8025_write(ns - ncn8025_slots);
+	}
+
+	if (ns->reread) {
+		ns->reread = false;
+		i2c_submit(slot2adapter(ns - ncn8025_slots), xfer);
+	}
+}
+
+/* the direction register has been written, called from interrupt context */
+static void ncn8025_dir_cb(struct i2c_xfer *xfer, int rc)
+{
+	if (rc < 0)
+		ncn8025_report(xfer->priv, rc);
+}
+
+/* write the shadow register to the chip, or once more after the write in progress */
+static void ncn8025_write(uint8_t slot)
+{
+	struct ncn8025_slot *ns = &ncn8025_slots[slot];
+
+	CRITICAL_SECTION_ENTER()
+	if (ns->wr.busy) {
+		ns->dirty = true;
+	} else {
+		ns->wr.val = ns->data;
+		i2c_submit(slot2adapter(slot), &ns->wr);
+	}
+	CRITICAL_SECTION_LEAVE()
+}
+
+/*! Re-read a given NCN8025 from the chip in the background: the input of the shadow
+ *  register is updated, and the outputs are written again if the chip lost them.
+ *  \param[in] slot Slot number (0..7)
+ *  \returns 0 on success; negative on error */
+int ncn8025_resync(uint8_t slot)
+{
+	const struct i2c_adapter *adap = slot2adapter(slot);
+	struct ncn8025_slot *ns = &ncn8025_slots[slot];
+	int rc;
+
+	ASSERT(slot < ARRAY_SIZE(ncn8025_slots));
+	CRITICAL_SECTION_ENTER()
+	rc = i2c_submit(adap, &ns->rd);
+	if (rc == ERR_BUSY) {
+		/* a read which is still queued will do, one on the bus may have sampled the
+		 * input before the change we are called for: read again once it is done */
+		if (adap->state->cur == &ns->rd)
+			ns->reread = true;
+		rc = 0;
+	}
+	CRITICAL_SECTION_LEAVE()
+	return rc;
+}
+
 /*! Set a given NCN8025 as described in 'set'.
+ *  The chip is written in the background, nothing is written if the outputs already are
+ *  in this state. May be called from interrupt context.
  *  \param[in] slot Slot number (0..7)
  *  \param[in] set Settings that shall be written
  *  \returns 0 on success; negative on error */
 int ncn8025_set(uint8_t slot, const struct ncn8025_settings *set)
 {
-	const struct i2c_adapter *adap = slot2adapter(slot);
-	uint8_t reg = slot2data_reg(slot);
+	struct ncn8025_slot *ns = &ncn8025_slots[slot];
 	uint8_t raw = ncn8025_encode(set);
-	return i2c_write_reg(adap, SX1503_ADDR, reg, raw);
+	bool changed;
+
+	ASSERT(slot < ARRAY_SIZE(ncn8025_slots));
+	CRITICAL_SECTION_ENTER()
+	changed = (ns->data ^ raw) & ~SX1503_INPUT_MASK;
+	ns->data = (ns->data & SX1503_INPUT_MASK) | (raw & ~SX1503_INPUT_MASK);
+	CRITICAL_SECTION_LEAVE()
+
+	if (changed)
+		ncn8025_write(slot);
+	return 0;
+}
+
+/*! Check whether the chip of a given NCN8025 still lacks outputs that have been set. If so,
+ *  the callback registered by ncn8025_set_cb() is called once it has them; check and
+ *  ncn8025_set() have to be in one critical section for that to be about the same write.
+ *  \param[in] slot Slot number (0..7)
+ *  \returns true while the outputs are being written */
+bool ncn8025_busy(uint8_t slot)
+{
+	ASSERT(slot < ARRAY_SIZE(ncn8025_slots));
+	return ncn8025_slots[slot].wr.busy || ncn8025_slots[slot].dirty;
 }
 
-/*! Get a given NCN8025 state from the chip.
+/*! Get a given NCN8025 state from the shadow register.
  *  \param[in] slot Slot number (0..7)
  *  \param[out] set Settings that are retrieved
  *  \returns 0 on success; negative on error */
 int ncn8025_get(uint8_t slot, struct ncn8025_settings *set)
 {
-	const struct i2c_adapter *adap = slot2adapter(slot);
-	uint8_t reg = slot2data_reg(slot);
 	int rc;
-	rc = i2c_read_reg(adap, SX1503_ADDR, reg);
-	if (rc < 0)
-		return rc;
-	rc = ncn8025_decode(rc, set);
+
+	ASSERT(slot < ARRAY_SIZE(ncn8025_slots));
+	rc = ncn8025_decode(ncn8025_slots[slot].data, set);
 	set->interrupt = ncn8025_interrupt_level(slot);
 	return rc;
 }
 
+/*! Register a callback for the completion of the background writes of a given NCN8025.
+ *  It is called from interrupt context with rc 0 once the chip has all the outputs set so
+ *  far, with rc < 0 if the chip could not be accessed.
+ *  \param[in] slot Slot number (0..7)
+ *  \param[in] cb callback, NULL to unregister
+ *  \param[in] data user data passed to the callback */
+void ncn8025_set_cb(uint8_t slot, ncn8025_cb_t cb, void *data)
+{
+	ASSERT(slot < ARRAY_SIZE(ncn8025_slots));
+	CRITICAL_SECTION_ENTER()
+	ncn8025_slots[slot].cb = cb;
+	ncn8025_slots[slot].cb_data = data;
+	CRITICAL_SECTION_LEAVE()
+}
+
 /*! default settings we use at start-up: powered off, in reset, slowest clock, 3V */
 static const struct ncn8025_settings def_settings = {
 	.rstin = true,
@@ -142,17 +294,39 @@ static const struct ncn8025_settings def_settings = {
 	.vsel = SIM_VOLT_3V0,
 };
 
-/*! Initialize a given NCN8025/slot. */
+/*! Initialize a given NCN8025/slot.
+ *  The chip is set up in the background like any other access, so that the chips on the
+ *  different buses are initialized in parallel, and nobody waits for them. Until the chip
+ *  has been read, the shadow register has no card present.
+ *  \returns 0 if the transfers have been queued; negative on error */
 int ncn8025_init(unsigned int slot)
 {
 	const struct i2c_adapter *adap = slot2adapter(slot);
-	uint8_t reg = slot2dir_reg(slot);
+	struct ncn8025_slot *ns = &ncn8025_slots[slot];
 	int rc;
+
+	ns->wr = (struct i2c_xfer) {
+		.addr = SX1503_ADDR,
+		.reg = slot2data_reg(slot),
+		.cb = ncn8025_wr_cb,
+		.priv = ns,
+	};
+	ns->rd = ns->wr;
+	ns->rd.read = true;
+	ns->rd.cb = ncn8025_rd_cb;
 	/* IO6 of each bank is input (!PRESENT), rest are outputs */
-	rc = i2c_write_reg(adap, SX1503_ADDR, reg, 0x40);
+	ns->dir = ns->wr;
+	ns->dir.reg = slot2dir_reg(slot);
+	ns->dir.val = SX1503_INPUT_MASK;
+	ns->dir.cb = ncn8025_dir_cb;
+	ns->data = ncn8025_encode(&def_settings) | SX1503_INPUT_MASK;
+
+	/* a bus executes its transfers in order: direction, outputs, then read the input */
+	rc = i2c_submit(adap, &ns->dir);
 	if (rc < 0)
 		return rc;
-	return ncn8025_set(slot, &def_settings);
+	ncn8025_write(slot);
+	return ncn8025_resync(slot);
 }
 
 static const char *volt_str[] = {
@@ -1,5 +1,6 @@
 #pragma once
 #include <stdbool.h>
+#include <stdint.h>
 
 enum ncn8025_sim_voltage {
 	SIM_VOLT_3V0 = 0,
@@ -16,6 +17,9 @@ enum ncn8025_sim_clkdiv {
 
 extern const unsigned int ncn8025_div_val[];
 
+/*! completion of the background access to a slot, rc < 0 on error */
+typedef void (*ncn8025_cb_t)(uint8_t slot, int rc, void *data);
+
 struct ncn8025_settings {
 	bool rstin;	/* Reset signal (true: asserted low) */
 	bool cmdvcc;	/* Command VCC pin. Activation sequence Enable (true: active low) */
@@ -28,6 +32,9 @@ struct ncn8025_settings {
 
 int ncn8025_set(uint8_t slot, const struct ncn8025_settings *set);
 int ncn8025_get(uint8_t slot, struct ncn8025_settings *set);
+int ncn8025_resync(uint8_t slot);
+bool ncn8025_busy(uint8_t slot);
+void ncn8025_set_cb(uint8_t slot, ncn8025_cb_t cb, void *data);
 bool ncn8025_interrupt_level(uint8_t slot);
 int ncn8025_init(unsigned int slot);
 void ncn8025_dump(const struct ncn8025_settings *set);
@@ -1,10 +1,18 @@
+#include <hal_atomic.h>
+#include <utils.h>
 #include "atmel_start_pins.h"
 #include "i2c_bitbang.h"
+#include "octsim_i2c.h"
+#include "prof.h"
 
 /* FIXME: This somehow ends up with measured 125 kHz SCL speed ?!?  We should probably
  * switch away from using delay_us() and instead use some hardware timer? */
 #define I2C_DELAY_US	1
 
+/* queued transfers advance by one half SCL cycle per TC0 tick, clocked by the 48 MHz GCLK1 */
+#define I2C_TICK_CLK_HZ	48000000
+#define I2C_TICK_HZ	100000
+
 #ifndef SDA1
 /* We should define those pins in Atmel START. Until they are, define them here */
 #define SDA1 GPIO(GPIO_PORTB, 15)
@@ -17,27 +25,81 @@
 #define SCL4 GPIO(GPIO_PORTC, 27)
 #endif
 
+static struct i2c_bus_state i2c_state[4];
+
 /* Unfortunately the schematics count I2C busses from '1', not from '0' :(
  * In software, we [obviously] count from '0' upwards. */
+
 const struct i2c_adapter i2c[4] = {
 	[0] = {
 		.pin_sda = SDA1,
 		.pin_scl = SCL1,
 		.udelay = I2C_DELAY_US,
+		.state = &i2c_state[0],
 	},
 	[1] = {
 		.pin_sda = SDA2,
 		.pin_scl = SCL2,
 		.udelay = I2C_DELAY_US,
+		.state = &i2c_state[1],
 	},
 	[2] = {
 		.pin_sda = SDA3,
 		.pin_scl = SCL3,
 		.udelay = I2C_DELAY_US,
+		.state = &i2c_state[2],
 	},
 	[3] = {
 		.pin_sda = SDA4,
 		.pin_scl = SCL4,
 		.udelay = I2C_DELAY_US,
+		.state = &i2c_state[3],
 	}
 };
+
+void TC0_Handler(void)
+{
+	uint32_t t = prof_begin();
+	bool busy = false;
+	unsigned int i;
+
+	hri_tc_clear_INTFLAG_MC0_bit(TC0);
+
+	i2c_async_tick(i2c, ARRAY_SIZE(i2c));
+
+	/* stop ticking once all buses are idle; checked atomically against i2c_async_kick() */
+	CRITICAL_SECTION_ENTER()
+	for (i = 0; i < ARRAY_SIZE(i2c); i++)
+		busy |= i2c_busy(&i2c[i]);
+	if (!busy)
+		hri_tc_clear_CTRLA_ENABLE_bit(TC0);
+	CRITICAL_SECTION_LEAVE()
+	prof_end(PROF_ISR_I2C, t);
+}
+
+void i2c_async_kick(void)
+{
+	CRITICAL_SECTION_ENTER()
+	if (!hri_tc_get_CTRLA_ENABLE_bit(TC0))
+		hri_tc_set_CTRLA_ENABLE_bit(TC0);
+	CRITICAL_SECTION_LEAVE()
+}
+
+/*! Initialize all I2C buses and the timer for queued transfers */
+void octsim_i2c_init(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(i2c); i++)
+		i2c_init(&i2c[i]);
+
+	hri_mclk_set_APBAMASK_TC0_bit(MCLK);
+	hri_gclk_write_PCHCTRL_reg(GCLK, TC0_GCLK_ID, GCLK_PCHCTRL_GEN_GCLK1 | (1 << GCLK_PCHCTRL_CHEN_Pos));
+
+	hri_tc_write_CTRLA_reg(TC0, TC_CTRLA_SWRST);
+	hri_tc_write_CTRLA_reg(TC0, TC_CTRLA_MODE_COUNT16 | TC_CTRLA_PRESCALER_DIV1);
+	hri_tc_write_WAVE_reg(TC0, TC_WAVE_WAVEGEN_MFRQ);
+	hri_tccount16_write_CC_reg(TC0, 0, I2C_TICK_CLK_HZ / I2C_TICK_HZ - 1);
+	hri_tc_set_INTEN_MC0_bit(TC0);
+	NVIC_EnableIRQ(TC0_IRQn);
+}
@@ -2,3 +2,5 @@
 #include "i2c_bitbang.h"
 
 extern const struct i2c_adapter i2c[4];
+
+void octsim_i2c_init(void);
@@ -0,0 +1,187 @@
+/* Cycle counter profiling of the main loop, interrupt handlers and I2C transfers
+ *
+ * Code sections are timed with the DWT cycle counter of the Cortex-M4 by placing
+ * prof_begin()/prof_end() around them. Each section keeps the count, minimum, maximum and
+ * sum of its durations and a histogram of them. Besides, one event of the CMCC cache
+ * monitor is counted. All of it is printed and cleared with the "prof" command.
+ *
+ * (C) 2019 by sysmocom - s.f.m.c. GmbH
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <hal_atomic.h>
+#include <utils.h>
+#include <hri_cmcc_e54.h>
+#include <peripheral_clk_config.h>
+
+#include "command.h"
+#include "prof.h"
+
+/* the profile is only read with the "prof" command */
+#if !defined(ENABLE_DBG_UART7) && !defined(WITH_DEBUG_CDC)
+#error "PROF needs a shell, build with DEBUG_UART=1 (costs slot 7) or WITH_DEBUG_CDC"
+#endif
+
+/* histogram buckets: below 64 cycles, then by factors of 4, the last one open ended */
+#define PROF_HIST_BUCKETS	8
+#define PROF_HIST_FIRST_BITS	6
+
+struct prof_stat {
+	uint32_t count;
+	uint32_t min;
+	uint32_t max;
+	uint64_t sum;
+	uint16_t hist[PROF_HIST_BUCKETS];
+};
+
+static const char *const prof_names[_NUM_PROF] = {
+	[PROF_LOOP]		= "loop",
+	[PROF_LOOP_RESET]	= "loop usb_reset",
+	[PROF_LOOP_TICK]	= "loop tick",
+	[PROF_LOOP_CMD]		= "loop cmd",
+	[PROF_LOOP_VENDOR]	= "loop vendor",
+	[PROF_FEED_CCID]	= "feed_ccid",
+	[PROF_SUBMIT_OUT]	= "submit_out",
+	[PROF_SLOT_FSM(0)]	= "slot0 fsm",
+	[PROF_SLOT_FSM(1)]	= "slot1 fsm",
+	[PROF_SLOT_FSM(2)]	= "slot2 fsm",
+	[PROF_SLOT_FSM(3)]	= "slot3 fsm",
+	[PROF_SLOT_FSM(4)]	= "slot4 fsm",
+	[PROF_SLOT_FSM(5)]	= "slot5 fsm",
+	[PROF_SLOT_FSM(6)]	= "slot6 fsm",
+	[PROF_SLOT_FSM(7)]	= "slot7 fsm",
+	[PROF_ISR_USB]		= "isr usb",
+	[PROF_ISR_SERCOM]	= "isr sercom",
+	[PROF_ISR_I2C]		= "isr i2c",
+	[PROF_I2C]		= "i2c xfer",
+};
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wlarger-than="
+static struct prof_stat prof_stats[_NUM_PROF];
+#pragma GCC diagnostic pop
+
+/* cycle counter at the last reset, the CMCC monitor counts from there */
+static uint32_t prof_reset_cycles;
+
+static const char *const cmcc_mode_names[] = {
+	[CMCC_MCFG_MODE_CYCLE_COUNT_Val]	= "cycles",
+	[CMCC_MCFG_MODE_IHIT_COUNT_Val]		= "ihit",
+	[CMCC_MCFG_MODE_DHIT_COUNT_Val]		= "dhit",
+};
+
+static unsigned int prof_hist_bucket(uint32_t cycles)
+{
+	unsigned int bits = 32 - __builtin_clz(cycles | 1);
+
+	if (bits <= PROF_HIST_FIRST_BITS)
+		return 0;
+	bits = (bits - PROF_HIST_FIRST_BITS + 1) / 2;
+	return bits < PROF_HIST_BUCKETS ? bits : PROF_HIST_BUCKETS - 1;
+}
+
+/*! end timing a code section; may be called from interrupt context
+ *  \param[in] id code section
+ *  \param[in] begin return value of the matching prof_begin() */
+void prof_end(unsigned int id, uint32_t begin)
+{
+	uint32_t cycles = DWT->CYCCNT - begin;
+	struct prof_stat *st = &prof_stats[id];
+	unsigned int b = prof_hist_bucket(cycles);
+
+	CRITICAL_SECTION_ENTER()
+	if (!st->count || cycles < st->min)
+		st->min = cycles;
+	if (cycles > st->max)
+		st->max = cycles;
+	st->count++;
+	st->sum += cycles;
+	if (st->hist[b] != UINT16_MAX)
+		st->hist[b]++;
+	CRITICAL_SECTION_LEAVE()
+}
+
+static void prof_reset(void)
+{
+	CRITICAL_SECTION_ENTER()
+	memset(prof_stats, 0, sizeof(prof_stats));
+	hri_cmcc_write_MCTRL_reg(CMCC, CMCC_MCTRL_SWRST);
+	prof_reset_cycles = DWT->CYCCNT;
+	CRITICAL_SECTION_LEAVE()
+}
+
+static void prof_show(void)
+{
+	uint32_t mode = hri_cmcc_read_MCFG_reg(CMCC) & CMCC_MCFG_MODE_Msk;
+	uint32_t cycles, events;
+	unsigned int i, b;
+
+	CRITICAL_SECTION_ENTER()
+	cycles = DWT->CYCCNT - prof_reset_cycles;
+	events = hri_cmcc_read_MSR_reg(CMCC);
+	CRITICAL_SECTION_LEAVE()
+
+	printf("%lu cycles (%lu ms) since reset, cmcc %s: %lu\r\n", (unsigned long)cycles,
+		(unsigned long)(cycles / (CONF_CPU_FREQUENCY / 1000)),
+		mode < ARRAY_SIZE(cmcc_mode_names) ? cmcc_mode_names[mode] : "?", (unsigned long)events);
+	printf(" %-14s %8s %8s %8s %8s   histogram (<64, <256, <1k, .. <256k, more cycles)\r\n",
+		"section", "count", "min", "avg", "max");
+	for (i = 0; i < _NUM_PROF; i++) {
+		struct prof_stat st;
+
+		CRITICAL_SECTION_ENTER()
+		st = prof_stats[i];
+		CRITICAL_SECTION_LEAVE()
+
+		if (!st.count)
+			continue;
+		printf(" %-14s %8lu %8lu %8lu %8lu  ", prof_names[i], (unsigned long)st.count,
+			(unsigned long)st.min, (unsigned long)(st.sum / st.count), (unsigned long)st.max);
+		for (b = 0; b < PROF_HIST_BUCKETS; b++)
+			printf(" %u", st.hist[b]);
+		printf("\r\n");
+	}
+	printf("(times in cycles of %lu MHz)\r\n", (unsigned long)(CONF_CPU_FREQUENCY / 1000000));
+}
+
+DEFUN(cmd_prof, cmd_prof_cmd, "prof", "Cycle profile: prof show|reset|cmcc cycles|ihit|dhit")
+{
+	unsigned int i;
+
+	if (argc < 2 || !strcmp(argv[1], "show")) {
+		prof_show();
+	} else if (!strcmp(argv[1], "reset")) {
+		prof_reset();
+	} else if (!strcmp(argv[1], "cmcc") && argc >= 3) {
+		for (i = 0; i < ARRAY_SIZE(cmcc_mode_names); i++) {
+			if (!strcmp(argv[2], cmcc_mode_names[i]))
+				break;
+		}
+		if (i == ARRAY_SIZE(cmcc_mode_names)) {
+			printf("Unknown cmcc event: '%s'\r\n", argv[2]);
+			return;
+		}
+		/* only one event can be counted, switching restarts the whole profile */
+		hri_cmcc_write_MCFG_reg(CMCC, CMCC_MCFG_MODE(i));
+		prof_reset();
+	} else {
+		printf("Usage: prof show|reset|cmcc cycles|ihit|dhit\r\n");
+	}
+}
+
+/*! Start the cycle counter and the CMCC monitor, register the "prof" command */
+void prof_init(void)
+{
+	/* already running since main() for the boot times, which must not be reset */
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+	hri_cmcc_write_MCFG_reg(CMCC, CMCC_MCFG_MODE_IHIT_COUNT);
+	hri_cmcc_write_MEN_reg(CMCC, CMCC_MEN_MENABLE);
+	prof_reset();
+
+	command_register(&cmd_prof_cmd);
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include <stdint.h>
+
+/*! code sections timed by prof_begin()/prof_end(), see the "prof" command */
+enum prof_id {
+	PROF_LOOP,		/* main loop: one pass handling the flagged work */
+	PROF_LOOP_RESET,	/* main loop: WORK_USB_RESET */
+	PROF_LOOP_TICK,		/* main loop: WORK_TICK */
+	PROF_LOOP_CMD,		/* main loop: WORK_CMD */
+	PROF_LOOP_VENDOR,	/* main loop: vendor interface */
+	PROF_FEED_CCID,		/* feed_ccid() */
+	PROF_SUBMIT_OUT,	/* submit_next_out_all() */
+	PROF_SLOT_FSM0,		/* handle_fsm_events() of slots 0..7 */
+	PROF_ISR_USB = PROF_SLOT_FSM0 + 8,
+	PROF_ISR_SERCOM,	/* card UARTs and debug UART */
+	PROF_ISR_I2C,		/* TC0: tick of the queued I2C transfers */
+	PROF_I2C,		/* queued I2C transfer, from i2c_submit() to its completion */
+	_NUM_PROF
+};
+#define PROF_SLOT_FSM(n)	(PROF_SLOT_FSM0 + (n))
+
+#ifdef WITH_PROF
+#include <compiler.h>
+
+/*! start timing a code section
+ *  \returns the cycle counter, to be passed to prof_end() */
+static inline uint32_t prof_begin(void)
+{
+	return DWT->CYCCNT;
+}
+
+void prof_end(unsigned int id, uint32_t begin);
+void prof_init(void);
+#else
+static inline uint32_t prof_begin(void)
+{
+	return 0;
+}
+
+static inline void prof_end(unsigned int id, uint32_t begin)
+{
+}
+#endif
@@ -0,0 +1,666 @@
+/* Slot self-benchmark: APDU loops run on the card slots from the debug shell, without USB
+ *
+ * The commands are handed to the CCID layer as CCID messages with a bSeq of their own, as
+ * the vendor interface does, and their responses are taken back before they reach the CCID
+ * IN endpoint. So the CCID layer, the ISO7816 FSMs and the card UARTs do just what they do
+ * for the host, while USB and the host are out of the picture: the results tell what the
+ * cards and the slot hardware can do.
+ *
+ * A run consists of one round per rate. Each round activates the card, negotiates F and D
+ * with a PPS unless it runs at the default rate, and repeats SELECT and READ BINARY of a
+ * transparent EF. When a round ends, its commands and data bytes per second, its errors and
+ * the latency percentiles of each phase are printed. A card which stopped responding is
+ * activated again, up to BENCH_MAX_FAILS times in a row.
+ *
+ * The host should leave the slots under test alone: its commands are rejected as busy while
+ * one of the benchmark runs, and the card is left unpowered at the end. No host is needed
+ * though, the slots are usable as soon as the device has booted.
+ *
+ * The commands are registered on the shell, which needs DEBUG_UART=1 or WITH_DEBUG_CDC. The
+ * debug UART takes the SERCOM of slot 7, which then can't be benchmarked.
+ *
+ * (C) 2019 by sysmocom - s.f.m.c. GmbH
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <compiler.h>
+#include <peripheral_clk_config.h>
+#include <osmocom/core/msgb.h>
+#include <osmocom/core/utils.h>
+#include <osmocom/core/bit32gen.h>
+
+#include "ccid_proto.h"
+#include "ccid_device.h"
+#include "ccid_slot_fsm.h"
+#include "iso7816_3.h"
+#include "msgb_pool.h"
+#include "libosmo_emb.h"
+#include "command.h"
+#include "slot_bench.h"
+
+#if !defined(ENABLE_DBG_UART7) && !defined(WITH_DEBUG_CDC)
+#error "BENCH needs a shell, build with DEBUG_UART=1 (costs slot 7) or WITH_DEBUG_CDC"
+#endif
+
+/* slots with a card UART: SERCOM7 of slot 7 may be the debug UART */
+#ifdef ENABLE_DBG_UART7
+#define BENCH_SLOT_MASK		0x7f
+#else
+#define BENCH_SLOT_MASK		0xff
+#endif
+/* latency histogram: exact below 4us, then 4 bins per power of 2, up to half a second */
+#define BENCH_HIST_BINS		72
+/* consecutive failed activations or exchanges after which a round is given up */
+#define BENCH_MAX_FAILS		3
+/* iterations of a round, so that the histogram bins can't overflow */
+#define BENCH_MAX_COUNT		30000
+
+enum bench_phase {
+	BENCH_ATR,		/* IccPowerOn until the ATR */
+	BENCH_PPS,
+	BENCH_SELECT,
+	BENCH_READ,
+	_NUM_BENCH_PHASE
+};
+
+static const char *const bench_phase_names[_NUM_BENCH_PHASE] = {
+	[BENCH_ATR]	= "atr",
+	[BENCH_PPS]	= "pps",
+	[BENCH_SELECT]	= "select",
+	[BENCH_READ]	= "read",
+};
+
+enum bench_rate {
+	BENCH_RATE_DEFAULT,	/* Fd/Dd, no PPS */
+	BENCH_RATE_MAX,		/* F and D from TA1 of the ATR */
+	BENCH_RATE_SWEEP,	/* Dd, then each higher D up to the one of TA1 */
+};
+
+static const char *const bench_rate_names[] = {
+	[BENCH_RATE_DEFAULT]	= "default",
+	[BENCH_RATE_MAX]	= "max",
+	[BENCH_RATE_SWEEP]	= "sweep",
+};
+
+/* command to send next, or whose response is awaited */
+enum bench_state {
+	BS_IDLE,
+	BS_ACTIVATE,
+	BS_PPS,
+	BS_SELECT,
+	BS_READ,
+	BS_DEACTIVATE,		/* at the end of a round */
+};
+
+static const char *const bench_state_names[] = {
+	[BS_IDLE]	= "idle",
+	[BS_ACTIVATE]	= "activate",
+	[BS_PPS]	= "pps",
+	[BS_SELECT]	= "select",
+	[BS_READ]	= "read",
+	[BS_DEACTIVATE]	= "deactivate",
+};
+
+struct bench_phase_stat {
+	uint32_t count;
+	uint32_t max;
+	uint64_t sum;
+	/* latencies in us, see bench_bin() */
+	uint16_t hist[BENCH_HIST_BINS];
+};
+
+struct bench_slot {
+	enum bench_state state;
+	/* a command is with the CCID layer, its response not yet back */
+	bool waiting;
+	/* the response is back, not yet handled by bench_complete() */
+	bool rsp_pending;
+	uint8_t seq;
+	/* of the response: bStatus masked with CCID_CMD_STATUS_MASK */
+	uint8_t rsp_status;
+	/* of a RDR_to_PC_DataBlock: data length and the last two bytes, the status word */
+	uint16_t rsp_len;
+	uint8_t rsp_sw1;
+	uint8_t rsp_sw2;
+	/* cycle counter when the command was handed over, and its latency */
+	uint32_t t_cmd;
+	uint32_t rsp_cycles;
+
+	/* TA1 of the last ATR, 0x11 (Fd/Dd) if it has none */
+	uint8_t ta1;
+	/* rate of the current round as Fi/Di index, di 0: Fd/Dd without PPS */
+	uint8_t fi;
+	uint8_t di;
+	/* consecutive failures */
+	uint8_t fails;
+	/* takes part in the current or last run */
+	bool used;
+
+	/* results of the current round */
+	uint32_t t_round;
+	uint32_t ms;
+	uint32_t iter;
+	uint32_t cmds;
+	uint32_t bytes;
+	uint32_t err_mute;
+	uint32_t err_sw;
+	uint32_t err_act;
+	struct bench_phase_stat phase[_NUM_BENCH_PHASE];
+};
+
+static struct {
+	struct ccid_instance *ci;
+	/* parameters of the run */
+	uint32_t count;
+	uint16_t len;
+	uint16_t fid;
+	uint8_t cla;
+	enum bench_rate rate;
+	/* stop all slots after their current command */
+	bool stopping;
+} g_bench;
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wlarger-than="
+static struct bench_slot g_bench_slot[NR_SLOTS];
+#pragma GCC diagnostic pop
+
+static unsigned int bench_bin(uint32_t us)
+{
+	unsigned int bits = 32 - __builtin_clz(us | 1);
+	unsigned int b;
+
+	if (us < 4)
+		return us;
+	b = 4 * (bits - 2) + ((us >> (bits - 3)) & 3);
+	return b < BENCH_HIST_BINS ? b : BENCH_HIST_BINS - 1;
+}
+
+/* largest latency of a bin */
+static uint32_t bench_bin_top(unsigned int b)
+{
+	if (b < 4)
+		return b;
+	return ((4 + b % 4 + 1) << (b / 4 - 1)) - 1;
+}
+
+static void bench_record(struct bench_phase_stat *ps, uint32_t us)
+{
+	ps->count++;
+	ps->sum += us;
+	if (us > ps->max)
+		ps->max = us;
+	ps->hist[bench_bin(us)]++;
+}
+
+/* latency in us which pct percent of the samples don't exceed, rounded up to its bin */
+static uint32_t bench_percentile(const struct bench_phase_stat *ps, unsigned int pct)
+{
+	uint32_t rank = (ps->count * pct + 99) / 100;
+	uint32_t n = 0;
+	unsigned int b;
+
+	for (b = 0; b < BENCH_HIST_BINS - 1; b++) {
+		n += ps->hist[b];
+		if (n >= rank)
+			break;
+	}
+	return OSMO_MIN(bench_bin_top(b), ps->max);
+}
+
+/* Di index of the highest D the card supports according to TA1, 0 for Dd */
+static uint8_t bench_max_di(uint8_t ta1)
+{
+	if (!iso7816_3_fi_table[ta1 >> 4] || iso7816_3_di_table[ta1 & 0xf] <= 1)
+		return 0;
+	return ta1 & 0xf;
+}
+
+/* Di index of the next higher D the card supports according to TA1, 0 if there is none */
+static uint8_t bench_next_di(uint8_t di, uint8_t ta1)
+{
+	uint8_t d = di ? iso7816_3_di_table[di] : 1;
+	uint8_t dmax = iso7816_3_di_table[bench_max_di(ta1)];
+	uint8_t best = 0;
+	int i;
+
+	for (i = 1; i < 16; i++) {
+		uint8_t cand = iso7816_3_di_table[i];
+		if (cand > d && cand <= dmax && (!best || cand < iso7816_3_di_table[best]))
+			best = i;
+	}
+	return best;
+}
+
+static void bench_print_round(uint8_t slot_nr, uint32_t ms)
+{
+	const struct bench_slot *bs = &g_bench_slot[slot_nr];
+	unsigned int i;
+
+	printf("slot%u F=%u D=%u: %lu cmds, %lu bytes in %lu ms: %lu cmds/s, %lu bytes/s\r\n",
+		slot_nr, bs->di ? iso7816_3_fi_table[bs->fi] : 372, bs->di ? iso7816_3_di_table[bs->di] : 1,
+		(unsigned long)bs->cmds, (unsigned long)bs->bytes, (unsigned long)ms,
+		(unsigned long)((uint64_t)bs->cmds * 1000 / (ms ? ms : 1)),
+		(unsigned long)((uint64_t)bs->bytes * 1000 / (ms ? ms : 1)));
+	printf(" errors: %lu mute, %lu status word, %lu activation\r\n", (unsigned long)bs->err_mute,
+		(unsigned long)bs->err_sw, (unsigned long)bs->err_act);
+	for (i = 0; i < _NUM_BENCH_PHASE; i++) {
+		const struct bench_phase_stat *ps = &bs->phase[i];
+
+		if (!ps->count)
+			continue;
+		printf(" %-6s %6lu  avg %lu  p50 %lu  p90 %lu  p99 %lu  max %lu us\r\n", bench_phase_names[i],
+			(unsigned long)ps->count, (unsigned long)(ps->sum / ps->count),
+			(unsigned long)bench_percentile(ps, 50), (unsigned long)bench_percentile(ps, 90),
+			(unsigned long)bench_percentile(ps, 99), (unsigned long)ps->max);
+	}
+}
+
+static void bench_round_start(struct bench_slot *bs)
+{
+	bs->fails = 0;
+	bs->ms = 0;
+	bs->iter = 0;
+	bs->cmds = 0;
+	bs->bytes = 0;
+	bs->err_mute = 0;
+	bs->err_sw = 0;
+	bs->err_act = 0;
+	memset(bs->phase, 0, sizeof(bs->phase));
+	bs->t_round = get_jiffies();
+	bs->state = BS_ACTIVATE;
+}
+
+static void bench_round_done(uint8_t slot_nr)
+{
+	struct bench_slot *bs = &g_bench_slot[slot_nr];
+
+	bs->ms = get_jiffies() - bs->t_round;
+	bench_print_round(slot_nr, bs->ms);
+
+	if (!g_bench.stopping && g_bench.rate == BENCH_RATE_SWEEP
+	    && (bs->di = bench_next_di(bs->di, bs->ta1))) {
+		bs->fi = bs->ta1 >> 4;
+		bench_round_start(bs);
+	} else
+		bs->state = BS_IDLE;
+}
+
+/* the card was deactivated by the slot: activate it again, or give up on the round */
+static void bench_failed(struct bench_slot *bs, uint32_t *err)
+{
+	(*err)++;
+	bs->state = ++bs->fails < BENCH_MAX_FAILS ? BS_ACTIVATE : BS_DEACTIVATE;
+}
+
+/* handle the response to the command of the current state, go on to the next state */
+static void bench_complete(uint8_t slot_nr)
+{
+	struct bench_slot *bs = &g_bench_slot[slot_nr];
+	uint32_t us = bs->rsp_cycles / (CONF_CPU_FREQUENCY / 1000000);
+	bool ok = bs->rsp_status == CCID_CMD_STATUS_OK;
+	bool sw_ok;
+
+	bs->rsp_pending = false;
+
+	switch (bs->state) {
+	case BS_ACTIVATE:
+		if (!ok) {
+			bench_failed(bs, &bs->err_act);
+			break;
+		}
+		bench_record(&bs->phase[BENCH_ATR], us);
+		if (g_bench.rate == BENCH_RATE_MAX) {
+			bs->di = bench_max_di(bs->ta1);
+			bs->fi = bs->ta1 >> 4;
+		}
+		bs->state = bs->di ? BS_PPS : BS_SELECT;
+		break;
+	case BS_PPS:
+		if (!ok) {
+			bench_failed(bs, &bs->err_act);
+			break;
+		}
+		bench_record(&bs->phase[BENCH_PPS], us);
+		bs->state = BS_SELECT;
+		break;
+	case BS_SELECT:
+	case BS_READ:
+		if (!ok) {
+			bench_failed(bs, &bs->err_mute);
+			break;
+		}
+		bench_record(&bs->phase[bs->state == BS_SELECT ? BENCH_SELECT : BENCH_READ], us);
+		bs->cmds++;
+		bs->fails = 0;
+
+		/* 9000, 91xx (proactive command), 9Fxx/61xx (response data available) */
+		sw_ok = bs->rsp_len >= 2 && (bs->rsp_sw1 == 0x90 || bs->rsp_sw1 == 0x91
+			|| (bs->state == BS_SELECT && (bs->rsp_sw1 == 0x9f || bs->rsp_sw1 == 0x61)));
+		if (!sw_ok)
+			bs->err_sw++;
+		else if (bs->state == BS_READ)
+			bs->bytes += bs->rsp_len - 2;
+
+		if (bs->state == BS_SELECT)
+			bs->state = BS_READ;
+		else if (++bs->iter < g_bench.count)
+			bs->state = BS_SELECT;
+		else
+			bs->state = BS_DEACTIVATE;
+		break;
+	case BS_DEACTIVATE:
+		bench_round_done(slot_nr);
+		break;
+	case BS_IDLE:
+		break;
+	}
+}
+
+/* hand the command of the current state to the CCID layer
+ * \returns false if it has to wait, e.g. for a msgb or for a command of the host */
+static bool bench_issue(uint8_t slot_nr)
+{
+	struct bench_slot *bs = &g_bench_slot[slot_nr];
+	struct ccid_slot *cs = &g_bench.ci->slot[slot_nr];
+	union ccid_pc_to_rdr *u;
+	struct msgb *msg;
+	uint8_t *tpdu;
+
+	if (cs->cmd_busy)
+		return false;
+	if (!cs->icc_present) {
+		printf("slot%u: card removed, benchmark stopped\r\n", slot_nr);
+		bs->ms = get_jiffies() - bs->t_round;
+		bench_print_round(slot_nr, bs->ms);
+		bs->state = BS_IDLE;
+		return false;
+	}
+
+	if (bs->state == BS_PPS) {
+		bs->seq++;
+		bs->t_cmd = DWT->CYCCNT;
+		if (iso_fsm_slot_pps(cs, bs->seq, bs->fi, bs->di) < 0) {
+			/* deactivated meanwhile */
+			bench_failed(bs, &bs->err_act);
+			return true;
+		}
+		bs->waiting = true;
+		return true;
+	}
+
+	/* leave the last msgbs to the responses, like the vendor interface */
+	if (g_ccid_msgb_pool.avail <= NR_SLOTS)
+		return false;
+	msg = msgb_pool_get(&g_ccid_msgb_pool);
+	if (!msg)
+		return false;
+
+	/* all of them have a 10 byte header, an XfrBlock is followed by the TPDU */
+	u = (union ccid_pc_to_rdr *) msgb_put(msg, sizeof(u->xfr_block));
+	memset(u, 0, sizeof(u->xfr_block));
+	switch (bs->state) {
+	case BS_ACTIVATE:
+		/* automatic voltage selection */
+		u->icc_power_on.hdr.bMessageType = PC_to_RDR_IccPowerOn;
+		break;
+	case BS_DEACTIVATE:
+		u->icc_power_off.hdr.bMessageType = PC_to_RDR_IccPowerOff;
+		break;
+	case BS_SELECT:
+		u->xfr_block.hdr.bMessageType = PC_to_RDR_XfrBlock;
+		tpdu = msgb_put(msg, 7);
+		tpdu[0] = g_bench.cla;
+		tpdu[1] = 0xa4;
+		/* by file identifier; a UICC shall not return the FCP */
+		tpdu[2] = 0x00;
+		tpdu[3] = g_bench.cla == 0xa0 ? 0x00 : 0x0c;
+		tpdu[4] = 2;
+		tpdu[5] = g_bench.fid >> 8;
+		tpdu[6] = g_bench.fid & 0xff;
+		break;
+	case BS_READ:
+		u->xfr_block.hdr.bMessageType = PC_to_RDR_XfrBlock;
+		tpdu = msgb_put(msg, 5);
+		tpdu[0] = g_bench.cla;
+		tpdu[1] = 0xb0;
+		tpdu[2] = 0x00;
+		tpdu[3] = 0x00;
+		tpdu[4] = g_bench.len & 0xff;
+		break;
+	default:
+		OSMO_ASSERT(0);
+	}
+	osmo_store32le(msgb_length(msg) - sizeof(u->xfr_block), &u->xfr_block.hdr.dwLength);
+	u->xfr_block.hdr.bSlot = slot_nr;
+	u->xfr_block.hdr.bSeq = ++bs->seq;
+
+	/* the response may already be back when ccid_handle_out() returns */
+	bs->waiting = true;
+	bs->t_cmd = DWT->CYCCNT;
+	ccid_handle_out(g_bench.ci, msg);
+	return true;
+}
+
+/*! Take the response to a command of the benchmark from the CCID layer.
+ *  \param[in] msg response on its way to the CCID IN endpoint
+ *  \returns true if it was one, ownership of msg is transferred then */
+bool slot_bench_handle_resp(struct msgb *msg)
+{
+	const struct ccid_header_in *chi = (const struct ccid_header_in *) msgb_data(msg);
+	const struct ccid_rdr_to_pc_data_block *db = (const struct ccid_rdr_to_pc_data_block *) chi;
+	uint32_t cycles = DWT->CYCCNT;
+	struct bench_slot *bs;
+	uint32_t len;
+
+	if (msgb_length(msg) < sizeof(*db) || chi->hdr.bSlot >= NR_SLOTS)
+		return false;
+	bs = &g_bench_slot[chi->hdr.bSlot];
+	if (!bs->waiting || chi->hdr.bSeq != bs->seq)
+		return false;
+	if (g_bench.ci->slot[chi->hdr.bSlot].cmd_busy) {
+		if ((chi->bStatus & CCID_CMD_STATUS_MASK) == CCID_CMD_STATUS_TIME_EXT) {
+			msgb_free(msg);
+			return true;
+		}
+		/* a command of the host rejected as busy, with the same bSeq */
+		return false;
+	}
+
+	bs->rsp_cycles = cycles - bs->t_cmd;
+	bs->rsp_status = chi->bStatus & CCID_CMD_STATUS_MASK;
+	bs->rsp_len = 0;
+	if (chi->hdr.bMessageType == RDR_to_PC_DataBlock) {
+		len = OSMO_MIN(osmo_load32le(&chi->hdr.dwLength), msgb_length(msg) - sizeof(*db));
+		bs->rsp_len = len;
+		if (len >= 2) {
+			bs->rsp_sw1 = db->abData[len - 2];
+			bs->rsp_sw2 = db->abData[len - 1];
+		}
+		/* TA1 is there if bit 5 of T0 is set */
+		if (bs->state == BS_ACTIVATE)
+			bs->ta1 = len >= 3 && (db->abData[1] & 0x10) ? db->abData[2] : 0x11;
+	}
+	bs->waiting = false;
+	bs->rsp_pending = true;
+	msgb_free(msg);
+	return true;
+}
+
+/*! Go on with the slots under test; from the main loop, not from within the CCID layer */
+void slot_bench_poll(void)
+{
+	uint8_t i;
+
+	for (i = 0; i < NR_SLOTS; i++) {
+		struct bench_slot *bs = &g_bench_slot[i];
+
+		/* the slot gave up on the command without a response, e.g. on card removal */
+		if (bs->waiting && !g_bench.ci->slot[i].cmd_busy) {
+			bs->waiting = false;
+			bs->rsp_pending = true;
+			bs->rsp_status = CCID_CMD_STATUS_FAILED;
+			bs->rsp_len = 0;
+		}
+		while (bs->state != BS_IDLE && !bs->waiting) {
+			if (bs->rsp_pending) {
+				bench_complete(i);
+				continue;
+			}
+			if (g_bench.stopping && bs->state != BS_DEACTIVATE)
+				bs->state = BS_DEACTIVATE;
+			if (!bench_issue(i))
+				break;
+		}
+	}
+}
+
+static bool bench_running(void)
+{
+	uint8_t i;
+
+	for (i = 0; i < NR_SLOTS; i++) {
+		if (g_bench_slot[i].state != BS_IDLE || g_bench_slot[i].waiting)
+			return true;
+	}
+	return false;
+}
+
+static void bench_show(void)
+{
+	uint8_t i;
+
+	printf("bench: %s, %lu x select %04x + read %u bytes, cla %02x, rate %s\r\n",
+		bench_running() ? (g_bench.stopping ? "stopping" : "running") : "idle",
+		(unsigned long)g_bench.count, g_bench.fid, g_bench.len, g_bench.cla,
+		bench_rate_names[g_bench.rate]);
+	for (i = 0; i < NR_SLOTS; i++) {
+		const struct bench_slot *bs = &g_bench_slot[i];
+
+		if (!bs->used)
+			continue;
+		printf("slot%u: %s, iteration %lu\r\n", i, bench_state_names[bs->state], (unsigned long)bs->iter);
+		bench_print_round(i, bs->state == BS_IDLE ? bs->ms : get_jiffies() - bs->t_round);
+	}
+}
+
+/* SELECT EF ICCID, which every SIM and UICC has, and READ BINARY all of it, in the GSM class */
+static void bench_set_defaults(void)
+{
+	g_bench.count = 100;
+	g_bench.len = 10;
+	g_bench.fid = 0x2fe2;
+	g_bench.cla = 0xa0;
+	g_bench.rate = BENCH_RATE_DEFAULT;
+}
+
+/* "bench start <slot|all> [<param> <value>]..." */
+static void bench_start(int argc, char **argv)
+{
+	unsigned long val;
+	uint8_t mask, i;
+	char *end;
+	int a;
+
+	if (bench_running()) {
+		printf("Benchmark still running\r\n");
+		return;
+	}
+	if (argc < 3)
+		goto usage;
+	if (!strcmp(argv[2], "all"))
+		mask = BENCH_SLOT_MASK;
+	else {
+		val = strtoul(argv[2], &end, 0);
+		if (*end || val >= NR_SLOTS)
+			goto usage;
+		mask = 1 << val;
+		if (!(mask & BENCH_SLOT_MASK)) {
+			printf("slot%lu: its UART is the debug UART\r\n", val);
+			return;
+		}
+	}
+
+	bench_set_defaults();
+	for (a = 3; a + 1 < argc; a += 2) {
+		if (!strcmp(argv[a], "rate")) {
+			for (i = 0; i < ARRAY_SIZE(bench_rate_names); i++) {
+				if (!strcmp(argv[a + 1], bench_rate_names[i]))
+					break;
+			}
+			if (i == ARRAY_SIZE(bench_rate_names))
+				goto usage;
+			g_bench.rate = i;
+			continue;
+		}
+		val = strtoul(argv[a + 1], &end, !strcmp(argv[a], "count") || !strcmp(argv[a], "len") ? 0 : 16);
+		if (*end)
+			goto usage;
+		if (!strcmp(argv[a], "count") && val >= 1 && val <= BENCH_MAX_COUNT)
+			g_bench.count = val;
+		else if (!strcmp(argv[a], "len") && val >= 1 && val <= 256)
+			g_bench.len = val;
+		else if (!strcmp(argv[a], "fid") && val <= 0xffff)
+			g_bench.fid = val;
+		else if (!strcmp(argv[a], "cla") && val <= 0xff)
+			g_bench.cla = val;
+		else
+			goto usage;
+	}
+	if (a != argc)
+		goto usage;
+
+	g_bench.stopping = false;
+	for (i = 0; i < NR_SLOTS; i++) {
+		struct bench_slot *bs = &g_bench_slot[i];
+
+		bs->used = false;
+		if (!(mask & (1 << i)))
+			continue;
+		if (!g_bench.ci->slot[i].icc_present) {
+			if (mask != BENCH_SLOT_MASK)
+				printf("slot%u: no card\r\n", i);
+			continue;
+		}
+		bs->used = true;
+		bs->rsp_pending = false;
+		bs->ta1 = 0x11;
+		bs->fi = 0;
+		bs->di = 0;
+		bench_round_start(bs);
+	}
+	slot_bench_poll();
+	return;
+
+usage:
+	printf("Usage: bench start <slot|all> [count <n>] [len <bytes>] [fid <hex>] [cla <hex>] "
+		"[rate default|max|sweep]\r\n");
+}
+
+DEFUN(cmd_bench, cmd_bench_cmd, "bench", "Slot benchmark: bench show|stop|start <slot|all> [...]")
+{
+	if (argc < 2 || !strcmp(argv[1], "show")) {
+		bench_show();
+	} else if (!strcmp(argv[1], "start")) {
+		bench_start(argc, argv);
+	} else if (!strcmp(argv[1], "stop")) {
+		/* the slots deactivate their cards after their current command */
+		g_bench.stopping = true;
+		slot_bench_poll();
+	} else {
+		printf("Usage: bench show|stop|start <slot|all> [count <n>] [len <bytes>] [fid <hex>] "
+			"[cla <hex>] [rate default|max|sweep]\r\n");
+	}
+}
+
+/*! Register the "bench" command for the slots of a CCID instance */
+void slot_bench_init(struct ccid_instance *ci)
+{
+	g_bench.ci = ci;
+	bench_set_defaults();
+	command_register(&cmd_bench_cmd);
+}
@@ -0,0 +1,11 @@
+#pragma once
+/* Slot self-benchmark from the debug shell, see the "bench" command in slot_bench.c */
+
+#include <stdbool.h>
+#include <osmocom/core/msgb.h>
+
+#include "ccid_device.h"
+
+void slot_bench_init(struct ccid_instance *ci);
+bool slot_bench_handle_resp(struct msgb *msg);
+void slot_bench_poll(void);
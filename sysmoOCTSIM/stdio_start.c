@@ -8,10 +8,12 @@
 
 #include "atmel_start.h"
 #include "stdio_start.h"
+#include "mainloop.h"
 
 #ifdef ENABLE_DBG_UART7
 static void UART_debug_rx_cb(const struct usart_async_rings_descriptor *const io_descr)
 {
+	mainloop_schedule(WORK_CMD);
 }
 
 void stdio_redirect_init(void)
@@ -0,0 +1,512 @@
+/* Minimal implementation of the talloc API for the firmware, used instead of the full
+ * talloc unless built with TALLOC_DEBUG=1.
+ *
+ * Everything allocated during initialization (FSM instances and their private data, card
+ * UARTs, the msgb pools, logging) lives as long as the firmware runs, so it is taken from a
+ * bump arena and never returned. Once talloc_emb_init_done() has been called, allocations
+ * come from a few pools of fixed size blocks, carved from the rest of the arena.
+ *
+ * Unlike the real talloc, there is no hierarchy: talloc_free() only frees the given chunk
+ * (after calling its destructor), not its children, and contexts are ignored.
+ *
+ * (C) 2019 by sysmocom - s.f.m.c. GmbH
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <hal_atomic.h>
+#include <osmocom/core/utils.h>
+#include "talloc.h"
+#include "talloc_emb.h"
+
+#ifndef TALLOC_EMB_ARENA_SIZE
+#define TALLOC_EMB_ARENA_SIZE	(40 * 1024)
+#endif
+
+/* header in front of each allocation */
+struct emb_chunk {
+	const char *name;
+	int (*destructor)(void *);
+	uint16_t size;
+	/* index into emb_pools[], or EMB_POOL_ARENA */
+	uint8_t pool;
+} __attribute__((aligned(8)));
+
+#define EMB_POOL_ARENA	0xff
+
+struct emb_pool {
+	/* usable size and number of the blocks */
+	uint16_t size;
+	uint16_t num;
+	/* singly linked list of free blocks, through their first word */
+	void *free;
+	/* blocks in use, and their maximum */
+	uint16_t used;
+	uint16_t high_water;
+	/* allocations which didn't fit into this pool (or any larger one) */
+	uint32_t exhausted;
+};
+
+static struct emb_pool emb_pools[] = {
+	{ .size = 32, .num = 16 },
+	{ .size = 64, .num = 16 },
+	{ .size = 128, .num = 8 },
+	{ .size = 512, .num = 4 },
+};
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wlarger-than="
+static uint8_t emb_arena[TALLOC_EMB_ARENA_SIZE] __attribute__((aligned(8)));
+#pragma GCC diagnostic pop
+
+static struct {
+	/* bytes of the arena in use */
+	size_t used;
+	/* allocations which didn't fit into the arena */
+	uint32_t exhausted;
+	/* arena chunks passed to talloc_free(), which can't be returned */
+	uint32_t leaked;
+	/* allocations come from the pools */
+	bool init_done;
+} emb_arena_state;
+
+#define EMB_CHUNK(ptr)	((struct emb_chunk *)(ptr) - 1)
+#define EMB_PTR(tc)	((void *)((struct emb_chunk *)(tc) + 1))
+
+static void *emb_arena_alloc(size_t size)
+{
+	void *mem = NULL;
+
+	size = (size + 7) & ~7;
+	CRITICAL_SECTION_ENTER()
+	if (size <= sizeof(emb_arena) - emb_arena_state.used) {
+		mem = &emb_arena[emb_arena_state.used];
+		emb_arena_state.used += size;
+	} else
+		emb_arena_state.exhausted++;
+	CRITICAL_SECTION_LEAVE()
+
+	return mem;
+}
+
+static struct emb_chunk *emb_alloc(size_t size, const char *name)
+{
+	struct emb_chunk *tc = NULL;
+	unsigned int i;
+
+	if (size > UINT16_MAX)
+		return NULL;
+
+	if (!emb_arena_state.init_done) {
+		tc = emb_arena_alloc(sizeof(*tc) + size);
+		if (!tc)
+			return NULL;
+		tc->pool = EMB_POOL_ARENA;
+	} else {
+		CRITICAL_SECTION_ENTER()
+		/* smallest pool with a free block; count the full ones on the way */
+		for (i = 0; i < ARRAY_SIZE(emb_pools); i++) {
+			struct emb_pool *pool = &emb_pools[i];
+			if (pool->size < size)
+				continue;
+			if (!pool->free) {
+				pool->exhausted++;
+				continue;
+			}
+			tc = pool->free;
+			pool->free = *(void **)tc;
+			if (++pool->used > pool->high_water)
+				pool->high_water = pool->used;
+			tc->pool = i;
+			break;
+		}
+		CRITICAL_SECTION_LEAVE()
+		if (!tc)
+			return NULL;
+	}
+
+	tc->name = name;
+	tc->destructor = NULL;
+	tc->size = size;
+	return tc;
+}
+
+/* largest size the chunk can be resized to in place */
+static size_t emb_capacity(const struct emb_chunk *tc)
+{
+	if (tc->pool == EMB_POOL_ARENA)
+		return (tc->size + 7) & ~7;
+	return emb_pools[tc->pool].size;
+}
+
+/*! Switch from the arena to the pools; called once initialization is complete */
+void talloc_emb_init_done(void)
+{
+	unsigned int i, j;
+
+	for (i = 0; i < ARRAY_SIZE(emb_pools); i++) {
+		struct emb_pool *pool = &emb_pools[i];
+		size_t block_size = sizeof(struct emb_chunk) + pool->size;
+		uint8_t *mem = emb_arena_alloc(block_size * pool->num);
+
+		OSMO_ASSERT(mem);
+		for (j = 0; j < pool->num; j++) {
+			void *block = mem + j * block_size;
+			*(void **)block = pool->free;
+			pool->free = block;
+		}
+	}
+	emb_arena_state.init_done = true;
+}
+
+/*! Print arena and pool usage */
+void talloc_emb_print_stats(void)
+{
+	unsigned int i;
+
+	printf("arena: %u/%u bytes, exhausted %lu, leaked %lu\r\n", (unsigned int)emb_arena_state.used,
+		(unsigned int)sizeof(emb_arena), (unsigned long)emb_arena_state.exhausted,
+		(unsigned long)emb_arena_state.leaked);
+	for (i = 0; i < ARRAY_SIZE(emb_pools); i++) {
+		const struct emb_pool *pool = &emb_pools[i];
+		printf("pool %3u bytes: %u/%u used, high water %u, exhausted %lu\r\n", pool->size,
+			pool->used, pool->num, pool->high_water, (unsigned long)pool->exhausted);
+	}
+}
+
+/***********************************************************************
+ * talloc API
+ ***********************************************************************/
+
+void *talloc_named_const(const void *context, size_t size, const char *name)
+{
+	struct emb_chunk *tc = emb_alloc(size, name);
+
+	return tc ? EMB_PTR(tc) : NULL;
+}
+
+void *_talloc(const void *context, size_t size)
+{
+	return talloc_named_const(context, size, NULL);
+}
+
+void *talloc_named(const void *context, size_t size, const char *fmt, ...)
+{
+	/* the name is not formatted, it is for debugging only */
+	return talloc_named_const(context, size, fmt);
+}
+
+void *talloc_init(const char *fmt, ...)
+{
+	return talloc_named_const(NULL, 0, fmt);
+}
+
+void *_talloc_zero(const void *ctx, size_t size, const char *name)
+{
+	void *ptr = talloc_named_const(ctx, size, name);
+
+	if (ptr)
+		memset(ptr, 0, size);
+	return ptr;
+}
+
+void *_talloc_array(const void *ctx, size_t el_size, unsigned count, const char *name)
+{
+	if (count && el_size > UINT16_MAX / count)
+		return NULL;
+	return talloc_named_const(ctx, el_size * count, name);
+}
+
+void *_talloc_zero_array(const void *ctx, size_t el_size, unsigned count, const char *name)
+{
+	if (count && el_size > UINT16_MAX / count)
+		return NULL;
+	return _talloc_zero(ctx, el_size * count, name);
+}
+
+void *_talloc_memdup(const void *t, const void *p, size_t size, const char *name)
+{
+	void *ptr = talloc_named_const(t, size, name);
+
+	if (ptr)
+		memcpy(ptr, p, size);
+	return ptr;
+}
+
+void *talloc_pool(const void *context, size_t size)
+{
+	return talloc_named_const(context, 0, "talloc_pool");
+}
+
+int _talloc_free(void *ptr, const char *location)
+{
+	struct emb_chunk *tc;
+	struct emb_pool *pool;
+
+	if (!ptr)
+		return -1;
+	tc = EMB_CHUNK(ptr);
+
+	if (tc->destructor) {
+		int (*d)(void *) = tc->destructor;
+
+		if (d == (void *)-1)
+			return -1;
+		/* protect against recursion from within the destructor */
+		tc->destructor = (void *)-1;
+		if (d(ptr) == -1) {
+			if (tc->destructor == (void *)-1)
+				tc->destructor = d;
+			return -1;
+		}
+		tc->destructor = NULL;
+	}
+
+	if (tc->pool == EMB_POOL_ARENA) {
+		emb_arena_state.leaked++;
+		/* harmless during init; at runtime, the memory is lost for good and allocating it
+		 * again takes from the pools, so repeated frees must be found */
+		if (emb_arena_state.init_done)
+			printf("talloc: arena chunk '%s' (%u bytes) freed after init at %s, leaked\r\n",
+				tc->name ? tc->name : "", tc->size, location ? location : "?");
+		return 0;
+	}
+
+	pool = &emb_pools[tc->pool];
+	CRITICAL_SECTION_ENTER()
+	*(void **)tc = pool->free;
+	pool->free = tc;
+	pool->used--;
+	CRITICAL_SECTION_LEAVE()
+	return 0;
+}
+
+void talloc_free_children(void *ptr)
+{
+}
+
+int talloc_unlink(const void *context, void *ptr)
+{
+	return _talloc_free(ptr, NULL);
+}
+
+void _talloc_set_destructor(const void *ptr, int (*destructor)(void *))
+{
+	EMB_CHUNK(ptr)->destructor = destructor;
+}
+
+void *_talloc_steal_loc(const void *new_ctx, const void *ptr, const char *location)
+{
+	return (void *)ptr;
+}
+
+void *_talloc_move(const void *new_ctx, const void *_pptr)
+{
+	const void **pptr = (const void **)_pptr;
+	void *ret = (void *)*pptr;
+
+	*pptr = NULL;
+	return ret;
+}
+
+void *talloc_parent(const void *ptr)
+{
+	return NULL;
+}
+
+void talloc_set_name_const(const void *ptr, const char *name)
+{
+	EMB_CHUNK(ptr)->name = name;
+}
+
+const char *talloc_get_name(const void *ptr)
+{
+	const char *name = EMB_CHUNK(ptr)->name;
+
+	return name ? name : "UNNAMED";
+}
+
+void *talloc_check_name(const void *ptr, const char *name)
+{
+	if (ptr && !strcmp(talloc_get_name(ptr), name))
+		return (void *)ptr;
+	return NULL;
+}
+
+void *_talloc_get_type_abort(const void *ptr, const char *name, const char *location)
+{
+	void *ret = talloc_check_name(ptr, name);
+
+	OSMO_ASSERT(ret);
+	return ret;
+}
+
+size_t talloc_get_size(const void *ctx)
+{
+	return ctx ? EMB_CHUNK(ctx)->size : 0;
+}
+
+size_t talloc_total_size(const void *ptr)
+{
+	size_t total = 0;
+	unsigned int i;
+
+	if (ptr)
+		return talloc_get_size(ptr);
+	for (i = 0; i < ARRAY_SIZE(emb_pools); i++)
+		total += emb_pools[i].used * emb_pools[i].size;
+	return emb_arena_state.used + total;
+}
+
+size_t talloc_total_blocks(const void *ptr)
+{
+	return ptr ? 1 : 0;
+}
+
+void *_talloc_realloc(const void *context, void *ptr, size_t size, const char *name)
+{
+	struct emb_chunk *tc;
+	void *new;
+
+	if (!ptr)
+		return talloc_named_const(context, size, name);
+	if (!size) {
+		_talloc_free(ptr, NULL);
+		return NULL;
+	}
+
+	tc = EMB_CHUNK(ptr);
+	if (size <= emb_capacity(tc)) {
+		tc->size = size;
+		tc->name = name;
+		return ptr;
+	}
+
+	new = talloc_named_const(context, size, name);
+	if (!new)
+		return NULL;
+	memcpy(new, ptr, tc->size);
+	_talloc_free(ptr, NULL);
+	return new;
+}
+
+void *_talloc_realloc_array(const void *ctx, void *ptr, size_t el_size, unsigned count, const char *name)
+{
+	if (count && el_size > UINT16_MAX / count)
+		return NULL;
+	return _talloc_realloc(ctx, ptr, el_size * count, name);
+}
+
+char *talloc_strndup(const void *t, const char *p, size_t n)
+{
+	size_t len = strnlen(p, n);
+	char *s = talloc_named_const(t, len + 1, NULL);
+
+	if (!s)
+		return NULL;
+	memcpy(s, p, len);
+	s[len] = '\0';
+	talloc_set_name_const(s, s);
+	return s;
+}
+
+char *talloc_strdup(const void *t, const char *p)
+{
+	return p ? talloc_strndup(t, p, SIZE_MAX) : NULL;
+}
+
+char *talloc_vasprintf(const void *t, const char *fmt, va_list ap)
+{
+	va_list ap2;
+	char *s;
+	int len;
+
+	va_copy(ap2, ap);
+	len = vsnprintf(NULL, 0, fmt, ap2);
+	va_end(ap2);
+	if (len < 0)
+		return NULL;
+
+	s = talloc_named_const(t, len + 1, NULL);
+	if (!s)
+		return NULL;
+	vsnprintf(s, len + 1, fmt, ap);
+	talloc_set_name_const(s, s);
+	return s;
+}
+
+char *talloc_asprintf(const void *t, const char *fmt, ...)
+{
+	va_list ap;
+	char *s;
+
+	va_start(ap, fmt);
+	s = talloc_vasprintf(t, fmt, ap);
+	va_end(ap);
+	return s;
+}
+
+char *talloc_vasprintf_append(char *s, const char *fmt, va_list ap)
+{
+	va_list ap2;
+	size_t slen;
+	int len;
+
+	if (!s)
+		return talloc_vasprintf(NULL, fmt, ap);
+
+	va_copy(ap2, ap);
+	len = vsnprintf(NULL, 0, fmt, ap2);
+	va_end(ap2);
+	if (len < 0)
+		return NULL;
+
+	slen = strlen(s);
+	s = _talloc_realloc(NULL, s, slen + len + 1, NULL);
+	if (!s)
+		return NULL;
+	vsnprintf(s + slen, len + 1, fmt, ap);
+	talloc_set_name_const(s, s);
+	return s;
+}
+
+char *talloc_asprintf_append(char *s, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	s = talloc_vasprintf_append(s, fmt, ap);
+	va_end(ap);
+	return s;
+}
+
+char *talloc_strdup_append(char *s, const char *a)
+{
+	return talloc_asprintf_append(s, "%s", a);
+}
+
+int talloc_set_memlimit(const void *ctx, size_t max_size)
+{
+	return 0;
+}
+
+void talloc_enable_null_tracking(void)
+{
+}
+
+void talloc_disable_null_tracking(void)
+{
+}
+
+void talloc_report_full(const void *ptr, FILE *f)
+{
+	talloc_emb_print_stats();
+}
+
+void talloc_report(const void *ptr, FILE *f)
+{
+	talloc_emb_print_stats();
+}
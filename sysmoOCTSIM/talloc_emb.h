@@ -0,0 +1,7 @@
+#pragma once
+
+/* Memory allocator behind the talloc API when the firmware is built without TALLOC_DEBUG:
+ * a bump arena during initialization, fixed size pools afterwards. */
+
+void talloc_emb_init_done(void);
+void talloc_emb_print_stats(void);
@@ -42,23 +42,28 @@ struct ccid_df_func_data {
 	const struct usb_ccid_class_descriptor *ccid_cd;
 };
 
-static struct usbdf_driver _ccid_df;
-static struct ccid_df_func_data _ccid_df_funcd;
+/* one function per CCID interface, each takes the first one not yet taken */
+static struct usbdf_driver _ccid_df[CCID_NUM_IFACES];
+static struct ccid_df_func_data _ccid_df_funcd[CCID_NUM_IFACES];
 
 extern const struct usb_desc_collection usb_fs_descs;
 
 void ccid_eps_enable(void)
 {
+	uint8_t i;
+
 	while (!ccid_df_is_enabled())
 		;
 
 	CRITICAL_SECTION_ENTER()
-	usb_d_ep_disable(_ccid_df_funcd.func_ep_in);
-	usb_d_ep_enable(_ccid_df_funcd.func_ep_in);
-	usb_d_ep_disable(_ccid_df_funcd.func_ep_irq);
-	usb_d_ep_enable(_ccid_df_funcd.func_ep_irq);
-	usb_d_ep_disable(_ccid_df_funcd.func_ep_out);
-	usb_d_ep_enable(_ccid_df_funcd.func_ep_out);
+	for (i = 0; i < CCID_NUM_IFACES; i++) {
+		usb_d_ep_disable(_ccid_df_funcd[i].func_ep_in);
+		usb_d_ep_enable(_ccid_df_funcd[i].func_ep_in);
+		usb_d_ep_disable(_ccid_df_funcd[i].func_ep_irq);
+		usb_d_ep_enable(_ccid_df_funcd[i].func_ep_irq);
+		usb_d_ep_disable(_ccid_df_funcd[i].func_ep_out);
+		usb_d_ep_enable(_ccid_df_funcd[i].func_ep_out);
+	}
 	CRITICAL_SECTION_LEAVE()
 }
 
@@ -91,6 +96,7 @@ static int32_t ccid_df_enable(struct usbdf_driver *drv, struct usbd_descriptors
 		return ERR_NO_RESOURCE;
 
 	func_data->func_iface = ifc_desc.bInterfaceNumber;
+	func_data->ccid_cd = (const struct usb_ccid_class_descriptor *)usb_find_desc(ifc, desc->eod, 33);
 
 	ep = usb_find_desc(ifc, desc->eod, USB_DT_ENDPOINT);
 	while (NULL != ep) {
@@ -120,7 +126,13 @@ static int32_t ccid_df_enable(struct usbdf_driver *drv, struct usbd_descriptors
 	ASSERT(func_data->func_ep_in != 0xff);
 	ASSERT(func_data->func_ep_out != 0xff);
 
-	_ccid_df_funcd.enabled = true;
+	/* ping-pong the bulk endpoints, so the next transfer can be queued while one is
+	 * ongoing; without, the endpoint just returns busy for the second one. This fails
+	 * if the bulk IN and OUT endpoint share their number, they stay single-bank then */
+	usb_d_ep_set_dual_bank(func_data->func_ep_in);
+	usb_d_ep_set_dual_bank(func_data->func_ep_out);
+
+	func_data->enabled = true;
 	return ERR_NONE;
 }
 
@@ -149,7 +161,7 @@ static int32_t ccid_df_disable(struct usbdf_driver *drv, struct usbd_descriptors
 		func_data->func_ep_irq = 0xff;
 	}
 
-	_ccid_df_funcd.enabled = false;
+	func_data->enabled = false;
 	return ERR_NONE;
 }
 
@@ -169,10 +181,10 @@ static int32_t ccid_df_ctrl(struct usbdf_driver *drv, enum usbdf_control ctrl, v
 }
 
 /* Section 5.3.1: ABORT */
-static int32_t ccid_df_ctrl_req_ccid_abort(uint8_t ep, struct usb_req *req,
-					   enum usb_ctrl_stage stage)
+static int32_t ccid_df_ctrl_req_ccid_abort(const struct ccid_df_func_data *func_data, uint8_t ep,
+					   struct usb_req *req, enum usb_ctrl_stage stage)
 {
-	const struct usb_ccid_class_descriptor *ccid_cd = _ccid_df_funcd.ccid_cd;
+	const struct usb_ccid_class_descriptor *ccid_cd = func_data->ccid_cd;
 	uint8_t slot_nr = req->wValue & 0xff;
 
 	if (slot_nr > ccid_cd->bMaxSlotIndex)
@@ -185,10 +197,10 @@ static int32_t ccid_df_ctrl_req_ccid_abort(uint8_t ep, struct usb_req *req,
 }
 
 /* Section 5.3.2: return array of DWORD containing clock frequencies in kHz */
-static int32_t ccid_df_ctrl_req_ccid_get_clock_freq(uint8_t ep, struct usb_req *req,
-						    enum usb_ctrl_stage stage)
+static int32_t ccid_df_ctrl_req_ccid_get_clock_freq(const struct ccid_df_func_data *func_data, uint8_t ep,
+						    struct usb_req *req, enum usb_ctrl_stage stage)
 {
-	const struct usb_ccid_class_descriptor *ccid_cd = _ccid_df_funcd.ccid_cd;
+	const struct usb_ccid_class_descriptor *ccid_cd = func_data->ccid_cd;
 
 	if (stage != USB_DATA_STAGE)
 		return ERR_NONE;
@@ -200,10 +212,10 @@ static int32_t ccid_df_ctrl_req_ccid_get_clock_freq(uint8_t ep, struct usb_req *
 }
 
 /* Section 5.3.3: return array of DWORD containing data rates in bps */
-static int32_t ccid_df_ctrl_req_ccid_get_data_rates(uint8_t ep, struct usb_req *req,
-						    enum usb_ctrl_stage stage)
+static int32_t ccid_df_ctrl_req_ccid_get_data_rates(const struct ccid_df_func_data *func_data, uint8_t ep,
+						    struct usb_req *req, enum usb_ctrl_stage stage)
 {
-	const struct usb_ccid_class_descriptor *ccid_cd = _ccid_df_funcd.ccid_cd;
+	const struct usb_ccid_class_descriptor *ccid_cd = func_data->ccid_cd;
 
 	if (stage != USB_DATA_STAGE)
 		return ERR_NONE;
@@ -218,6 +230,9 @@ static int32_t ccid_df_ctrl_req_ccid_get_data_rates(uint8_t ep, struct usb_req *
 /* process a control endpoint request */
 static int32_t ccid_df_ctrl_req(uint8_t ep, struct usb_req *req, enum usb_ctrl_stage stage)
 {
+	const struct ccid_df_func_data *func_data = NULL;
+	uint8_t i;
+
 	/* ERR_NOT_FOUND defers to default handlers which do the right thing */
 	if (stage == USB_SETUP_STAGE) {
 		if ((req->bmRequestType & USB_REQT_RECIP_MASK) == USB_REQT_RECIP_ENDPOINT) {
@@ -256,22 +271,26 @@ static int32_t ccid_df_ctrl_req(uint8_t ep, struct usb_req *req, enum usb_ctrl_s
                 return ERR_NOT_FOUND;
 
 	/* Verify req->wIndex == interface */
-	if (req->wIndex != _ccid_df_funcd.func_iface)
+	for (i = 0; i < CCID_NUM_IFACES; i++) {
+		if (req->wIndex == _ccid_df_funcd[i].func_iface)
+			func_data = &_ccid_df_funcd[i];
+	}
+	if (!func_data)
                 return ERR_NOT_FOUND;
 
 	switch (req->bRequest) {
 	case CLASS_SPEC_CCID_ABORT:
 		if (req->bmRequestType & USB_EP_DIR_IN)
 			return ERR_INVALID_ARG;
-		return ccid_df_ctrl_req_ccid_abort(ep, req, stage);
+		return ccid_df_ctrl_req_ccid_abort(func_data, ep, req, stage);
 	case CLASS_SPEC_CCID_GET_CLOCK_FREQ:
 		if (!(req->bmRequestType & USB_EP_DIR_IN))
 			return ERR_INVALID_ARG;
-		return ccid_df_ctrl_req_ccid_get_clock_freq(ep, req, stage);
+		return ccid_df_ctrl_req_ccid_get_clock_freq(func_data, ep, req, stage);
 	case CLASS_SPEC_CCID_GET_DATA_RATES:
 		if (!(req->bmRequestType & USB_EP_DIR_IN))
 			return ERR_INVALID_ARG;
-		return ccid_df_ctrl_req_ccid_get_data_rates(ep, req, stage);
+		return ccid_df_ctrl_req_ccid_get_data_rates(func_data, ep, req, stage);
 	default:
 		return ERR_NOT_FOUND;
 	}
@@ -281,14 +300,23 @@ static struct usbdc_handler ccid_df_req_h = { NULL, (FUNC_PTR) ccid_df_ctrl_req
 
 int32_t ccid_df_init(void)
 {
+	uint8_t i;
+
 	if (usbdc_get_state() > USBD_S_POWER)
 		return ERR_DENIED;
 
-	_ccid_df.ctrl = ccid_df_ctrl;
-	_ccid_df.func_data = &_ccid_df_funcd;
-
-	/* register the actual USB Function */
-	usbdc_register_function(&_ccid_df);
+	for (i = 0; i < CCID_NUM_IFACES; i++) {
+		_ccid_df[i].ctrl = ccid_df_ctrl;
+		_ccid_df[i].func_data = &_ccid_df_funcd[i];
+		/* not yet bound to an interface */
+		_ccid_df_funcd[i].func_iface = 0xff;
+		_ccid_df_funcd[i].func_ep_in = 0xff;
+		_ccid_df_funcd[i].func_ep_out = 0xff;
+		_ccid_df_funcd[i].func_ep_irq = 0xff;
+
+		/* register the actual USB Function */
+		usbdc_register_function(&_ccid_df[i]);
+	}
 	/* register the call-back for control endpoint handling */
 	usbdc_register_handler(USBDC_HDL_REQ, &ccid_df_req_h);
 
@@ -297,43 +325,49 @@ int32_t ccid_df_init(void)
 
 void ccid_df_deinit(void)
 {
-	usb_d_ep_deinit(_ccid_df_funcd.func_ep_in);
-	usb_d_ep_deinit(_ccid_df_funcd.func_ep_out);
-	usb_d_ep_deinit(_ccid_df_funcd.func_ep_irq);
+	uint8_t i;
+
+	for (i = 0; i < CCID_NUM_IFACES; i++) {
+		usb_d_ep_deinit(_ccid_df_funcd[i].func_ep_in);
+		usb_d_ep_deinit(_ccid_df_funcd[i].func_ep_out);
+		usb_d_ep_deinit(_ccid_df_funcd[i].func_ep_irq);
+	}
 }
 
-int32_t ccid_df_read_out(uint8_t *buf, uint32_t size)
+int32_t ccid_df_read_out(uint8_t idx, uint8_t *buf, uint32_t size)
 {
-	if (!ccid_df_is_enabled())
+	if (!_ccid_df_funcd[idx].enabled)
 		return ERR_DENIED;
-	return usbdc_xfer(_ccid_df_funcd.func_ep_out, buf, size, false);
+	return usbdc_xfer(_ccid_df_funcd[idx].func_ep_out, buf, size, false);
 }
 
-int32_t ccid_df_write_in(uint8_t *buf, uint32_t size)
+int32_t ccid_df_write_in(uint8_t idx, uint8_t *buf, uint32_t size)
 {
-	if (!ccid_df_is_enabled())
+	if (!_ccid_df_funcd[idx].enabled)
 		return ERR_DENIED;
-	return usbdc_xfer(_ccid_df_funcd.func_ep_in, buf, size, true);
+	return usbdc_xfer(_ccid_df_funcd[idx].func_ep_in, buf, size, true);
 }
 
-int32_t ccid_df_write_irq(uint8_t *buf, uint32_t size)
+int32_t ccid_df_write_irq(uint8_t idx, uint8_t *buf, uint32_t size)
 {
-	if (!ccid_df_is_enabled())
+	if (!_ccid_df_funcd[idx].enabled)
 		return ERR_DENIED;
-	return usbdc_xfer(_ccid_df_funcd.func_ep_irq, buf, size, true);
+	return usbdc_xfer(_ccid_df_funcd[idx].func_ep_irq, buf, size, true);
 }
 
-int32_t ccid_df_register_callback(enum ccid_df_cb_type cb_type, FUNC_PTR func)
+int32_t ccid_df_register_callback(uint8_t idx, enum ccid_df_cb_type cb_type, FUNC_PTR func)
 {
+	struct ccid_df_func_data *func_data = &_ccid_df_funcd[idx];
+
 	switch (cb_type) {
 	case CCID_DF_CB_READ_OUT:
-		usb_d_ep_register_callback(_ccid_df_funcd.func_ep_out, USB_D_EP_CB_XFER, func);
+		usb_d_ep_register_callback(func_data->func_ep_out, USB_D_EP_CB_XFER, func);
 		break;
 	case CCID_DF_CB_WRITE_IN:
-		usb_d_ep_register_callback(_ccid_df_funcd.func_ep_in, USB_D_EP_CB_XFER, func);
+		usb_d_ep_register_callback(func_data->func_ep_in, USB_D_EP_CB_XFER, func);
 		break;
 	case CCID_DF_CB_WRITE_IRQ:
-		usb_d_ep_register_callback(_ccid_df_funcd.func_ep_irq, USB_D_EP_CB_XFER, func);
+		usb_d_ep_register_callback(func_data->func_ep_irq, USB_D_EP_CB_XFER, func);
 		break;
 	default:
 		return ERR_INVALID_ARG;
@@ -341,7 +375,28 @@ int32_t ccid_df_register_callback(enum ccid_df_cb_type cb_type, FUNC_PTR func)
 	return ERR_NONE;
 }
 
+/*! \brief Find the CCID function (interface) of an endpoint
+ *  \return index of the function, -1 if none has the endpoint */
+int8_t ccid_df_ep_to_idx(uint8_t ep)
+{
+	uint8_t i;
+
+	for (i = 0; i < CCID_NUM_IFACES; i++) {
+		const struct ccid_df_func_data *func_data = &_ccid_df_funcd[i];
+		if (ep == func_data->func_ep_in || ep == func_data->func_ep_out || ep == func_data->func_ep_irq)
+			return i;
+	}
+	return -1;
+}
+
+/*! \brief Check if all CCID functions are enabled */
 bool ccid_df_is_enabled(void)
 {
-	return _ccid_df_funcd.enabled;
+	uint8_t i;
+
+	for (i = 0; i < CCID_NUM_IFACES; i++) {
+		if (!_ccid_df_funcd[i].enabled)
+			return false;
+	}
+	return true;
 }
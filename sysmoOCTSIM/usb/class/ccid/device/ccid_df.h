@@ -10,9 +10,11 @@ enum ccid_df_cb_type {
 
 int32_t ccid_df_init(void);
 void ccid_df_deinit(void);
-int32_t ccid_df_read_out(uint8_t *buf, uint32_t size);
-int32_t ccid_df_write_in(uint8_t *buf, uint32_t size);
-int32_t ccid_df_write_irq(uint8_t *buf, uint32_t size);
-int32_t ccid_df_register_callback(enum ccid_df_cb_type cb_type, FUNC_PTR ptr);
+/* idx: CCID function (interface), 0 .. CCID_NUM_IFACES-1 */
+int32_t ccid_df_read_out(uint8_t idx, uint8_t *buf, uint32_t size);
+int32_t ccid_df_write_in(uint8_t idx, uint8_t *buf, uint32_t size);
+int32_t ccid_df_write_irq(uint8_t idx, uint8_t *buf, uint32_t size);
+int32_t ccid_df_register_callback(uint8_t idx, enum ccid_df_cb_type cb_type, FUNC_PTR ptr);
+int8_t ccid_df_ep_to_idx(uint8_t ep);
 bool ccid_df_is_enabled(void);
 void ccid_eps_enable(void);
@@ -25,6 +25,75 @@
 #include "usb_descriptors.h"
 
 
+/* one CCID interface with its bulk OUT, bulk IN and interrupt endpoints */
+#define CCID_IF_DESCRIPTOR(idx, ep_out, ep_in, ep_irq)						\
+	.iface = {										\
+		.bLength = sizeof(struct usb_iface_desc),					\
+		.bDescriptorType = USB_DT_INTERFACE,						\
+		.bInterfaceNumber = CCID_IFACE_NUM(idx),					\
+		.bAlternateSetting = 0,								\
+		.bNumEndpoints = 3,								\
+		.bInterfaceClass = 11,								\
+		.bInterfaceSubClass = 0,							\
+		.bInterfaceProtocol = 0,							\
+		.iInterface = STR_DESC_INTF_CCID,						\
+	},											\
+	.class = {										\
+		.bLength = sizeof(struct usb_ccid_class_descriptor),				\
+		.bDescriptorType = 33,								\
+		.bcdCCID = LE16(0x0110),							\
+		.bMaxSlotIndex = CCID_SLOTS_PER_IFACE - 1,					\
+		.bVoltageSupport = 0x07, /* 5/3/1.8V */						\
+		.dwProtocols = 0x01, /* only t0 */						\
+		.dwDefaultClock = LE32(2500),							\
+		.dwMaximumClock = LE32(20000),							\
+		.bNumClockSupported = CCID_NUM_CLK_SUPPORTED,					\
+		.dwDataRate = LE32(6720), /* default clock 2.5M/372 */				\
+		.dwMaxDataRate = LE32(921600),							\
+		.bNumDataRatesSupported = 0,							\
+		.dwMaxIFSD = LE32(0),								\
+		.dwSynchProtocols = LE32(0),							\
+		.dwMechanical = LE32(0),							\
+		/* 0x10000 TPDU level exchanges with CCID					\
+		 * 0x80 Automatic PPS made by the CCID according to the active parameters	\
+		 * 0x20 Automatic baud rate change according to active parameters 		\
+		 * provided by the Host or self determined					\
+		 * 0x10 Automatic ICC clock frequency change according to active parameters	\
+		 *  provided by the Host or self determined */					\
+		.dwFeatures = LE32(0x10 | 0x20 | 0x80 | 0x00010000),				\
+		.dwMaxCCIDMessageLength = 272,							\
+		.bClassGetResponse = 0xff,							\
+		.bClassEnvelope = 0xff,								\
+		.wLcdLayout = LE16(0),								\
+		.bPINSupport = 0,								\
+		.bMaxCCIDBusySlots = CCID_SLOTS_PER_IFACE,					\
+	},											\
+	.ep = {											\
+		{	/* Bulk-OUT descriptor */						\
+			.bLength = sizeof(struct usb_ep_desc),					\
+			.bDescriptorType = USB_DT_ENDPOINT,					\
+			.bEndpointAddress = ep_out,						\
+			.bmAttributes = USB_EP_TYPE_BULK,					\
+			.wMaxPacketSize = 64,							\
+			.bInterval = 0,								\
+		},										\
+		{ 	/* Bulk-IN descriptor */						\
+			.bLength = sizeof(struct usb_ep_desc),					\
+			.bDescriptorType = USB_DT_ENDPOINT,					\
+			.bEndpointAddress = ep_in,						\
+			.bmAttributes = USB_EP_TYPE_BULK,					\
+			.wMaxPacketSize = 64,							\
+			.bInterval = 0,								\
+		},										\
+		{	/* Interrupt dscriptor */						\
+			.bLength = sizeof(struct usb_ep_desc),					\
+			.bDescriptorType = USB_DT_ENDPOINT,					\
+			.bEndpointAddress = ep_irq,						\
+			.bmAttributes = USB_EP_TYPE_INTERRUPT,					\
+			.wMaxPacketSize = 64,							\
+			.bInterval = 0x10,							\
+		},										\
+	},
 
 const struct usb_desc_collection usb_fs_descs = {
 	.dev = {
@@ -50,13 +119,12 @@ const struct usb_desc_collection usb_fs_descs = {
 				sizeof(usb_fs_descs.cdc) +
 #endif
 				sizeof(usb_fs_descs.ccid) +
+#ifdef WITH_VENDOR_IF
+				sizeof(usb_fs_descs.vendor) +
+#endif
 				sizeof(usb_fs_descs.dfu_rt) +
 				sizeof(usb_fs_descs.func_dfu),
-#ifdef WITH_DEBUG_CDC
-		.bNumInterfaces = 4,
-#else
-		.bNumInterfaces = 2,
-#endif
+		.bNumInterfaces = USB_NUM_CDC_IFACES + CCID_NUM_IFACES + USB_NUM_VENDOR_IFACES + 1,
 		.bConfigurationValue = CONF_USB_CDCD_ACM_BCONFIGVAL,
 		.iConfiguration = STR_DESC_CONFIG,
 		.bmAttributes = CONF_USB_CDCD_ACM_BMATTRI,
@@ -147,80 +215,54 @@ const struct usb_desc_collection usb_fs_descs = {
 		},
 	},
 #endif
+	/* Each dual-bank bulk EP needs both banks of its number. The OUT EP stays 0x02 as the
+	 * hosts know it, unless the debug CDC takes 0x82. The second interface has to share the
+	 * numbers of its bulk EPs, they are single-bank */
 	.ccid = {
+#ifdef WITH_DEBUG_CDC
+		{ CCID_IF_DESCRIPTOR(0, 0x05, 0x83, 0x84) },
+#else
+		{ CCID_IF_DESCRIPTOR(0, 0x02, 0x83, 0x84) },
+#endif
+#if CCID_NUM_IFACES > 1
+		{ CCID_IF_DESCRIPTOR(1, 0x06, 0x86, 0x87) },
+#endif
+	},
+#ifdef WITH_VENDOR_IF
+	/* dual-bank as well, on the numbers left free by the CCID interface */
+	.vendor = {
 		.iface = {
 			.bLength = sizeof(struct usb_iface_desc),
 			.bDescriptorType = USB_DT_INTERFACE,
-			.bInterfaceNumber = 0,
+			.bInterfaceNumber = VENDOR_IFACE_NUM,
 			.bAlternateSetting = 0,
-			.bNumEndpoints = 3,
-			.bInterfaceClass = 11,
-			.bInterfaceSubClass = 0,
-			.bInterfaceProtocol = 0,
-			.iInterface = STR_DESC_INTF_CCID,
-		},
-		.class = {
-			.bLength = sizeof(struct usb_ccid_class_descriptor),
-			.bDescriptorType = 33,
-			.bcdCCID = LE16(0x0110),
-			.bMaxSlotIndex = 7,
-			.bVoltageSupport = 0x07, /* 5/3/1.8V */
-			.dwProtocols = 0x01, /* only t0 */
-			.dwDefaultClock = LE32(2500),
-			.dwMaximumClock = LE32(20000),
-			.bNumClockSupported = CCID_NUM_CLK_SUPPORTED,
-			.dwDataRate = LE32(6720), /* default clock 2.5M/372 */
-			.dwMaxDataRate = LE32(921600),
-			.bNumDataRatesSupported = 0,
-			.dwMaxIFSD = LE32(0),
-			.dwSynchProtocols = LE32(0),
-			.dwMechanical = LE32(0),
-			/* 0x10000 TPDU level exchanges with CCID
-			 * 0x80 Automatic PPS made by the CCID according to the active parameters
-			 * 0x20 Automatic baud rate change according to active parameters 
-			 * provided by the Host or self determined
-			 * 0x10 Automatic ICC clock frequency change according to active parameters
-			 *  provided by the Host or self determined */
-			.dwFeatures = LE32(0x10 | 0x20 | 0x80 | 0x00010000),
-			.dwMaxCCIDMessageLength = 272,
-			.bClassGetResponse = 0xff,
-			.bClassEnvelope = 0xff,
-			.wLcdLayout = LE16(0),
-			.bPINSupport = 0,
-			.bMaxCCIDBusySlots = 8,
+			.bNumEndpoints = 2,
+			.bInterfaceClass = 0xff,
+			.bInterfaceSubClass = 0x00,
+			.bInterfaceProtocol = 0x00,
+			.iInterface = 0,
 		},
 		.ep = {
-			{	/* Bulk-OUT descriptor */
+			{
 				.bLength = sizeof(struct usb_ep_desc),
 				.bDescriptorType = USB_DT_ENDPOINT,
-				.bEndpointAddress = 0x02,
+				.bEndpointAddress = 0x06,
 				.bmAttributes = USB_EP_TYPE_BULK,
 				.wMaxPacketSize = 64,
 				.bInterval = 0,
 			},
-			{ 	/* Bulk-IN descriptor */
+			{
 				.bLength = sizeof(struct usb_ep_desc),
 				.bDescriptorType = USB_DT_ENDPOINT,
-				.bEndpointAddress = 0x83,
+				.bEndpointAddress = 0x87,
 				.bmAttributes = USB_EP_TYPE_BULK,
 				.wMaxPacketSize = 64,
 				.bInterval = 0,
 			},
-			{	/* Interrupt dscriptor */
-				.bLength = sizeof(struct usb_ep_desc),
-				.bDescriptorType = USB_DT_ENDPOINT,
-				.bEndpointAddress = 0x84,
-				.bmAttributes = USB_EP_TYPE_INTERRUPT,
-				.wMaxPacketSize = 64,
-				.bInterval = 0x10,
-			},
 		},
 	},
-#ifdef WITH_DEBUG_CDC
-	DFURT_IF_DESCRIPTOR(3, STR_DESC_INTF_DFURT),
-#else
-	DFURT_IF_DESCRIPTOR(1, STR_DESC_INTF_DFURT),
 #endif
+	DFURT_IF_DESCRIPTOR(DFURT_IFACE_NUM, STR_DESC_INTF_DFURT),
 	.str = {
 #if 0
 		CDCD_ACM_STR_DESCES
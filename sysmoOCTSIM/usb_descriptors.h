@@ -24,6 +24,41 @@
 
 #define CCID_NUM_CLK_SUPPORTED 4
 
+/* Number of CCID interfaces the slots are split over. Host drivers serialize the commands
+ * to the slots of one interface, but drive the interfaces in parallel. Each one needs its
+ * own bulk OUT, bulk IN and interrupt IN endpoint. IN endpoints are what runs out: the
+ * SAME54 has 7 besides EP0, so even single-bank and without the debug CDC 4 interfaces
+ * (8 IN endpoints) don't fit, and 3 doesn't split the slots evenly. */
+#ifndef CCID_NUM_IFACES
+#define CCID_NUM_IFACES 1
+#endif
+#if CCID_NUM_IFACES != 1 && CCID_NUM_IFACES != 2
+#error "CCID_NUM_IFACES must be 1 or 2"
+#endif
+#define CCID_SLOTS_PER_IFACE (NR_SLOTS / CCID_NUM_IFACES)
+
+#ifdef WITH_DEBUG_CDC
+#define USB_NUM_CDC_IFACES 2
+#else
+#define USB_NUM_CDC_IFACES 0
+#endif
+/* Optional vendor specific bulk interface for high-rate hosts, see ccid_vendor.h. It takes
+ * the endpoint numbers a second CCID interface would use. */
+#ifdef WITH_VENDOR_IF
+#if CCID_NUM_IFACES > 1
+#error "WITH_VENDOR_IF needs CCID_NUM_IFACES 1"
+#endif
+#define USB_NUM_VENDOR_IFACES 1
+#else
+#define USB_NUM_VENDOR_IFACES 0
+#endif
+
+/* the first CCID interface is 0, the others follow the debug CDC, then the vendor
+ * interface, DFU comes last */
+#define CCID_IFACE_NUM(i) ((i) ? USB_NUM_CDC_IFACES + (i) : 0)
+#define VENDOR_IFACE_NUM (USB_NUM_CDC_IFACES + CCID_NUM_IFACES)
+#define DFURT_IFACE_NUM (USB_NUM_CDC_IFACES + CCID_NUM_IFACES + USB_NUM_VENDOR_IFACES)
+
 /* aggregate descriptors for the combined CDC-ACM + CCID device that we expose
  * from sysmoQMOD */
 
@@ -61,12 +96,19 @@ struct usb_desc_collection {
 	} cdc;
 
 #endif
-	/* CCID: One interface with CCID class descriptor and three endpoints */
+	/* CCID: Interfaces with CCID class descriptor and three endpoints each */
 	struct {
 		struct usb_iface_desc iface;
 		struct usb_ccid_class_descriptor class;
 		struct usb_ep_desc ep[3];
-	} ccid;
+	} ccid[CCID_NUM_IFACES];
+#ifdef WITH_VENDOR_IF
+	/* vendor specific: one interface with BULK OUT + IN */
+	struct {
+		struct usb_iface_desc iface;
+		struct usb_ep_desc ep[2];
+	} vendor;
+#endif
 	DFURT_IF_DESCRIPTOR_STRUCT
 	uint8_t str[200];
 } __attribute__((packed));
@@ -144,24 +144,25 @@ void cdc_device_acm_init(void)
 
 /**
  * \brief Start USB stack
+ *
+ * Doesn't wait for the host: the CCID endpoints are set up from the main loop once
+ * it has set the configuration.
  */
 void usb_start(void)
 {
-
 #ifdef WITH_DEBUG_CDC
-	while (!cdcdf_acm_is_enabled()) {
-		// wait cdc acm to be installed
-	};
-
+	/* not bound to an endpoint, can be registered before the host configured us */
 	cdcdf_acm_register_callback(CDCDF_ACM_CB_STATE_C, (FUNC_PTR)usb_device_cb_state_c);
 #endif
-	while (!ccid_df_is_enabled());
 }
 
 void usb_init(void)
 {
 	cdc_device_acm_init();
 	ccid_df_init();
+#ifdef WITH_VENDOR_IF
+	vendor_df_init();
+#endif
 	usbdc_start((struct usbd_descriptors *) usb_descs);
 	usbdc_attach();
 
@@ -15,6 +15,9 @@ extern "C" {
 #include "cdcdf_acm.h"
 #include "cdcdf_acm_desc.h"
 #include "ccid_df.h"
+#ifdef WITH_VENDOR_IF
+#include "vendor_df.h"
+#endif
 #include "dfudf.h"
 
 